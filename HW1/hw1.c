@@ -1,3 +1,4 @@
+#define _GNU_SOURCE // qsort_r, splice and other Linux extensions
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,17 +9,104 @@
 #include <fcntl.h> // For open() constants
 #include <string.h> // For strlen()
 #include <time.h>
-#define MAX_STUDENTS 250
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "logger.h"
+
+// External sort: runs of SORT_RUN_RECORDS are sorted in memory, spilled to
+// temporary files and k-way merged, at most SORT_MAX_FANIN runs at a time
+#define SORT_RUN_RECORDS (64 * 1024)
+#define SORT_MERGE_BUFFER 1024
+#define SORT_MAX_FANIN 64
+#define LINE_READER_BUFFER (64 * 1024)
+
+// Text files get a "<file>.lidx" sidecar with the byte offset of every line
+#define LINE_INDEX_MAGIC "GTULIDX"
+#define LINE_INDEX_EXTENSION ".lidx"
+#define LINE_INDEX_BATCH 8192
+
+// showAll streams a text file to stdout in the kernel, at most STREAM_CHUNK per call
+#define STREAM_CHUNK (1 << 20)
+#define BENCH_SHOW_RUNS 5
+
+// Columnar snapshots for analytics, scanned SNAPSHOT_SCAN_ROWS rows at a time
+#define SNAPSHOT_MAGIC "GTUCOL1"
+#define SNAPSHOT_EXTENSION ".gcol"
+#define SNAPSHOT_ALIGN 64
+#define SNAPSHOT_SCAN_ROWS 65536
+
+// In-memory sorts work on (64-bit key, record) pairs split across threads
+#define SORT_PARALLEL_THRESHOLD 16384
+#define SORT_MAX_THREADS 16
+#define SORT_SMALL_RUN 32 // Equal-key runs up to this size use a comparison sort
+
+// Binary grade store: a header page followed by fixed-size StudentInfo records,
+// plus a "<file>.idx" sidecar holding record numbers sorted by name.
+#define STORE_MAGIC "GTUGRDB"
+#define INDEX_MAGIC "GTUIDX1"
+#define STORE_VERSION 2 // Version 2 added the tombstone log; version 1 stores are upgraded in place
+#define STORE_HEADER_SIZE 4096
+#define STORE_INITIAL_CAPACITY 1024
+#define STORE_EXTENSION ".db"
+
+// Updates and deletes append tombstones to "<file>.wal"; once dead records pass
+// COMPACT_GARBAGE_PERCENT of the store it is compacted and the log emptied
+#define WAL_EXTENSION ".wal"
+#define WAL_CHECK 0x5A5A5A5Au
+#define WAL_READ_BATCH 1024
+#define COMPACT_GARBAGE_PERCENT 25
+#define COMPACT_MIN_DEAD 256
+#define COMPACT_CHECK_SECONDS 1 // How often the server's compactor looks at the ratio
+
+// A reader that keeps meeting a writer spins this many times, then yields, then
+// waits on a read lock until the writer lets go
+#define STORE_READ_SPINS 64
+#define STORE_READ_YIELDS 16
+
+// Exact-name lookups use an open-addressing hash table kept in "<file>.hash"
+#define HASH_MAGIC "GTUHASH"
+#define HASH_INITIAL_SLOTS 1024
+#define HASH_MAX_LOAD 70 // Percent of slots in use before the table doubles
+
+// Daemon mode: the store stays mapped while clients talk to it over a Unix socket
+#define SERVER_DEFAULT_THREADS 4
+#define SERVER_QUEUE_SIZE 64
+#define SERVER_END_OF_REPLY ".\n" // Terminates every reply on the socket
+#define BENCH_MAX_NAMES 1024
+#define BENCH_MAX_FORK_OPS 1000
+#define SERVER_COMMIT_BATCH 256 // Appends from concurrent clients committed together
+
+// Script mode: read-only store commands run on a thread pool, up to SCRIPT_WINDOW ahead
+// of the output, which is still printed in script order
+#define SCRIPT_WINDOW 256
+#define SCRIPT_MAX_THREADS 16
+
+// Bulk imports validate a batch of records, then append it with one writev per
+// BULK_IOV_MAX segments (text) or one index merge (store)
+#define BULK_BATCH_RECORDS 4096
+#define BULK_IOV_MAX 1024 // IOV_MAX on Linux
+#define BULK_REPORT_REJECTS 5
 
 // Function prototypes
 void addStudentGrade(const char* nameSurname, const char* grade, const char* fileName);
 void searchStudent(const char* nameSurname, const char* fileName);
-void sortAll(const char* filePath, int sortMode);
+void sortAll(const char* filePath, int sortMode, const char* outputPath);
 void showAll(const char* filePath);
 void listGrades(const char* filePath);
 void listSome(int numEntries, int pageNumber, const char* filePath);
 void printUsage();
-void logMessage(const char* logFilePath, const char* operation, const char* message);
 void ensureFileExists(const char* filePath);
 
 typedef struct {
@@ -26,6 +114,311 @@ typedef struct {
     char grade[3];  // Assuming grade format is "AA", "BB", etc.
 } StudentInfo;
 
+// Letter grades accepted by bulkImport, best first, and their points in tenths
+#define NUM_GRADES 9
+static const char* const gradeNames[NUM_GRADES] = {"AA", "BA", "BB", "CB", "CC", "DC", "DD", "FD", "FF"};
+static const int gradePoints[NUM_GRADES] = {40, 35, 30, 25, 20, 15, 10, 5, 0};
+
+typedef struct {
+    uint64_t counts[NUM_GRADES + 1]; // Last slot counts grades outside the table
+    uint64_t points;                 // Sum of grade points in tenths
+} GradeTally;
+
+void tallyAdd(GradeTally* tally, const char* grade);
+void tallyRemove(GradeTally* tally, const char* grade);
+void printGradeStats(const GradeTally* tally, const char* prefix, FILE* out);
+void printHistogram(const GradeTally* tally, FILE* out);
+void gradeStats(const char* filePath, const char* prefix);
+void histogram(const char* filePath, const char* prefix);
+
+typedef struct {
+    int fd;
+    size_t start; // First unconsumed byte in buffer
+    size_t end;   // One past the last byte read
+    int eof;
+    uint64_t limit; // Bytes still allowed to be read from fd
+    char buffer[LINE_READER_BUFFER];
+} LineReader;
+
+// Text file helpers
+void lineReaderInit(LineReader* reader, int fd);
+int lineReaderNext(LineReader* reader, char** line, size_t* length);
+int parseStudentLine(const char* line, size_t length, StudentInfo* student);
+int parseGradeRecord(const char* line, size_t length, StudentInfo* student);
+int gradeIndex(const char* grade);
+size_t normalizeName(const char* name, char* out, size_t size);
+const char* scanSubstring(const char* haystack, size_t length, const char* needle, size_t needleLength);
+
+// Writers to a text grade file hold an fcntl write lock on it; readers never lock
+int textLockWrite(int fd);
+void textUnlock(int fd);
+uint64_t textStableSize(int fd, uint64_t size);
+
+typedef struct {
+    char magic[8];
+    uint64_t dataSize;        // Size, inode and mtime of the data file when indexed
+    uint64_t dataInode;
+    int64_t mtimeSeconds;
+    int64_t mtimeNanoseconds;
+    uint64_t lineCount;       // Followed by lineCount uint64_t line start offsets
+} LineIndexHeader;
+
+typedef struct {
+    int fd;
+    LineIndexHeader header;
+} LineIndex;
+
+int lineIndexOpen(LineIndex* index, const char* filePath, int dataFd);
+void lineIndexClose(LineIndex* index);
+int lineIndexRange(const LineIndex* index, uint64_t firstLine, uint64_t count, uint64_t* start, uint64_t* end);
+void lineIndexAppend(const char* filePath, const struct stat* before, const struct stat* after,
+                     const uint64_t* offsets, uint64_t count);
+int printLineRange(const char* filePath, uint64_t firstLine, uint64_t count);
+int streamFileRange(int fd, uint64_t start, uint64_t end, int outFd);
+void benchShowAll(const char* filePath, int runs, const char* outputPath);
+
+typedef struct {
+    uint64_t key;              // Order-preserving prefix of the sort fields
+    const StudentInfo* record;
+} SortKey;
+
+const char* sortModeTitle(int sortMode);
+int compareForMode(const StudentInfo* a, const StudentInfo* b, int sortMode);
+uint64_t sortKeyFor(const StudentInfo* student, int sortMode);
+SortKey* sortStudentKeys(const StudentInfo* students, size_t count, int sortMode);
+void sortStudents(StudentInfo* students, size_t count, int sortMode);
+void benchSort(size_t maxCount, int sortMode);
+int64_t externalSortGrades(int inputFd, int sortMode, FILE* out);
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+    uint64_t recordCount;
+    uint64_t capacity; // Records the data file currently has room for
+    _Atomic uint64_t sequence;       // Seqlock: odd while a writer is changing the store
+    _Atomic uint64_t hashGeneration; // Bumped whenever <store>.hash is replaced
+    GradeTally tally;                // Kept up to date by every append
+    uint64_t tallyCount;             // Records counted in tally; differs only in stores from older builds
+    uint64_t walCount;               // Tombstones in <store>.wal
+    uint64_t deadCount;              // Records that are deleted or replaced by a newer version
+    _Atomic uint64_t compactions;    // Bumped by every compaction, which renumbers records
+    // Non-zero while a compaction is moving records: (next source + 1) << 32 | next target.
+    // Until it is cleared the log still numbers records as they were before, so a store
+    // left behind by a crashed compaction can be finished on the next open.
+    _Atomic uint64_t compactCursor;
+    uint64_t storeId; // Random at creation, so an index copied from another store is noticed
+} StoreHeader;
+
+// Start of <store>.idx; counts that differ from the store's mean the index is rebuilt
+typedef struct {
+    char magic[8];
+    uint64_t storeId;     // Store the index was built for
+    uint64_t recordCount; // Records the index covers
+    uint64_t compactions; // Store's compaction count when it was last renumbered
+} IndexHeader;
+
+typedef struct {
+    uint32_t recordNumber; // Record that is no longer live
+    uint32_t check;        // recordNumber ^ WAL_CHECK, so a torn entry is ignored
+} WalEntry;
+
+typedef struct {
+    char magic[8];
+    uint64_t slotCount;   // Always a power of two
+    uint64_t recordCount; // Records hashed so far; a mismatch with the store means rebuild
+} HashHeader;
+
+typedef struct {
+    uint32_t hash;         // Hash of the normalized name
+    uint32_t recordPlusOne; // 0 marks an empty slot
+} HashSlot;
+
+typedef struct {
+    int fd;
+    int indexFd;
+    int hashFd;
+    StoreHeader* header;   // Start of the data file mapping
+    StudentInfo* records;  // Record area right after the header page
+    IndexHeader* indexHeader;
+    uint32_t* index;       // Record numbers ordered by name, right after indexHeader
+    HashHeader* hashHeader;
+    HashSlot* hashSlots;
+    size_t mapSize;
+    size_t indexMapSize;
+    size_t hashMapSize;
+    uint64_t capacity;       // Records covered by this process's mapping
+    uint64_t hashGeneration; // Generation of the hash table this process has mapped
+    int walFd;
+    uint64_t* dead;          // Bitmap of dead records, replayed from the log
+    uint64_t deadBits;
+    uint64_t walLoaded;      // Log entries already applied to the bitmap
+    uint64_t compactions;
+    char path[256];
+} GradeStore;
+
+// Read-only query run by storeRead; it may be repeated if a writer gets in the way
+typedef int (*StoreQuery)(const GradeStore* store, const void* arg, FILE* out);
+#define STORE_STALE -2 // storeTryRead: another process grew the store, call storeRefresh
+
+// Argument of querySortedCounted (sortMode) and queryRangeCounted (range)
+typedef struct {
+    int sortMode;
+    uint64_t range[2];  // First record and record count
+    uint64_t* written;  // Records the query wrote
+} CountedQuery;
+
+// Grade store prototypes
+int useGradeStore(const char* filePath);
+int storeOpen(GradeStore* store, const char* filePath);
+void storeClose(GradeStore* store);
+int storeAppend(GradeStore* store, const char* nameSurname, const char* grade);
+int storeAppendBatch(GradeStore* store, const StudentInfo* students, uint64_t count);
+uint64_t storeLowerBound(const GradeStore* store, const char* nameSurname);
+int64_t storeFind(const GradeStore* store, const char* nameSurname);
+uint64_t storeFindExact(const GradeStore* store, const char* nameSurname,
+                        void (*found)(const StudentInfo* student, void* context), void* context);
+uint64_t storeScanNames(const GradeStore* store, const char* needle,
+                        void (*found)(const StudentInfo* student, void* context), void* context);
+int storeRefresh(GradeStore* store);
+int storeTryRead(const GradeStore* store, StoreQuery query, const void* arg, FILE* out);
+int storeRead(GradeStore* store, StoreQuery query, const void* arg, FILE* out);
+int hashOpen(GradeStore* store);
+int hashAdd(GradeStore* store, uint64_t firstRecord, uint64_t count);
+int storeRemove(GradeStore* store, const char* nameSurname, const char* newGrade);
+int storeNeedsCompaction(const GradeStore* store);
+int storeCompact(GradeStore* store);
+void updateStudentGrade(const char* nameSurname, const char* grade, const char* filePath);
+void deleteStudent(const char* nameSurname, const char* filePath);
+void printStudent(const StudentInfo* student, void* context);
+int storeQuerySearch(const GradeStore* store, const char* nameSurname, FILE* out);
+int64_t storeQuerySorted(const GradeStore* store, int sortMode, FILE* out);
+uint64_t storeQueryRange(const GradeStore* store, uint64_t start, uint64_t numEntries, FILE* out);
+void storeAddStudentGrade(const char* nameSurname, const char* grade, const char* filePath);
+void storeSearchStudent(const char* nameSurname, const char* filePath);
+void storeSortAll(const char* filePath, int sortMode, const char* outputPath);
+void storeShowAll(const char* filePath);
+void storeListGrades(const char* filePath);
+void storeListSome(int numEntries, int pageNumber, const char* filePath);
+void bulkImport(const char* sourcePath, const char* targetPath);
+void exportGrades(const char* storePath, const char* textPath);
+
+// Columnar snapshot: a 64-byte header, then a 1-byte grade enum column (gradeNames index,
+// NUM_GRADES for anything else), a uint32_t name id column and the name dictionary. Every
+// column starts on a SNAPSHOT_ALIGN boundary so readers can mmap the file and scan in place.
+typedef struct {
+    char magic[8];
+    uint64_t rowCount;
+    uint64_t nameCount;
+    uint64_t gradeOffset;
+    uint64_t nameIdOffset;
+    uint64_t dictionaryOffset; // nameCount + 1 uint64_t offsets into the string blob
+    uint64_t stringsOffset;    // NUL-terminated names back to back
+    uint64_t fileSize;
+} SnapshotHeader;
+
+typedef struct {
+    const SnapshotHeader* header;
+    const uint8_t* grades;
+    const uint32_t* nameIds;
+    const uint64_t* dictionary;
+    const char* strings;
+    size_t size;
+} Snapshot;
+
+typedef struct {
+    uint8_t* grades;
+    uint32_t* nameIds;
+    uint64_t rowCount, gradeCapacity, idCapacity;
+    uint64_t* nameStarts;  // Dictionary: start of each distinct name in strings
+    uint64_t nameCount, nameCapacity;
+    char* strings;
+    uint64_t stringsSize, stringsCapacity;
+    uint32_t* slots;       // Open-addressing hash of name id + 1, 0 when empty
+    uint64_t slotCount;
+} SnapshotBuilder;
+
+int snapshotOpen(Snapshot* snapshot, const char* path);
+void snapshotClose(Snapshot* snapshot);
+const char* snapshotName(const Snapshot* snapshot, uint64_t row, size_t* length);
+uint64_t snapshotFilter(const Snapshot* snapshot, uint16_t gradeMask, uint64_t start, uint64_t end, uint32_t* rows);
+void exportSnapshot(const char* sourcePath, const char* snapshotPath);
+void scanSnapshot(const char* snapshotPath, const char* gradeList, const char* outputPath);
+
+typedef struct {
+    int* clients;
+    int size;
+    int in;
+    int out;
+    int count;
+    int done;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} ClientQueue;
+
+typedef struct {
+    StudentInfo student;
+    int* result; // 1 while pending, then 0 or -1 once committed
+} PendingAppend;
+
+typedef struct {
+    GradeStore store;
+    pthread_rwlock_t storeLock; // Readers share the store, addStudentGrade takes it exclusively
+    pthread_mutex_t commitMutex;
+    pthread_cond_t commitDone;
+    PendingAppend pending[SERVER_COMMIT_BATCH];
+    int pendingCount;
+    int committing;             // A worker is writing a batch to the store
+    pthread_t compactor;
+    pthread_mutex_t compactMutex;
+    pthread_cond_t compactWake; // Signalled after deletes and updates
+    ClientQueue queue;
+    int listenFd;
+    int numThreads;
+    int* activeClients;         // Connection each worker is serving, -1 when idle
+    volatile int stopping;
+} GradeServer;
+
+// Server mode prototypes
+void serveGrades(const char* storePath, const char* socketPath, int numThreads);
+void remoteCommand(const char* socketPath, const char* request);
+void benchServer(const char* socketPath, const char* textPath, int ops, int numClients);
+
+// Script mode: each store a script reads is opened once and shared by the workers
+typedef struct ScriptStore {
+    char path[256];
+    GradeStore store;
+    pthread_rwlock_t lock; // Taken exclusively only to refresh a stale mapping
+    struct ScriptStore* next;
+} ScriptStore;
+
+typedef struct {
+    ScriptStore* store;    // NULL for commands run in order on the main thread
+    StoreQuery query;
+    const char* title;     // Printed before the query output
+    char text[256];        // Name or prefix argument
+    uint64_t range[2];
+    int sortMode;
+    char* output;
+    size_t outputSize;
+    double seconds;
+    int done;
+} ScriptJob;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work;
+    pthread_cond_t finished;
+    ScriptJob jobs[SCRIPT_WINDOW];
+    int count;             // Jobs queued in this window
+    int next;              // Next job a worker picks up
+    int stopping;
+} ScriptPool;
+
+int runCommand(char* args[], int argCount);
+void runScript(const char* scriptPath, int numThreads);
+
 
 int compareByNameAsc(const void* a, const void* b) {
     const StudentInfo* studentA = (const StudentInfo*)a;
@@ -75,71 +468,139 @@ int main() {
 
         if (argCount == 0) continue; // If no command is entered, prompt again
 
-        // Process commands
-       if (strcmp(args[0], "addStudentGrade") == 0 && argCount >= 5) {
-    char fullName[256] = ""; // Initialize fullName with an empty string
-
-    // Start at index 1 to skip the command itself and end before the last two arguments (grade and fileName)
-    // This accounts for names with multiple parts by concatenating everything before the grade and fileName
-    for (int i = 1; i < argCount - 2; ++i) {
-        strcat(fullName, args[i]); // Add the current name part
-        if (i < argCount - 2) strcat(fullName, " "); // Add space if this is not the last part of the name
+        if (runCommand(args, argCount)) {
+            break;
+        }
     }
 
-    addStudentGrade(fullName, args[argCount - 2], args[argCount - 1]);
+    return 0;
 }
 
- 
-        else if (strcmp(args[0], "searchStudent") == 0 && argCount >= 4) {
-    char fullName[256] = ""; // Initialize fullName with an empty string
-    
-    // Start at index 1 to skip the command itself and end before the last argument (fileName)
-    // This loop concatenates all parts of the name, correctly handling spaces
-    for (int i = 1; i < argCount - 2; ++i) {
-        strcat(fullName, args[i]); // Add the current name part
-        if (i < argCount - 2) strcat(fullName, " "); // Add space if this is not the last part of the name
-    }
-    
-    // Ensure to add the last part of the name without an extra space
-    strcat(fullName, args[argCount - 2]);
-
-    searchStudent(fullName, args[argCount - 1]);
-}
+// Runs one parsed command line; returns 1 for exit
+int runCommand(char* args[], int argCount) {
+    // Process commands
+    if (strcmp(args[0], "addStudentGrade") == 0 && argCount >= 5) {
+        char fullName[256] = ""; // Initialize fullName with an empty string
 
-        else if (strcmp(args[0], "sortAll") == 0 && argCount >= 2) {
-            int sortMode = 1;
-            sortMode = atoi(args[2]);
-            sortAll(args[1], sortMode);
-        }
-        else if (strcmp(args[0], "showAll") == 0 && argCount == 2) {
-            showAll(args[1]);
+        // Start at index 1 to skip the command itself and end before the last two arguments (grade and fileName)
+        // This accounts for names with multiple parts by concatenating everything before the grade and fileName
+        for (int i = 1; i < argCount - 2; ++i) {
+            strcat(fullName, args[i]); // Add the current name part
+            if (i < argCount - 2) strcat(fullName, " "); // Add space if this is not the last part of the name
         }
-        else if (strcmp(args[0], "listGrades") == 0 && argCount == 2) {
-            listGrades(args[1]);
+
+        addStudentGrade(fullName, args[argCount - 2], args[argCount - 1]);
+    }
+    else if (strcmp(args[0], "searchStudent") == 0 && argCount >= 3) {
+        char fullName[256] = ""; // Initialize fullName with an empty string
+
+        // Start at index 1 to skip the command itself and end before the last argument (fileName)
+        // This loop concatenates all parts of the name, correctly handling spaces
+        for (int i = 1; i < argCount - 2; ++i) {
+            strcat(fullName, args[i]); // Add the current name part
+            if (i < argCount - 2) strcat(fullName, " "); // Add space if this is not the last part of the name
         }
-        else if (strcmp(args[0], "listSome") == 0 && argCount == 4) {
-            int numOfEntries = atoi(args[1]);
-            int pageNumber = atoi(args[2]);
-            listSome(numOfEntries, pageNumber, args[3]);
+
+        // Ensure to add the last part of the name without an extra space
+        strcat(fullName, args[argCount - 2]);
+
+        searchStudent(fullName, args[argCount - 1]);
+    }
+    else if (strcmp(args[0], "updateStudentGrade") == 0 && argCount >= 5) {
+        char fullName[256] = "";
+        for (int i = 1; i < argCount - 2; ++i) {
+            strcat(fullName, args[i]);
+            if (i < argCount - 3) strcat(fullName, " ");
         }
-        else if(strcmp(args[0], "gtuStudentGrades") == 0 && argCount >= 2)
-        {
-            ensureFileExists(args[1]);
+        updateStudentGrade(fullName, args[argCount - 2], args[argCount - 1]);
+    }
+    else if (strcmp(args[0], "deleteStudent") == 0 && argCount >= 3) {
+        char fullName[256] = "";
+        for (int i = 1; i < argCount - 1; ++i) {
+            strcat(fullName, args[i]);
+            if (i < argCount - 2) strcat(fullName, " ");
         }
-
-        else if (strcmp(args[0], "gtuStudentGrades") == 0) {
-            printUsage();
+        deleteStudent(fullName, args[argCount - 1]);
+    }
+    else if (strcmp(args[0], "sortAll") == 0 && argCount >= 2) {
+        int sortMode = 1;
+        if (argCount >= 3) sortMode = atoi(args[2]);
+        sortAll(args[1], sortMode, argCount >= 4 ? args[3] : NULL);
+    }
+    else if (strcmp(args[0], "showAll") == 0 && argCount == 2) {
+        showAll(args[1]);
+    }
+    else if (strcmp(args[0], "listGrades") == 0 && argCount == 2) {
+        listGrades(args[1]);
+    }
+    else if (strcmp(args[0], "listSome") == 0 && argCount == 4) {
+        int numOfEntries = atoi(args[1]);
+        int pageNumber = atoi(args[2]);
+        listSome(numOfEntries, pageNumber, args[3]);
+    }
+    else if ((strcmp(args[0], "bulkImport") == 0 || strcmp(args[0], "importGrades") == 0) && argCount == 3) {
+        bulkImport(args[1], args[2]);
+    }
+    else if ((strcmp(args[0], "gradeStats") == 0 || strcmp(args[0], "histogram") == 0) && argCount >= 2) {
+        char prefix[256] = "";
+        for (int i = 2; i < argCount; ++i) {
+            strcat(prefix, args[i]);
+            if (i < argCount - 1) strcat(prefix, " ");
         }
-        else if (strcmp(args[0], "exit") == 0) {
-            printf("Exiting program...\n");
-            break; // Exit the loop and end the program
+        if (strcmp(args[0], "gradeStats") == 0) {
+            gradeStats(args[1], prefix);
+        } else {
+            histogram(args[1], prefix);
         }
-        else {
-            printf("Invalid command!\n");
-            printUsage(); // Show usage help
+    }
+    else if (strcmp(args[0], "exportGrades") == 0 && argCount == 3) {
+        exportGrades(args[1], args[2]);
+    }
+    else if (strcmp(args[0], "exportSnapshot") == 0 && argCount == 3) {
+        exportSnapshot(args[1], args[2]);
+    }
+    else if (strcmp(args[0], "scanSnapshot") == 0 && argCount >= 2) {
+        scanSnapshot(args[1], argCount >= 3 ? args[2] : "all", argCount >= 4 ? args[3] : NULL);
+    }
+    else if (strcmp(args[0], "benchShowAll") == 0 && argCount >= 2) {
+        benchShowAll(args[1], argCount >= 3 ? atoi(args[2]) : BENCH_SHOW_RUNS, argCount >= 4 ? args[3] : "/dev/null");
+    }
+    else if (strcmp(args[0], "benchSort") == 0) {
+        benchSort(argCount >= 2 ? strtoull(args[1], NULL, 10) : 1000000, argCount >= 3 ? atoi(args[2]) : 1);
+    }
+    else if (strcmp(args[0], "runScript") == 0 && argCount >= 2) {
+        runScript(args[1], argCount >= 3 ? atoi(args[2]) : 0);
+    }
+    else if (strcmp(args[0], "serveGrades") == 0 && argCount >= 3) {
+        serveGrades(args[1], args[2], argCount >= 4 ? atoi(args[3]) : SERVER_DEFAULT_THREADS);
+    }
+    else if (strcmp(args[0], "remoteCommand") == 0 && argCount >= 3) {
+        char request[512] = "";
+        for (int i = 2; i < argCount; ++i) {
+            strcat(request, args[i]);
+            if (i < argCount - 1) strcat(request, " ");
         }
+        remoteCommand(args[1], request);
+    }
+    else if (strcmp(args[0], "benchServer") == 0 && argCount >= 4) {
+        benchServer(args[1], args[2], atoi(args[3]), argCount >= 5 ? atoi(args[4]) : 1);
+    }
+    else if(strcmp(args[0], "gtuStudentGrades") == 0 && argCount >= 2)
+    {
+        ensureFileExists(args[1]);
     }
 
+    else if (strcmp(args[0], "gtuStudentGrades") == 0) {
+        printUsage();
+    }
+    else if (strcmp(args[0], "exit") == 0) {
+        printf("Exiting program...\n");
+        return 1; // Exit the loop and end the program
+    }
+    else {
+        printf("Invalid command!\n");
+        printUsage(); // Show usage help
+    }
     return 0;
 }
 
@@ -148,24 +609,48 @@ void printUsage() {
     printf("\tUsage:\n");
     printf("1) To add a student grade:addStudentGrade Name Surname Grade grades.txt\n");
     printf("2) To search for a student grade:searchStudent Name Surname grades.txt\n");
+    printf("   A partial name (searchStudent Sur grades.txt) lists every student whose name contains it\n");
     printf("3) To sort all grades by student name:sortAll grades.txt\n");
     printf(" -----------------Sorting Options--------------\n");
     printf("sortAll grades.txt or sortAll grades.txt 1 =>Sorted by Name ascending\n");
     printf("sortAll grades.txt 2 => Sorted by Name descending\n");
     printf("sortAll grades.txt 3 => Sorted by Grades descending\n");
     printf("sortAll grades.txt 4 => Sorted by Grades ascending\n");
+    printf("sortAll grades.txt 1 sorted.txt => Writes the sorted grades to sorted.txt instead\n");
     printf("-----------------------------------------------------------\n");
     printf("4) To display all student grades:showAll grades.txt\n");
+    printf("   To time showAll against the old forked copy:benchShowAll grades.txt [runs] [output file]\n");
     printf("5) To display the first 5 student grades:listGrades grades.txt\n");
     printf("6) To display a specific number of grades from a specific page:listSome <numOfEntries> <pageNumber> grades.txt\n");
     printf("7) Example:listSome 5 2 grades.txt (displays entries from the 6th to the 10th)\n\n");
     printf("8) To display usage:gtuStudentGrades\n");
     printf("9) To creata a file:gtuStudentGrades grades.txt\n");
-    printf("10) Write exit to quit the program\n");
+    printf("10) To convert a text file into an indexed grade store:importGrades grades.txt grades.db\n");
+    printf("    To append many records at once:bulkImport records.csv grades.txt (or grades.db)\n");
+    printf("    bulkImport - grades.txt reads records from the keyboard until a line with a single . or Ctrl-D\n");
+    printf("11) To write a grade store back out as text:exportGrades grades.db grades.txt\n");
+    printf("    Every command above also accepts a grades.db store in place of grades.txt\n");
+    printf("    A store also supports:updateStudentGrade Name Surname Grade grades.db and deleteStudent Name Surname grades.db\n");
+    printf("12) To serve a store to other processes:serveGrades grades.db /tmp/grades.sock [threads]\n");
+    printf("    Clients send the usual commands without the file name:remoteCommand /tmp/grades.sock searchStudent Name Surname\n");
+    printf("    remoteCommand /tmp/grades.sock shutdown stops the server\n");
+    printf("13) To compare server and fork throughput:benchServer /tmp/grades.sock grades.txt <ops> [clients]\n");
+    printf("14) To compare qsort with the parallel key sort:benchSort [maxRecords] [sortMode]\n");
+    printf("15) To see grade counts and the average grade point:gradeStats grades.txt [Name prefix]\n");
+    printf("    To draw the grade distribution:histogram grades.txt [Name prefix]\n");
+    printf("16) To run a file of commands, reads in parallel and writes in order:runScript commands.txt [threads]\n");
+    printf("17) To write a columnar snapshot for analytics:exportSnapshot grades.txt grades.gcol\n");
+    printf("    To filter it by grade:scanSnapshot grades.gcol AA,BA [output.txt or output.gcol]\n");
+    printf("18) Write exit to quit the program\n");
    
 }
 
 void addStudentGrade(const char* nameSurname, const char* grade, const char* fileName) {
+    if (useGradeStore(fileName)) {
+        storeAddStudentGrade(nameSurname, grade, fileName);
+        return;
+    }
+
     pid_t pid = fork();
 
     if (pid == -1) {
@@ -184,11 +669,24 @@ void addStudentGrade(const char* nameSurname, const char* grade, const char* fil
         char buffer[256];
         int length = snprintf(buffer, sizeof(buffer), "%s, %s\n", nameSurname, grade);
         
+        // The lock keeps the line and its .lidx entry together when several shells append
+        struct stat before, after;
+        if (textLockWrite(file) == -1) {
+            close(file);
+            exit(EXIT_FAILURE);
+        }
+        fstat(file, &before);
         if (write(file, buffer, length) != length) {
             perror("write");
             close(file);
             exit(EXIT_FAILURE);
         }
+        fstat(file, &after);
+        if (after.st_size == before.st_size + length) {
+            uint64_t offset = before.st_size;
+            lineIndexAppend(fileName, &before, &after, &offset, 1);
+        }
+        textUnlock(file);
         
         char logBuffer[256];
         snprintf(logBuffer, sizeof(logBuffer), "Successfully added grade for %s.", nameSurname);
@@ -210,6 +708,11 @@ void addStudentGrade(const char* nameSurname, const char* grade, const char* fil
 
 
 void searchStudent(const char* nameSurname, const char* fileName) {
+    if (useGradeStore(fileName)) {
+        storeSearchStudent(nameSurname, fileName);
+        return;
+    }
+
     pid_t pid = fork();
 
     if (pid == -1) {
@@ -222,58 +725,51 @@ void searchStudent(const char* nameSurname, const char* fileName) {
             perror("open");
             exit(EXIT_FAILURE);
         }
-       
-        
-        if (file == -1) {
-            perror("open");
-            exit(EXIT_FAILURE);
+
+        // Scan a mapping of the whole file and print every line that matches
+        struct stat st;
+        fstat(file, &st);
+        size_t length = textStableSize(file, st.st_size);
+        const char* data = NULL;
+        if (length > 0) {
+            data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, file, 0);
+            if (data == MAP_FAILED) {
+                perror("mmap");
+                exit(EXIT_FAILURE);
+            }
+            madvise((void*)data, length, MADV_SEQUENTIAL);
         }
+        close(file);
 
-        char buffer[1024]; // Increased buffer size for larger reads
-        ssize_t bytes_read;
+        size_t position = 0, nameLength = strlen(nameSurname);
         int found = 0;
-
-        // Temporary buffer to hold one line at a time
-        char line[256];
-        int lineIndex = 0;
-
-        while ((bytes_read = read(file, buffer, sizeof(buffer) - 1)) > 0) {
-            for (ssize_t i = 0; i < bytes_read; ++i) {
-                if (buffer[i] == '\n' || lineIndex == sizeof(line) - 1) {
-                    // End of line or maximum line length reached, null-terminate and process
-                    line[lineIndex] = '\0';
-                    if (strstr(line, nameSurname) != NULL) {
-                        printf("%s\n", line);
-                        found = 1;
-                        break;
-                    }
-                    lineIndex = 0; // Reset line index for the next line
-                } else {
-                    // Accumulate characters into the line buffer
-                    line[lineIndex++] = buffer[i];
-                }
-            }
-            if (found) 
-            {
-                char logBuffer[256];
-    snprintf(logBuffer, sizeof(logBuffer), "Student found: %s.", nameSurname);
-    logMessage("operations.log", "searchStudent", logBuffer);
-                break; // Break if the student is found
-        
+        const char* match;
+        while (position < length &&
+               (match = scanSubstring(data + position, length - position, nameSurname, nameLength)) != NULL) {
+            const char* lineStart = match;
+            while (lineStart > data && lineStart[-1] != '\n') {
+                lineStart--;
             }
+            const char* lineEnd = memchr(match, '\n', data + length - match);
+            if (lineEnd == NULL) {
+                lineEnd = data + length;
             }
-        
-
-
-        close(file);
+            printf("%.*s\n", (int)(lineEnd - lineStart), lineStart);
+            found++;
+            position = lineEnd - data + 1;
+        }
+        if (data != NULL) {
+            munmap((void*)data, length);
+        }
 
-        
-        if (!found) {
-            char logBuffer[256];
-    snprintf(logBuffer, sizeof(logBuffer), "Student not found: %s.", nameSurname);
-            logMessage("operations.log", "searchStudent", logBuffer);
+        char logBuffer[256];
+        if (found) {
+            snprintf(logBuffer, sizeof(logBuffer), "Student found: %s.", nameSurname);
+        } else {
+            snprintf(logBuffer, sizeof(logBuffer), "Student not found: %s.", nameSurname);
             printf("Student '%s' not found.\n", nameSurname);
         }
+        logMessage("operations.log", "searchStudent", logBuffer);
         
         exit(EXIT_SUCCESS);
     } else {
@@ -285,7 +781,12 @@ void searchStudent(const char* nameSurname, const char* fileName) {
     }
 }
 }
-void sortAll(const char* filePath, int sortMode) {
+void sortAll(const char* filePath, int sortMode, const char* outputPath) {
+    if (useGradeStore(filePath)) {
+        storeSortAll(filePath, sortMode, outputPath);
+        return;
+    }
+
     pid_t pid = fork();
    
     if (pid == -1) {
@@ -300,60 +801,49 @@ void sortAll(const char* filePath, int sortMode) {
             exit(EXIT_FAILURE);
         }
 
-        int (*compareFunc)(const void*, const void*);
-        switch (sortMode) {
-            case 1: compareFunc = compareByNameAsc; break;
-            case 2: compareFunc = compareByNameDesc; break;
-            case 3: compareFunc = compareByGradeDesc; break;
-            case 4: compareFunc = compareByGradeAsc; break;
-            default: compareFunc = compareByNameAsc; // Default to name ascending
+        // Sorted output goes to a temporary file first so it can replace the input itself
+        FILE* out = stdout;
+        char tempPath[512];
+        if (outputPath != NULL) {
+            snprintf(tempPath, sizeof(tempPath), "%s.sorting", outputPath);
+            out = fopen(tempPath, "w");
+            if (out == NULL) {
+                perror("Failed to open file for writing");
+                exit(EXIT_FAILURE);
+            }
         }
 
-        StudentInfo students[MAX_STUDENTS];
-        int studentCount = 0;
-        char buffer[256];
-        ssize_t bytes_read;
-        while ((bytes_read = read(file, buffer, sizeof(buffer) - 1)) > 0 && studentCount < MAX_STUDENTS) {
-            buffer[bytes_read] = '\0';
-            char* line = strtok(buffer, "\n");
-            while (line != NULL && studentCount < MAX_STUDENTS) {
-                sscanf(line, "%99[^,], %2s", students[studentCount].name, students[studentCount].grade);
-                studentCount++;
-                line = strtok(NULL, "\n");
+        printf("%s\n", sortModeTitle(sortMode));
+        int64_t studentCount = externalSortGrades(file, sortMode, out);
+        close(file);
+        if (outputPath != NULL) {
+            if (fclose(out) != 0 || studentCount == -1 || rename(tempPath, outputPath) == -1) {
+                perror("Failed to write sorted file");
+                unlink(tempPath);
+                exit(EXIT_FAILURE);
             }
+            printf("%lld students written to %s.\n", (long long)studentCount, outputPath);
+        }
+        if (studentCount == -1) {
+            exit(EXIT_FAILURE);
         }
-        close(file);
-
-        // Sort the students array based on the specified mode
-        qsort(students, studentCount, sizeof(StudentInfo), compareFunc);
 
         switch(sortMode)
     {
-        case 1: 
-            logMessage("operations.log", "sortAll", "Displayed students sorted ascending ordered by name.");
-            printf("Students sorted ascending ordered by name.\n");
-            break;
         case 2: 
             logMessage("operations.log", "sortAll", "Displayed students sorted descending ordered by name.");
-            printf("Students sorted descending ordered by name.\n");
             break;
         case 3: 
             logMessage("operations.log", "sortAll", "Displayed students sorted descending ordered by grade.");
-            printf("Students sorted descending ordered by grades.\n");
             break;
         case 4: 
             logMessage("operations.log", "sortAll", "Displayed students sorted asscending ordered by grade.");
-            printf("Students sorted asscending ordered by grades.\n");
             break;            
+        default: 
+            logMessage("operations.log", "sortAll", "Displayed students sorted ascending ordered by name.");
+            break;
     }
 
-        // Instead of writing back to the file, print sorted students to the terminal
-        for (int i = 0; i < studentCount; i++) {
-            printf("%s, %s\n", students[i].name, students[i].grade);
-        }
-
-       
-
         exit(EXIT_SUCCESS); // Child process exits successfully
     } else {
         // Parent process waits for the child to finish
@@ -365,47 +855,38 @@ void sortAll(const char* filePath, int sortMode) {
     }
 }
 void showAll(const char* filePath) {
-    // Log the start of the operation
-    logMessage("operations.log", "showAll", "Operation started.");
-
-    pid_t pid = fork();
+    if (useGradeStore(filePath)) {
+        storeShowAll(filePath);
+        return;
+    }
 
-    if (pid == -1) {
-        // Fork failed
-        perror("fork");
-        logMessage("operations.log", "showAll", "Fork failed for displaying all grades.");
-        exit(EXIT_FAILURE);
-    } else if (pid == 0) {
-        // Child process
-        int file = open(filePath, O_RDONLY);
-        if (file == -1) {
-            perror("Failed to open file");
-            logMessage("operations.log", "showAll", "Failed to open grades file in child process.");
-            exit(EXIT_FAILURE);
-        }
+    logMessage("operations.log", "showAll", "Operation started.");
 
-        char buffer[256];
-        ssize_t bytes_read;
-        while ((bytes_read = read(file, buffer, sizeof(buffer) - 1)) > 0) {
-            buffer[bytes_read] = '\0';
-            write(STDOUT_FILENO, buffer, bytes_read); // Use write() to display the content
-        }
+    int file = open(filePath, O_RDONLY);
+    if (file == -1) {
+        perror("Failed to open file");
+        logMessage("operations.log", "showAll", "Failed to open grades file.");
+        return;
+    }
 
-        close(file);
-        exit(EXIT_SUCCESS);
+    struct stat st;
+    fstat(file, &st);
+    uint64_t size = textStableSize(file, st.st_size);
+    fflush(stdout); // Anything printed earlier must come out first
+    if (streamFileRange(file, 0, size, STDOUT_FILENO) == -1) {
+        printf("Failed to display file content.\n");
+        logMessage("operations.log", "showAll", "Failed to display all grades.");
     } else {
-        // Parent process waits for the child to complete
-        int status;
-        wait(&status);
-        if (status != 0) {
-            printf("Failed to display file content.\n");
-            logMessage("operations.log", "showAll", "Failed to display all grades.");
-        } else {
-            logMessage("operations.log", "showAll", "Displayed all student grades successfully.");
-        }
+        logMessage("operations.log", "showAll", "Displayed all student grades successfully.");
     }
+    close(file);
 }
 void listGrades(const char* filePath) {
+    if (useGradeStore(filePath)) {
+        storeListGrades(filePath);
+        return;
+    }
+
     pid_t pid = fork();
     
     
@@ -415,32 +896,9 @@ void listGrades(const char* filePath) {
     } else if (pid == 0) {
         logMessage("operations.log", "listGrades", "Operation started.");
         // Child process for listing grades
-        int file = open(filePath, O_RDONLY);
-        if (file == -1) {
-            perror("open");
+        if (printLineRange(filePath, 0, 5) == -1) {
             exit(EXIT_FAILURE);
         }
-
-        char buffer[256];
-        ssize_t bytes_read;
-        int lineCount = 0, i = 0;
-        while ((bytes_read = read(file, buffer + i, 1)) > 0 && lineCount < 5) {
-            if (buffer[i] == '\n') {
-                buffer[i+1] = '\0'; // Null-terminate the string
-                write(STDOUT_FILENO, buffer, i+1);
-                lineCount++;
-                i = 0; // Reset buffer index for the next line
-                continue;
-            }
-            i++;
-            if (i >= (int)(sizeof(buffer) - 2)) {
-                buffer[i] = '\0';
-                write(STDOUT_FILENO, buffer, i); // Print what's been read so far
-                i = 0; // Reset buffer index
-            }
-        }
-
-        close(file);
         exit(EXIT_SUCCESS);
     } else {
         // Parent process waits for the child to finish
@@ -455,6 +913,11 @@ void listGrades(const char* filePath) {
 }
 
 void listSome(int numEntries, int pageNumber, const char* filePath) {
+    if (useGradeStore(filePath)) {
+        storeListSome(numEntries, pageNumber, filePath);
+        return;
+    }
+
     logMessage("operations.log", "listSome", "Operation started.");
 
     pid_t pid = fork();
@@ -465,41 +928,15 @@ void listSome(int numEntries, int pageNumber, const char* filePath) {
         exit(EXIT_FAILURE);
     } else if (pid == 0) {
         // Child process
-        int file = open(filePath, O_RDONLY);
-        if (file == -1) {
-            perror("Failed to open file");
-            logMessage("operations.log", "listSome", "Failed to open file in child process.");
+        if (numEntries <= 0 || pageNumber <= 0) {
+            printf("Invalid page.\n");
             exit(EXIT_FAILURE);
         }
-
-        int startLine = (pageNumber - 1) * numEntries + 1;
-        int endLine = startLine + numEntries - 1;
-        int currentLine = 0;
-        char buffer[256 + 1]; // +1 for null terminator
-        ssize_t bytesRead;
-        int lineIndex = 0;
-
-        while ((bytesRead = read(file, buffer + lineIndex, 1)) > 0) {
-            if (buffer[lineIndex] == '\n' || lineIndex == 256) {
-                buffer[lineIndex + 1] = '\0'; // Null terminate the string
-                currentLine++;
-
-                if (currentLine >= startLine && currentLine <= endLine) {
-                    write(STDOUT_FILENO, buffer, lineIndex + 1);
-                } else if (currentLine > endLine) {
-                    break; // Stop reading the file if end of page is reached
-                }
-
-                lineIndex = -1; // Reset line index for the next line
-            }
-
-            lineIndex++;
-            if (lineIndex == 256) { // Prevent buffer overflow
-                lineIndex = 0; // Reset buffer index
-            }
+        // The line index turns the page into one byte range
+        if (printLineRange(filePath, (uint64_t)(pageNumber - 1) * numEntries, numEntries) == -1) {
+            logMessage("operations.log", "listSome", "Failed to open file in child process.");
+            exit(EXIT_FAILURE);
         }
-
-        close(file);
         exit(EXIT_SUCCESS);
     } else {
         // Parent process waits for the child to complete
@@ -513,47 +950,16 @@ void listSome(int numEntries, int pageNumber, const char* filePath) {
     }
 }
 
-void logMessage(const char* logFilePath, const char* operation, const char* message) {
-    pid_t pid = fork();
-    
-    if (pid == -1) {
-        // Fork failed
-        perror("fork");
-        exit(EXIT_FAILURE);
-    } else if (pid == 0) {
-        // Child process
-        int fd = open(logFilePath, O_WRONLY | O_CREAT | O_APPEND, 0666);
-        if (fd == -1) {
-            perror("Failed to open log file");
+void ensureFileExists(const char* filePath) {
+    if (useGradeStore(filePath)) {
+        GradeStore store;
+        if (storeOpen(&store, filePath) == -1) {
             exit(EXIT_FAILURE);
         }
-
-        // Get current time
-        time_t now = time(NULL);
-        char* timeStr = ctime(&now);
-        timeStr[24] = '\0'; // Remove the newline at the end of the time string
-
-        // Construct the log message
-        char logEntry[1024]; // Ensure this buffer is large enough for your log message
-        int len = snprintf(logEntry, sizeof(logEntry), "[%s] %s: %s\n", timeStr, operation, message);
-        
-        // Write the log message
-        if (write(fd, logEntry, len) != len) {
-            perror("Failed to write log entry");
-        }
-
-        // Close the file
-        close(fd);
-        
-        exit(EXIT_SUCCESS); // Ensure child exits successfully
-    } else {
-        // Parent process
-        int status;
-        wait(&status); // Wait for the child process to complete
+        storeClose(&store);
+        return;
     }
-}
 
-void ensureFileExists(const char* filePath) {
     pid_t pid = fork();
 
     if (pid == -1) {
@@ -578,4 +984,4225 @@ void ensureFileExists(const char* filePath) {
             exit(EXIT_FAILURE);
         }
     }
-}
\ No newline at end of file
+}
+
+
+int useGradeStore(const char* filePath) {
+    size_t length = strlen(filePath);
+    size_t extLength = strlen(STORE_EXTENSION);
+    if (length > extLength && strcmp(filePath + length - extLength, STORE_EXTENSION) == 0) {
+        return 1; // New stores are created from the extension alone
+    }
+
+    int fd = open(filePath, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+    char magic[sizeof(STORE_MAGIC)];
+    ssize_t bytesRead = read(fd, magic, sizeof(magic));
+    close(fd);
+    return bytesRead == (ssize_t)sizeof(magic) && memcmp(magic, STORE_MAGIC, sizeof(magic)) == 0;
+}
+
+// (Re)maps the data file and the name index for the given capacity
+static int storeMap(GradeStore* store, uint64_t capacity) {
+    if (store->indexHeader != NULL) {
+        munmap(store->indexHeader, store->indexMapSize);
+        store->indexHeader = NULL;
+        store->index = NULL;
+    }
+    if (store->header != NULL) {
+        munmap(store->header, store->mapSize);
+        store->header = NULL;
+    }
+
+    store->mapSize = STORE_HEADER_SIZE + capacity * sizeof(StudentInfo);
+    store->indexMapSize = sizeof(IndexHeader) + capacity * sizeof(uint32_t);
+    void* data = mmap(NULL, store->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    store->header = data;
+    store->records = (StudentInfo*)((char*)data + STORE_HEADER_SIZE);
+
+    void* index = mmap(NULL, store->indexMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, store->indexFd, 0);
+    if (index == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    store->indexHeader = index;
+    store->index = (uint32_t*)(store->indexHeader + 1);
+    store->capacity = capacity;
+    return 0;
+}
+
+static const StudentInfo* indexSortRecords; // qsort has no context argument
+static int hashRebuild(GradeStore* store, uint64_t minimumRecords);
+static int storeInsert(GradeStore* store, const StudentInfo* student);
+static void storeRecountGrades(GradeStore* store);
+static int storeLoadWal(GradeStore* store);
+static int storeCompactResume(GradeStore* store);
+static int storeIsDead(const GradeStore* store, uint64_t recordNumber);
+static void hashClose(GradeStore* store);
+static int querySearch(const GradeStore* store, const void* arg, FILE* out);
+static int querySorted(const GradeStore* store, const void* arg, FILE* out);
+static int queryRange(const GradeStore* store, const void* arg, FILE* out);
+static int querySortedCounted(const GradeStore* store, const void* arg, FILE* out);
+static int queryRangeCounted(const GradeStore* store, const void* arg, FILE* out);
+
+static int compareIndexEntries(const void* a, const void* b) {
+    uint32_t recordA = *(const uint32_t*)a;
+    uint32_t recordB = *(const uint32_t*)b;
+    int result = strcmp(indexSortRecords[recordA].name, indexSortRecords[recordB].name);
+    if (result != 0) {
+        return result;
+    }
+    return recordA < recordB ? -1 : recordA > recordB; // Keep insertion order among equal names
+}
+
+// Records that the index now matches the store; called after every change to recordCount
+static void storeIndexSync(GradeStore* store) {
+    memcpy(store->indexHeader->magic, INDEX_MAGIC, sizeof(store->indexHeader->magic));
+    store->indexHeader->storeId = store->header->storeId;
+    store->indexHeader->recordCount = store->header->recordCount;
+    store->indexHeader->compactions = atomic_load(&store->header->compactions);
+}
+
+// Rebuilds the sorted name index from the records, used when the sidecar is missing or stale
+static void storeRebuildIndex(GradeStore* store) {
+    for (uint64_t i = 0; i < store->header->recordCount; i++) {
+        store->index[i] = (uint32_t)i;
+    }
+    indexSortRecords = store->records;
+    qsort(store->index, store->header->recordCount, sizeof(uint32_t), compareIndexEntries);
+    storeIndexSync(store);
+}
+
+// Writers take an fcntl lock on the first byte of the data file. Readers only wait on it
+// when a writer keeps getting in their way (storeReadBackoff).
+static int storeLockWrite(GradeStore* store) {
+    struct flock lock = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1};
+    while (fcntl(store->fd, F_SETLKW, &lock) == -1) {
+        if (errno != EINTR) {
+            perror("fcntl");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void storeUnlockWrite(GradeStore* store) {
+    struct flock lock = {.l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1};
+    fcntl(store->fd, F_SETLK, &lock);
+}
+
+static int storeWriterActive(const GradeStore* store) {
+    struct flock lock = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1};
+    return fcntl(store->fd, F_GETLK, &lock) == 0 && lock.l_type != F_UNLCK;
+}
+
+// One pass over the records for stores whose header has no grade counters yet
+static void storeRecountGrades(GradeStore* store) {
+    GradeTally tally;
+    memset(&tally, 0, sizeof(tally));
+    for (uint64_t i = 0; i < store->header->recordCount; i++) {
+        if (!storeIsDead(store, i)) {
+            tallyAdd(&tally, store->records[i].grade);
+        }
+    }
+    atomic_fetch_add(&store->header->sequence, 1);
+    store->header->tally = tally;
+    store->header->tallyCount = store->header->recordCount;
+    atomic_fetch_add(&store->header->sequence, 1);
+}
+
+static uint64_t storeNewId() {
+    uint64_t id = 0;
+    if (getentropy(&id, sizeof(id)) == -1) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        id = (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec + ((uint64_t)getpid() << 40);
+    }
+    return id != 0 ? id : 1; // 0 marks a store from before the id existed
+}
+
+int storeOpen(GradeStore* store, const char* filePath) {
+    char indexPath[512];
+    snprintf(indexPath, sizeof(indexPath), "%s.idx", filePath);
+    memset(store, 0, sizeof(*store));
+    store->indexFd = store->hashFd = store->walFd = -1;
+    snprintf(store->path, sizeof(store->path), "%s", filePath);
+
+    store->fd = open(filePath, O_RDWR | O_CREAT, 0666);
+    if (store->fd == -1) {
+        perror("open");
+        return -1;
+    }
+    store->indexFd = open(indexPath, O_RDWR | O_CREAT, 0666);
+    char walPath[512];
+    snprintf(walPath, sizeof(walPath), "%s%s", filePath, WAL_EXTENSION);
+    store->walFd = open(walPath, O_RDWR | O_CREAT, 0666);
+    if (store->indexFd == -1 || store->walFd == -1) {
+        perror("open");
+        storeClose(store);
+        return -1;
+    }
+
+    // Creating or repairing the files needs the write lock; opening a healthy store does not
+    int locked = 0, indexSized = 0, indexStale = 0;
+    StoreHeader header;
+    struct stat st;
+    while (1) {
+        fstat(store->fd, &st);
+        if (st.st_size == 0 && !locked) {
+            if (storeLockWrite(store) == -1) {
+                storeClose(store);
+                return -1;
+            }
+            locked = 1;
+            continue; // Someone may have created it while we waited
+        }
+        if (st.st_size == 0) {
+            // Fresh store: write the header and reserve the first block of records
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+            header.version = STORE_VERSION;
+            header.recordSize = sizeof(StudentInfo);
+            header.capacity = STORE_INITIAL_CAPACITY;
+            header.storeId = storeNewId();
+            if (ftruncate(store->fd, STORE_HEADER_SIZE + header.capacity * sizeof(StudentInfo)) == -1 ||
+                pwrite(store->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+                perror("Failed to initialize grade store");
+                storeClose(store);
+                return -1;
+            }
+        } else if (pread(store->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                   memcmp(header.magic, STORE_MAGIC, sizeof(header.magic)) != 0 ||
+                   header.version == 0 || header.version > STORE_VERSION || header.recordSize != sizeof(StudentInfo)) {
+            if (!locked) {
+                // Possibly another process halfway through creating it; look again under the lock
+                if (storeLockWrite(store) == -1) {
+                    storeClose(store);
+                    return -1;
+                }
+                locked = 1;
+                continue;
+            }
+            fprintf(stderr, "%s is not a grade store or has an unsupported version.\n", filePath);
+            storeClose(store);
+            return -1;
+        } else if (header.capacity == 0 || header.recordCount > header.capacity ||
+                   (uint64_t)st.st_size < STORE_HEADER_SIZE ||
+                   header.capacity > ((uint64_t)st.st_size - STORE_HEADER_SIZE) / sizeof(StudentInfo)) {
+            // Mapping or indexing past the end of the file would fault later on
+            fprintf(stderr, "%s has a damaged header: %llu records and room for %llu do not fit the file.\n",
+                    filePath, (unsigned long long)header.recordCount, (unsigned long long)header.capacity);
+            storeClose(store);
+            return -1;
+        }
+
+        // An index from an older build, another store or a crashed writer has the wrong counts
+        IndexHeader indexHeader;
+        fstat(store->indexFd, &st);
+        indexSized = (uint64_t)st.st_size == sizeof(IndexHeader) + header.capacity * sizeof(uint32_t);
+        indexStale = (uint64_t)st.st_size < sizeof(IndexHeader) + header.recordCount * sizeof(uint32_t) ||
+                     pread(store->indexFd, &indexHeader, sizeof(indexHeader), 0) != (ssize_t)sizeof(indexHeader) ||
+                     memcmp(indexHeader.magic, INDEX_MAGIC, sizeof(indexHeader.magic)) != 0 ||
+                     indexHeader.storeId != header.storeId || indexHeader.recordCount != header.recordCount ||
+                     indexHeader.compactions != header.compactions;
+        if ((indexSized && !indexStale && header.storeId != 0) || locked) {
+            break;
+        }
+        if (storeLockWrite(store) == -1) {
+            storeClose(store);
+            return -1;
+        }
+        locked = 1;
+    }
+
+    if (!indexSized && ftruncate(store->indexFd, sizeof(IndexHeader) + header.capacity * sizeof(uint32_t)) == -1) {
+        perror("ftruncate");
+        storeClose(store);
+        return -1;
+    }
+    if (storeMap(store, header.capacity) == -1) {
+        storeClose(store);
+        return -1;
+    }
+    if (store->header->storeId == 0) {
+        store->header->storeId = storeNewId(); // Store from an older build; its index is rebuilt below
+        indexStale = 1;
+    }
+    if (indexStale) {
+        atomic_fetch_add(&store->header->sequence, 1);
+        storeRebuildIndex(store);
+        atomic_fetch_add(&store->header->sequence, 1);
+    }
+    if (storeLoadWal(store) == -1) {
+        if (locked) storeUnlockWrite(store);
+        storeClose(store);
+        return -1;
+    }
+    if (atomic_load(&store->header->compactCursor) != 0) {
+        if (!locked && storeLockWrite(store) == -1) {
+            storeClose(store);
+            return -1;
+        }
+        locked = 1;
+        // Reload under the lock: another process may have finished it meanwhile
+        if (storeLoadWal(store) == -1 ||
+            (atomic_load(&store->header->compactCursor) != 0 && storeCompactResume(store) == -1)) {
+            storeUnlockWrite(store);
+            storeClose(store);
+            return -1;
+        }
+    }
+
+    int hashState = hashOpen(store);
+    if (hashState == 1 && !locked) {
+        if (storeLockWrite(store) == -1) {
+            storeClose(store);
+            return -1;
+        }
+        locked = 1;
+        hashState = hashOpen(store); // It may have been rebuilt while we waited
+    }
+    if (hashState == 1) {
+        hashState = hashRebuild(store, store->header->recordCount);
+    }
+    if (hashState != -1 && store->header->tallyCount != store->header->recordCount) {
+        if (!locked && storeLockWrite(store) == 0) {
+            locked = 1;
+        }
+        if (locked && store->header->tallyCount != store->header->recordCount) {
+            storeRecountGrades(store);
+        }
+    }
+    if (locked) {
+        storeUnlockWrite(store);
+    }
+    if (hashState == -1) {
+        storeClose(store);
+        return -1;
+    }
+    return 0;
+}
+
+void storeClose(GradeStore* store) {
+    hashClose(store);
+    if (store->indexHeader != NULL) {
+        munmap(store->indexHeader, store->indexMapSize);
+    }
+    if (store->header != NULL) {
+        munmap(store->header, store->mapSize);
+    }
+    if (store->indexFd != -1) {
+        close(store->indexFd);
+    }
+    if (store->walFd != -1) {
+        close(store->walFd);
+    }
+    if (store->fd != -1) {
+        close(store->fd);
+    }
+    free(store->dead);
+    memset(store, 0, sizeof(*store));
+    store->fd = store->indexFd = store->hashFd = store->walFd = -1;
+}
+
+// Doubles the capacity of both files and remaps them
+static int storeGrow(GradeStore* store) {
+    uint64_t capacity = store->header->capacity * 2;
+    if (ftruncate(store->fd, STORE_HEADER_SIZE + capacity * sizeof(StudentInfo)) == -1 ||
+        ftruncate(store->indexFd, sizeof(IndexHeader) + capacity * sizeof(uint32_t)) == -1) {
+        perror("ftruncate");
+        return -1;
+    }
+    store->header->capacity = capacity;
+    return storeMap(store, capacity);
+}
+
+static int storeIsDead(const GradeStore* store, uint64_t recordNumber) {
+    return recordNumber < store->deadBits && (store->dead[recordNumber / 64] >> (recordNumber % 64) & 1);
+}
+
+static int storeMarkDead(GradeStore* store, uint64_t recordNumber) {
+    if (recordNumber >= store->deadBits) {
+        uint64_t bits = store->deadBits ? store->deadBits : 1024;
+        while (bits <= recordNumber) {
+            bits *= 2;
+        }
+        uint64_t* dead = realloc(store->dead, bits / 8);
+        if (dead == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        memset(dead + store->deadBits / 64, 0, (bits - store->deadBits) / 8);
+        store->dead = dead;
+        store->deadBits = bits;
+    }
+    store->dead[recordNumber / 64] |= 1ULL << (recordNumber % 64);
+    return 0;
+}
+
+// Applies log entries written since the last call. A compaction renumbers every record,
+// so after one the bitmap is dropped and the (now short) log is replayed from the start.
+static int storeLoadWal(GradeStore* store) {
+    uint64_t compactions = atomic_load(&store->header->compactions);
+    if (compactions != store->compactions) {
+        if (store->dead != NULL) {
+            memset(store->dead, 0, store->deadBits / 8);
+        }
+        store->walLoaded = 0;
+        store->compactions = compactions;
+    }
+    WalEntry entries[WAL_READ_BATCH];
+    while (store->walLoaded < store->header->walCount) {
+        uint64_t wanted = store->header->walCount - store->walLoaded;
+        if (wanted > WAL_READ_BATCH) {
+            wanted = WAL_READ_BATCH;
+        }
+        ssize_t bytesRead = pread(store->walFd, entries, wanted * sizeof(WalEntry), store->walLoaded * sizeof(WalEntry));
+        if (bytesRead < (ssize_t)sizeof(WalEntry)) {
+            break; // The writer has not finished the entry yet; the seqlock makes the reader retry
+        }
+        uint64_t count = bytesRead / sizeof(WalEntry);
+        for (uint64_t i = 0; i < count; i++) {
+            if ((entries[i].recordNumber ^ WAL_CHECK) == entries[i].check &&
+                storeMarkDead(store, entries[i].recordNumber) == -1) {
+                return -1;
+            }
+        }
+        store->walLoaded += count;
+    }
+    return 0;
+}
+
+// Catches this process's mappings up with a store another process grew, rehashed or compacted
+int storeRefresh(GradeStore* store) {
+    if (store->header->capacity != store->capacity && storeMap(store, store->header->capacity) == -1) {
+        return -1;
+    }
+    if (atomic_load(&store->header->hashGeneration) != store->hashGeneration && hashOpen(store) == -1) {
+        return -1;
+    }
+    return storeLoadWal(store);
+}
+
+// Takes the write lock and makes the sequence odd so readers know to retry
+static int storeWriteBegin(GradeStore* store) {
+    if (storeLockWrite(store) == -1) {
+        return -1;
+    }
+    if (storeRefresh(store) == -1) {
+        storeUnlockWrite(store);
+        return -1;
+    }
+    if (store->header->version < STORE_VERSION) {
+        store->header->version = STORE_VERSION;
+    }
+    uint64_t sequence = atomic_load(&store->header->sequence);
+    if ((sequence & 1) || store->hashHeader == NULL) {
+        // The last writer died halfway through; redo the indexes from the records
+        storeRebuildIndex(store);
+        storeRecountGrades(store);
+        if (hashRebuild(store, store->header->recordCount) == -1) {
+            storeUnlockWrite(store);
+            return -1;
+        }
+        atomic_store(&store->header->sequence, sequence | 1);
+    } else {
+        atomic_store(&store->header->sequence, sequence + 1);
+    }
+    return 0;
+}
+
+static void storeWriteEnd(GradeStore* store) {
+    atomic_fetch_add(&store->header->sequence, 1);
+    storeUnlockWrite(store);
+}
+
+// Readers may look at the store while it changes, so every record number they follow is
+// clamped to this process's mapping; a torn result is thrown away by storeTryRead
+static uint64_t storeVisibleCount(const GradeStore* store) {
+    uint64_t count = store->header->recordCount;
+    return count < store->capacity ? count : store->capacity;
+}
+
+static const StudentInfo* storeIndexed(const GradeStore* store, uint64_t position) {
+    uint32_t recordNumber = store->index[position];
+    return &store->records[recordNumber < store->capacity ? recordNumber : 0];
+}
+
+// Runs query once against a stable snapshot. The output is buffered and only copied to
+// out if no writer touched the store meanwhile; returns STORE_STALE if the mapping is behind.
+// Waits out a writer after the given number of failed attempts. Past the spins and
+// yields it takes an open file description read lock: unlike a plain fcntl lock it also
+// conflicts with the write lock, and closing no other descriptor drops it.
+// Returns 1 once the reader holds that lock.
+static int storeReadBackoff(const GradeStore* store, int attempt) {
+    if (attempt < STORE_READ_SPINS) {
+        return 0;
+    }
+    if (attempt < STORE_READ_SPINS + STORE_READ_YIELDS) {
+        sched_yield();
+        return 0;
+    }
+    struct flock lock = {.l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1};
+    while (fcntl(store->fd, F_OFD_SETLKW, &lock) == -1) {
+        if (errno != EINTR) {
+            sched_yield(); // Kernel without OFD locks: keep yielding
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void storeReadUnlock(const GradeStore* store, int locked) {
+    if (locked) {
+        struct flock lock = {.l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 1};
+        fcntl(store->fd, F_OFD_SETLK, &lock);
+    }
+}
+
+int storeTryRead(const GradeStore* store, StoreQuery query, const void* arg, FILE* out) {
+    int locked = 0;
+    for (int attempt = 0;; attempt++) {
+        uint64_t sequence = atomic_load_explicit(&store->header->sequence, memory_order_acquire);
+        // Odd with nobody holding the write lock means a writer died mid-update
+        if ((sequence & 1) && (attempt < STORE_READ_SPINS || storeWriterActive(store))) {
+            locked |= storeReadBackoff(store, attempt);
+            continue;
+        }
+        if (store->header->capacity != store->capacity ||
+            atomic_load(&store->header->hashGeneration) != store->hashGeneration ||
+            store->header->walCount != store->walLoaded ||
+            atomic_load(&store->header->compactions) != store->compactions) {
+            storeReadUnlock(store, locked);
+            return STORE_STALE;
+        }
+
+        char* data = NULL;
+        size_t size = 0;
+        FILE* buffer = open_memstream(&data, &size);
+        if (buffer == NULL) {
+            perror("open_memstream");
+            storeReadUnlock(store, locked);
+            return -1;
+        }
+        int result = query(store, arg, buffer);
+        fclose(buffer);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&store->header->sequence, memory_order_relaxed) == sequence) {
+            storeReadUnlock(store, locked);
+            fwrite(data, 1, size, out);
+            free(data);
+            return result;
+        }
+        free(data);
+        locked |= storeReadBackoff(store, attempt);
+    }
+}
+
+int storeRead(GradeStore* store, StoreQuery query, const void* arg, FILE* out) {
+    int result;
+    while ((result = storeTryRead(store, query, arg, out)) == STORE_STALE) {
+        if (storeRefresh(store) == -1) {
+            return -1;
+        }
+    }
+    return result;
+}
+
+uint64_t storeLowerBound(const GradeStore* store, const char* nameSurname) {
+    uint64_t low = 0, high = storeVisibleCount(store);
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        if (strcmp(storeIndexed(store, middle)->name, nameSurname) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int64_t storeFind(const GradeStore* store, const char* nameSurname) {
+    uint64_t count = storeVisibleCount(store);
+    for (uint64_t position = storeLowerBound(store, nameSurname);
+         position < count && strcmp(storeIndexed(store, position)->name, nameSurname) == 0; position++) {
+        int64_t recordNumber = storeIndexed(store, position) - store->records;
+        if (!storeIsDead(store, recordNumber)) {
+            return recordNumber;
+        }
+    }
+    return -1;
+}
+
+int storeAppend(GradeStore* store, const char* nameSurname, const char* grade) {
+    StudentInfo student;
+    memset(&student, 0, sizeof(student));
+    snprintf(student.name, sizeof(student.name), "%s", nameSurname);
+    // The shell leaves a space after multi-part names; strip it so lookups match
+    size_t length = strlen(student.name);
+    while (length > 0 && student.name[length - 1] == ' ') {
+        student.name[--length] = '\0';
+    }
+    snprintf(student.grade, sizeof(student.grade), "%s", grade);
+
+    if (storeWriteBegin(store) == -1) {
+        return -1;
+    }
+    int result = storeInsert(store, &student);
+    storeWriteEnd(store);
+    return result;
+}
+
+// Adds one record and its index entries; the caller holds the write lock
+static int storeInsert(GradeStore* store, const StudentInfo* student) {
+    if (store->header->recordCount >= UINT32_MAX) {
+        fprintf(stderr, "Grade store is full.\n");
+        return -1;
+    }
+    if (store->header->recordCount == store->header->capacity && storeGrow(store) == -1) {
+        return -1;
+    }
+
+    uint64_t recordNumber = store->header->recordCount;
+    StudentInfo* record = &store->records[recordNumber];
+    *record = *student;
+
+    // Insert after any equal names so duplicates keep their insertion order
+    uint64_t position = storeLowerBound(store, record->name);
+    while (position < recordNumber && strcmp(store->records[store->index[position]].name, record->name) == 0) {
+        position++;
+    }
+    memmove(&store->index[position + 1], &store->index[position], (recordNumber - position) * sizeof(uint32_t));
+    store->index[position] = (uint32_t)recordNumber;
+    tallyAdd(&store->header->tally, record->grade);
+    store->header->recordCount = recordNumber + 1;
+    store->header->tallyCount = recordNumber + 1;
+    storeIndexSync(store);
+    return hashAdd(store, recordNumber, 1);
+}
+
+// Appends many records at once: the new index entries are sorted on their own and
+// merged into the index in one pass instead of one memmove per record. The whole batch
+// is one commit under the write lock.
+int storeAppendBatch(GradeStore* store, const StudentInfo* students, uint64_t count) {
+    if (storeWriteBegin(store) == -1) {
+        return -1;
+    }
+    uint64_t first = store->header->recordCount;
+    uint32_t* merged = NULL;
+    if (count > UINT32_MAX - first) {
+        fprintf(stderr, "Grade store is full.\n");
+        storeWriteEnd(store);
+        return -1;
+    }
+    while (first + count > store->header->capacity) {
+        if (storeGrow(store) == -1) {
+            storeWriteEnd(store);
+            return -1;
+        }
+    }
+    merged = malloc((first + count) * sizeof(uint32_t));
+    if (merged == NULL) {
+        perror("malloc");
+        storeWriteEnd(store);
+        return -1;
+    }
+
+    memcpy(&store->records[first], students, count * sizeof(StudentInfo));
+    uint32_t* added = &store->index[first];
+    for (uint64_t i = 0; i < count; i++) {
+        added[i] = (uint32_t)(first + i);
+    }
+    indexSortRecords = store->records;
+    qsort(added, count, sizeof(uint32_t), compareIndexEntries);
+
+    uint64_t oldPosition = 0, newPosition = 0, out = 0;
+    while (oldPosition < first && newPosition < count) {
+        if (compareIndexEntries(&store->index[oldPosition], &added[newPosition]) <= 0) {
+            merged[out++] = store->index[oldPosition++];
+        } else {
+            merged[out++] = added[newPosition++];
+        }
+    }
+    while (oldPosition < first) merged[out++] = store->index[oldPosition++];
+    while (newPosition < count) merged[out++] = added[newPosition++];
+    memcpy(store->index, merged, out * sizeof(uint32_t));
+    free(merged);
+
+    for (uint64_t i = 0; i < count; i++) {
+        tallyAdd(&store->header->tally, students[i].grade);
+    }
+    store->header->recordCount = first + count;
+    store->header->tallyCount = first + count;
+    storeIndexSync(store);
+    int result = hashAdd(store, first, count);
+    storeWriteEnd(store);
+    return result;
+}
+
+void storeAddStudentGrade(const char* nameSurname, const char* grade, const char* filePath) {
+    logMessage("operations.log", "addStudentGrade", "Operation started.");
+
+    GradeStore store;
+    if (storeOpen(&store, filePath) == -1 || storeAppend(&store, nameSurname, grade) == -1) {
+        storeClose(&store);
+        logMessage("operations.log", "addStudentGrade", "Failed to add student grade.");
+        printf("Failed to add student grade.\n");
+        return;
+    }
+    storeClose(&store);
+
+    char logBuffer[256];
+    snprintf(logBuffer, sizeof(logBuffer), "Successfully added grade for %s.", nameSurname);
+    logMessage("operations.log", "addStudentGrade", logBuffer);
+    printf("Student grade added successfully.\n");
+}
+
+// Updates and deletes only exist for grade stores; a text file would have to be rewritten
+static void storeChangeStudent(const char* nameSurname, const char* grade, const char* filePath, const char* operation) {
+    logMessage("operations.log", operation, "Operation started.");
+    if (!useGradeStore(filePath)) {
+        printf("%s needs a grade store; convert %s with importGrades first.\n", operation, filePath);
+        logMessage("operations.log", operation, "Not a grade store.");
+        return;
+    }
+    GradeStore store;
+    if (storeOpen(&store, filePath) == -1) {
+        logMessage("operations.log", operation, "Failed to open grade store.");
+        return;
+    }
+
+    char logBuffer[512];
+    int replaced = storeRemove(&store, nameSurname, grade);
+    if (replaced == -1) {
+        snprintf(logBuffer, sizeof(logBuffer), "Failed to change %s.", nameSurname);
+    } else if (replaced == 0) {
+        snprintf(logBuffer, sizeof(logBuffer), "Student '%s' not found.", nameSurname);
+    } else if (grade != NULL) {
+        snprintf(logBuffer, sizeof(logBuffer), "Updated grade for %s to %s.", nameSurname, grade);
+    } else {
+        snprintf(logBuffer, sizeof(logBuffer), "Deleted %s.", nameSurname);
+    }
+    logMessage("operations.log", operation, logBuffer);
+    printf("%s\n", logBuffer);
+
+    if (replaced > 0 && storeNeedsCompaction(&store)) {
+        unsigned long long dead = store.header->deadCount;
+        if (storeCompact(&store) == 0) {
+            snprintf(logBuffer, sizeof(logBuffer), "Compacted %s, %llu dead records removed.", filePath, dead);
+            logMessage("operations.log", "compact", logBuffer);
+            printf("%s\n", logBuffer);
+        }
+    }
+    storeClose(&store);
+}
+
+void updateStudentGrade(const char* nameSurname, const char* grade, const char* filePath) {
+    storeChangeStudent(nameSurname, grade, filePath, "updateStudentGrade");
+}
+
+void deleteStudent(const char* nameSurname, const char* filePath) {
+    storeChangeStudent(nameSurname, NULL, filePath, "deleteStudent");
+}
+
+// Exact names (ignoring case and spacing) come from the hash index; otherwise
+// every record whose name contains the query is printed
+int storeQuerySearch(const GradeStore* store, const char* nameSurname, FILE* out) {
+    uint64_t matches = storeFindExact(store, nameSurname, printStudent, out);
+    if (matches == 0) {
+        matches = storeScanNames(store, nameSurname, printStudent, out);
+    }
+    if (matches == 0) {
+        fprintf(out, "Student '%s' not found.\n", nameSurname);
+    }
+    return matches > 0;
+}
+
+void storeSearchStudent(const char* nameSurname, const char* filePath) {
+    logMessage("operations.log", "searchStudent", "Operation started.");
+
+    GradeStore store;
+    if (storeOpen(&store, filePath) == -1) {
+        printf("Search operation failed.\n");
+        return;
+    }
+    int found = storeRead(&store, querySearch, nameSurname, stdout);
+    storeClose(&store);
+
+    char logBuffer[256];
+    snprintf(logBuffer, sizeof(logBuffer), found ? "Student found: %s." : "Student not found: %s.", nameSurname);
+    logMessage("operations.log", "searchStudent", logBuffer);
+}
+
+// Writes the live records in sortMode order; returns how many, or -1
+int64_t storeQuerySorted(const GradeStore* store, int sortMode, FILE* out) {
+    uint64_t count = storeVisibleCount(store);
+    int64_t written = 0;
+
+    switch (sortMode) {
+        case 2:
+            for (uint64_t i = count; i > 0; i--) {
+                const StudentInfo* student = storeIndexed(store, i - 1);
+                if (!storeIsDead(store, student - store->records)) {
+                    fprintf(out, "%s, %s\n", student->name, student->grade);
+                    written++;
+                }
+            }
+            return written;
+        case 3:
+        case 4: {
+            // Grade order is not indexed, so sort keys that point into the mapping
+            SortKey* keys = sortStudentKeys(store->records, count, sortMode);
+            if (keys == NULL) {
+                return -1;
+            }
+            for (uint64_t i = 0; i < count; i++) {
+                if (!storeIsDead(store, keys[i].record - store->records)) {
+                    fprintf(out, "%s, %s\n", keys[i].record->name, keys[i].record->grade);
+                    written++;
+                }
+            }
+            free(keys);
+            return written;
+        }
+        default:
+            for (uint64_t i = 0; i < count; i++) {
+                const StudentInfo* student = storeIndexed(store, i);
+                if (!storeIsDead(store, student - store->records)) {
+                    fprintf(out, "%s, %s\n", student->name, student->grade);
+                    written++;
+                }
+            }
+            return written;
+    }
+}
+
+void storeSortAll(const char* filePath, int sortMode, const char* outputPath) {
+    logMessage("operations.log", "sortAll", "Operation started.");
+
+    GradeStore store;
+    FILE* out = stdout;
+    if (storeOpen(&store, filePath) == -1) {
+        logMessage("operations.log", "sortAll", "Sorting failed.");
+        return;
+    }
+    // Text written over the store would truncate it before it is read, so refuse that
+    struct stat storeStat, outputStat;
+    if (outputPath != NULL && stat(outputPath, &outputStat) == 0 && fstat(store.fd, &storeStat) == 0 &&
+        outputStat.st_dev == storeStat.st_dev && outputStat.st_ino == storeStat.st_ino) {
+        fprintf(stderr, "Cannot write the sorted list over the grade store %s\n", filePath);
+        storeClose(&store);
+        logMessage("operations.log", "sortAll", "Sorting failed.");
+        return;
+    }
+    if (outputPath != NULL && (out = fopen(outputPath, "w")) == NULL) {
+        perror("Failed to open file for writing");
+        storeClose(&store);
+        logMessage("operations.log", "sortAll", "Sorting failed.");
+        return;
+    }
+    printf("%s\n", sortModeTitle(sortMode));
+    uint64_t written = 0;
+    CountedQuery query = {.sortMode = sortMode, .written = &written};
+    if (storeRead(&store, querySortedCounted, &query, out) == -1) {
+        storeClose(&store);
+        if (out != stdout) fclose(out);
+        logMessage("operations.log", "sortAll", "Sorting failed.");
+        return;
+    }
+    if (out != stdout) {
+        fclose(out);
+        printf("%llu students written to %s.\n", (unsigned long long)written, outputPath);
+    }
+    storeClose(&store);
+
+    switch (sortMode) {
+        case 2:
+            logMessage("operations.log", "sortAll", "Displayed students sorted descending ordered by name.");
+            break;
+        case 3:
+            logMessage("operations.log", "sortAll", "Displayed students sorted descending ordered by grade.");
+            break;
+        case 4:
+            logMessage("operations.log", "sortAll", "Displayed students sorted asscending ordered by grade.");
+            break;
+        default:
+            logMessage("operations.log", "sortAll", "Displayed students sorted ascending ordered by name.");
+    }
+}
+
+// Records are fixed size, so without deletions any page is a direct slice of the mapping.
+// Dead records are skipped a bitmap word at a time to find where the page starts.
+// Returns the number of records written.
+uint64_t storeQueryRange(const GradeStore* store, uint64_t start, uint64_t numEntries, FILE* out) {
+    uint64_t count = storeVisibleCount(store);
+    if (store->walLoaded == 0) {
+        uint64_t end = start + numEntries;
+        if (end > count || end < start) {
+            end = count;
+        }
+        for (uint64_t i = start; i < end; i++) {
+            fprintf(out, "%s, %s\n", store->records[i].name, store->records[i].grade);
+        }
+        return start < end ? end - start : 0;
+    }
+
+    uint64_t i = 0;
+    while (i + 64 <= count && i + 64 <= store->deadBits) {
+        uint64_t live = 64 - __builtin_popcountll(store->dead[i / 64]);
+        if (live > start) {
+            break;
+        }
+        start -= live;
+        i += 64;
+    }
+    uint64_t written = 0;
+    for (; i < count && written < numEntries; i++) {
+        if (storeIsDead(store, i)) {
+            continue;
+        }
+        if (start > 0) {
+            start--;
+            continue;
+        }
+        fprintf(out, "%s, %s\n", store->records[i].name, store->records[i].grade);
+        written++;
+    }
+    return written;
+}
+
+// storeRead adapters for the queries above
+static int querySearch(const GradeStore* store, const void* arg, FILE* out) {
+    return storeQuerySearch(store, arg, out);
+}
+
+static int querySorted(const GradeStore* store, const void* arg, FILE* out) {
+    return storeQuerySorted(store, *(const int*)arg, out) == -1 ? -1 : 0;
+}
+
+static int queryRange(const GradeStore* store, const void* arg, FILE* out) {
+    const uint64_t* range = arg; // First record and record count
+    storeQueryRange(store, range[0], range[1], out);
+    return 0;
+}
+
+// The same two queries for callers that report how many records went out. A repeated
+// run overwrites the count, so it always matches the output storeRead kept.
+static int querySortedCounted(const GradeStore* store, const void* arg, FILE* out) {
+    const CountedQuery* query = arg;
+    int64_t written = storeQuerySorted(store, query->sortMode, out);
+    if (written == -1) {
+        return -1;
+    }
+    *query->written = written;
+    return 0;
+}
+
+static int queryRangeCounted(const GradeStore* store, const void* arg, FILE* out) {
+    const CountedQuery* query = arg;
+    *query->written = storeQueryRange(store, query->range[0], query->range[1], out);
+    return 0;
+}
+
+// Counts for the whole store come straight from the header. A name prefix selects a
+// contiguous run of the sorted index, so only the matching records are visited.
+static void storeTally(const GradeStore* store, const char* prefix, GradeTally* tally) {
+    if (prefix == NULL || prefix[0] == '\0') {
+        *tally = store->header->tally;
+        return;
+    }
+    memset(tally, 0, sizeof(*tally));
+    size_t prefixLength = strlen(prefix);
+    uint64_t count = storeVisibleCount(store);
+    for (uint64_t i = storeLowerBound(store, prefix); i < count; i++) {
+        const StudentInfo* student = storeIndexed(store, i);
+        if (strncmp(student->name, prefix, prefixLength) != 0) {
+            break;
+        }
+        if (!storeIsDead(store, student - store->records)) {
+            tallyAdd(tally, student->grade);
+        }
+    }
+}
+
+static int queryStats(const GradeStore* store, const void* arg, FILE* out) {
+    GradeTally tally;
+    storeTally(store, arg, &tally);
+    printGradeStats(&tally, arg, out);
+    return 0;
+}
+
+static int queryHistogram(const GradeStore* store, const void* arg, FILE* out) {
+    GradeTally tally;
+    storeTally(store, arg, &tally);
+    printHistogram(&tally, out);
+    return 0;
+}
+
+// Text files have no counters, so they are tallied with one pass over the lines
+static int textTally(const char* filePath, const char* prefix, GradeTally* tally) {
+    int file = open(filePath, O_RDONLY);
+    if (file == -1) {
+        perror("Failed to open file for reading");
+        return -1;
+    }
+    LineReader* reader = malloc(sizeof(LineReader));
+    if (reader == NULL) {
+        perror("malloc");
+        close(file);
+        return -1;
+    }
+    struct stat st;
+    fstat(file, &st);
+    lineReaderInit(reader, file);
+    reader->limit = textStableSize(file, st.st_size);
+
+    memset(tally, 0, sizeof(*tally));
+    size_t prefixLength = prefix != NULL ? strlen(prefix) : 0;
+    char* line;
+    size_t length;
+    StudentInfo student;
+    while (lineReaderNext(reader, &line, &length)) {
+        if (parseStudentLine(line, length, &student) &&
+            (prefixLength == 0 || strncmp(student.name, prefix, prefixLength) == 0)) {
+            tallyAdd(tally, student.grade);
+        }
+    }
+    free(reader);
+    close(file);
+    return 0;
+}
+
+static void reportGrades(const char* filePath, const char* prefix, const char* operation, StoreQuery query) {
+    logMessage("operations.log", operation, "Operation started.");
+    int result;
+    if (useGradeStore(filePath)) {
+        GradeStore store;
+        result = storeOpen(&store, filePath);
+        if (result == 0) {
+            result = storeRead(&store, query, prefix, stdout);
+            storeClose(&store);
+        }
+    } else {
+        GradeTally tally;
+        result = textTally(filePath, prefix, &tally);
+        if (result == 0 && query == queryStats) {
+            printGradeStats(&tally, prefix, stdout);
+        } else if (result == 0) {
+            printHistogram(&tally, stdout);
+        }
+    }
+    logMessage("operations.log", operation, result == 0 ? "Report completed successfully." : "Report failed.");
+}
+
+void gradeStats(const char* filePath, const char* prefix) {
+    reportGrades(filePath, prefix, "gradeStats", queryStats);
+}
+
+void histogram(const char* filePath, const char* prefix) {
+    reportGrades(filePath, prefix, "histogram", queryHistogram);
+}
+
+void storeShowAll(const char* filePath) {
+    logMessage("operations.log", "showAll", "Operation started.");
+
+    GradeStore store;
+    if (storeOpen(&store, filePath) == -1) {
+        printf("Failed to display file content.\n");
+        logMessage("operations.log", "showAll", "Failed to display all grades.");
+        return;
+    }
+    uint64_t range[2] = {0, UINT64_MAX};
+    storeRead(&store, queryRange, range, stdout);
+    storeClose(&store);
+    logMessage("operations.log", "showAll", "Displayed all student grades successfully.");
+}
+
+static void storeListRange(uint64_t start, uint64_t numEntries, const char* filePath, const char* operation) {
+    logMessage("operations.log", operation, "Operation started.");
+
+    GradeStore store;
+    if (storeOpen(&store, filePath) == -1) {
+        logMessage("operations.log", operation, "Listing failed.");
+        return;
+    }
+    uint64_t range[2] = {start, numEntries};
+    storeRead(&store, queryRange, range, stdout);
+    storeClose(&store);
+    logMessage("operations.log", operation, "Listing completed successfully.");
+}
+
+void storeListGrades(const char* filePath) {
+    storeListRange(0, 5, filePath, "listGrades");
+}
+
+void storeListSome(int numEntries, int pageNumber, const char* filePath) {
+    if (numEntries <= 0 || pageNumber <= 0) {
+        printf("Invalid page.\n");
+        return;
+    }
+    storeListRange((uint64_t)(pageNumber - 1) * numEntries, numEntries, filePath, "listSome");
+}
+
+typedef struct {
+    const GradeStore* store;
+    uint32_t* numbers;
+    size_t count;
+    size_t capacity;
+    int failed;
+} RecordList;
+
+static void collectRecord(const StudentInfo* student, void* context) {
+    RecordList* list = context;
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 8;
+        uint32_t* numbers = realloc(list->numbers, capacity * sizeof(uint32_t));
+        if (numbers == NULL) {
+            list->failed = 1;
+            return;
+        }
+        list->numbers = numbers;
+        list->capacity = capacity;
+    }
+    list->numbers[list->count++] = (uint32_t)(student - list->store->records);
+}
+
+// Tombstones every live record of a student and, when newGrade is given, appends the new
+// version. Only the log and the new record are written, so this costs about as much as
+// an append. Returns how many records were replaced, or -1.
+int storeRemove(GradeStore* store, const char* nameSurname, const char* newGrade) {
+    if (storeWriteBegin(store) == -1) {
+        return -1;
+    }
+    RecordList list = {store, NULL, 0, 0, 0};
+    storeFindExact(store, nameSurname, collectRecord, &list);
+    int result = list.failed ? -1 : (int)list.count;
+
+    WalEntry* entries = result > 0 ? malloc(list.count * sizeof(WalEntry)) : NULL;
+    if (result > 0 && entries == NULL) {
+        perror("malloc");
+        result = -1;
+    }
+    if (result > 0) {
+        for (size_t i = 0; i < list.count; i++) {
+            entries[i].recordNumber = list.numbers[i];
+            entries[i].check = list.numbers[i] ^ WAL_CHECK;
+        }
+        size_t size = list.count * sizeof(WalEntry);
+        if (pwrite(store->walFd, entries, size, store->header->walCount * sizeof(WalEntry)) != (ssize_t)size) {
+            perror("Failed to write tombstones");
+            result = -1;
+        }
+    }
+    for (size_t i = 0; result > 0 && i < list.count; i++) {
+        if (storeMarkDead(store, list.numbers[i]) == -1) {
+            result = -1;
+            break;
+        }
+        tallyRemove(&store->header->tally, store->records[list.numbers[i]].grade);
+    }
+    if (result > 0) {
+        store->header->walCount += list.count;
+        store->header->deadCount += list.count;
+        store->walLoaded = store->header->walCount;
+    }
+    if (result > 0 && newGrade != NULL) {
+        StudentInfo student = store->records[list.numbers[0]]; // Keep the name as it was stored
+        memset(student.grade, 0, sizeof(student.grade));
+        snprintf(student.grade, sizeof(student.grade), "%s", newGrade);
+        if (storeInsert(store, &student) == -1) {
+            result = -1;
+        }
+    }
+    storeWriteEnd(store);
+    free(entries);
+    free(list.numbers);
+    return result;
+}
+
+int storeNeedsCompaction(const GradeStore* store) {
+    return store->header->deadCount >= COMPACT_MIN_DEAD &&
+           store->header->deadCount * 100 >= store->header->recordCount * COMPACT_GARBAGE_PERCENT;
+}
+
+// Moves the live records down from the saved cursor on. A record is copied before the
+// cursor passes it and sources at or past the cursor are never overwritten, so the move
+// can be repeated from the cursor after a crash. Returns the number of live records.
+static uint64_t storeCompactMove(GradeStore* store) {
+    uint64_t cursor = atomic_load(&store->header->compactCursor);
+    uint64_t count = store->header->recordCount;
+    uint64_t source = (cursor >> 32) - 1, target = (uint32_t)cursor;
+    for (; source < count; source++) {
+        if (storeIsDead(store, source)) {
+            continue;
+        }
+        if (target != source) {
+            store->records[target] = store->records[source];
+        }
+        target++;
+        atomic_store_explicit(&store->header->compactCursor, (source + 2) << 32 | target, memory_order_release);
+    }
+    atomic_store_explicit(&store->header->compactCursor, (count + 1) << 32 | target, memory_order_release);
+    return target;
+}
+
+// Second half of a compaction, once every live record has moved: empties the log and
+// drops the tail. Clearing the cursor is the commit point; a crash before it repeats
+// this step, and rebuildIndex is set then because the index may be half renumbered.
+static int storeCompactFinish(GradeStore* store, uint64_t live, int rebuildIndex) {
+    uint64_t count = store->header->recordCount;
+    memset(&store->records[live], 0, (count - live) * sizeof(StudentInfo));
+    store->header->walCount = 0;
+    if (ftruncate(store->walFd, 0) == -1) {
+        perror("ftruncate");
+    }
+    store->header->recordCount = live;
+    store->header->tallyCount = live;
+    store->header->deadCount = 0;
+    if (rebuildIndex) {
+        storeRebuildIndex(store);
+    }
+    // Only now may readers notice, so they never pair the new numbering with old log entries
+    store->compactions = atomic_fetch_add(&store->header->compactions, 1) + 1;
+    storeIndexSync(store);
+    atomic_store(&store->header->compactCursor, 0);
+    if (store->dead != NULL) {
+        memset(store->dead, 0, store->deadBits / 8);
+    }
+    store->walLoaded = 0;
+    return hashRebuild(store, live);
+}
+
+// Finishes a compaction a crashed process left behind; needs the write lock and the log
+// loaded in the old numbering, which it still is while the cursor is set
+static int storeCompactResume(GradeStore* store) {
+    fprintf(stderr, "Finishing an interrupted compaction of %s.\n", store->path);
+    atomic_fetch_add(&store->header->sequence, 1);
+    int result = storeCompactFinish(store, storeCompactMove(store), 1);
+    atomic_fetch_add(&store->header->sequence, 1);
+    return result;
+}
+
+// Squeezes dead records out of the data file in place. Live records keep their order, so
+// the name index is renumbered rather than sorted again; the hash table is rebuilt and
+// the log emptied. Readers see an odd sequence throughout and retry afterwards.
+int storeCompact(GradeStore* store) {
+    if (storeWriteBegin(store) == -1) {
+        return -1;
+    }
+    uint64_t count = store->header->recordCount;
+    uint32_t* renumber = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if (renumber == NULL) {
+        perror("malloc");
+        storeWriteEnd(store);
+        return -1;
+    }
+    uint64_t live = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        renumber[i] = storeIsDead(store, i) ? UINT32_MAX : (uint32_t)live++;
+    }
+    atomic_store(&store->header->compactCursor, 1ULL << 32); // Source 0, target 0
+    storeCompactMove(store);
+    uint64_t out = 0;
+    for (uint64_t position = 0; position < count; position++) {
+        uint32_t recordNumber = renumber[store->index[position]];
+        if (recordNumber != UINT32_MAX) {
+            store->index[out++] = recordNumber;
+        }
+    }
+    free(renumber);
+    int result = storeCompactFinish(store, live, 0);
+    storeWriteEnd(store);
+    return result;
+}
+
+static double elapsedSeconds(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// writev() until every segment is out; iov is consumed in place
+static int writevFully(int fd, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+// Writes a batch as "Name, GR" lines straight from the records, four segments per line,
+// and stores the offset each line starts at
+static int bulkWriteLines(int fd, const StudentInfo* students, uint64_t count, uint64_t* offsets, uint64_t* position) {
+    struct iovec iov[BULK_IOV_MAX];
+    int segments = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        size_t nameLength = strlen(students[i].name);
+        offsets[i] = *position;
+        *position += nameLength + 5;
+        iov[segments++] = (struct iovec){(void*)students[i].name, nameLength};
+        iov[segments++] = (struct iovec){", ", 2};
+        iov[segments++] = (struct iovec){(void*)students[i].grade, 2};
+        iov[segments++] = (struct iovec){"\n", 1};
+        if (segments == BULK_IOV_MAX || i == count - 1) {
+            if (writevFully(fd, iov, segments) == -1) {
+                perror("writev");
+                return -1;
+            }
+            segments = 0;
+        }
+    }
+    return 0;
+}
+
+// Reads the next source line; standard input goes through stdio so lines typed after the
+// command are not lost, and a line holding just "." ends the input there
+static int bulkNextLine(LineReader* reader, char** streamLine, size_t* streamSize, char** line, size_t* length) {
+    if (reader != NULL) {
+        return lineReaderNext(reader, line, length);
+    }
+    ssize_t bytesRead = getline(streamLine, streamSize, stdin);
+    if (bytesRead <= 0) {
+        clearerr(stdin); // Let the shell keep reading after Ctrl-D
+        return 0;
+    }
+    if ((*streamLine)[bytesRead - 1] == '\n') {
+        bytesRead--;
+    }
+    if (bytesRead == 1 && (*streamLine)[0] == '.') {
+        return 0;
+    }
+    *line = *streamLine;
+    *length = bytesRead;
+    return 1;
+}
+
+// Imports "Name, GR" records from a file or standard input ("-") into a text file or
+// grade store. Invalid lines are counted and skipped; valid ones go out in batches.
+void bulkImport(const char* sourcePath, const char* targetPath) {
+    int fromStdin = strcmp(sourcePath, "-") == 0;
+    int toStore = useGradeStore(targetPath);
+    int input = -1, output = -1;
+    LineReader* reader = NULL;
+    StudentInfo* batch = NULL;
+    uint64_t* offsets = NULL;
+    uint64_t offsetCapacity = 0;
+    char* streamLine = NULL;
+    size_t streamSize = 0;
+    GradeStore store;
+    struct stat before, after;
+    uint64_t position = 0, lineNumber = 0, imported = 0, rejected = 0, batchCount = 0;
+    int failed = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    store.header = NULL;
+    if (!fromStdin) {
+        input = open(sourcePath, O_RDONLY);
+        if (input == -1) {
+            perror("Failed to open file for reading");
+            logMessage("operations.log", "bulkImport", "Import failed.");
+            return;
+        }
+        reader = malloc(sizeof(LineReader));
+    }
+    batch = malloc(BULK_BATCH_RECORDS * sizeof(StudentInfo));
+    if ((!fromStdin && reader == NULL) || batch == NULL) {
+        perror("malloc");
+        failed = 1;
+    } else if (toStore) {
+        failed = storeOpen(&store, targetPath) == -1;
+    } else {
+        // Other writers wait for the whole import, so its lines and .lidx entries stay together
+        output = open(targetPath, O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (output == -1 || textLockWrite(output) == -1 || fstat(output, &before) == -1) {
+            perror("Failed to open file for writing");
+            failed = 1;
+        } else {
+            position = before.st_size;
+        }
+    }
+    if (reader != NULL) {
+        lineReaderInit(reader, input);
+    }
+
+    char* line;
+    size_t length;
+    int more = !failed;
+    while (more) {
+        more = bulkNextLine(reader, &streamLine, &streamSize, &line, &length);
+        if (more) {
+            lineNumber++;
+            if (length == 0) {
+                continue;
+            }
+            if (!parseGradeRecord(line, length, &batch[batchCount])) {
+                if (++rejected <= BULK_REPORT_REJECTS) {
+                    fprintf(stderr, "Line %llu rejected: %.*s\n", (unsigned long long)lineNumber,
+                            (int)(length > 80 ? 80 : length), line);
+                }
+                continue;
+            }
+            batchCount++;
+        }
+        if (batchCount == BULK_BATCH_RECORDS || (!more && batchCount > 0)) {
+            if (toStore) {
+                failed = storeAppendBatch(&store, batch, batchCount) == -1;
+            } else {
+                if (imported + batchCount > offsetCapacity) {
+                    uint64_t capacity = offsetCapacity ? offsetCapacity * 2 : BULK_BATCH_RECORDS;
+                    uint64_t* grown = realloc(offsets, capacity * sizeof(uint64_t));
+                    if (grown == NULL) {
+                        perror("realloc");
+                        failed = 1;
+                        break;
+                    }
+                    offsets = grown;
+                    offsetCapacity = capacity;
+                }
+                failed = bulkWriteLines(output, batch, batchCount, offsets + imported, &position) == -1;
+            }
+            if (failed) {
+                break;
+            }
+            imported += batchCount;
+            batchCount = 0;
+        }
+    }
+
+    if (output != -1) {
+        // One index update for the whole import, if nobody else wrote in between
+        if (!failed && imported > 0 && fstat(output, &after) == 0 && (uint64_t)after.st_size == position) {
+            lineIndexAppend(targetPath, &before, &after, offsets, imported);
+        }
+        textUnlock(output);
+        close(output);
+    }
+    if (toStore && store.header != NULL) {
+        storeClose(&store);
+    }
+    if (input != -1) {
+        close(input);
+    }
+    free(streamLine);
+    free(offsets);
+    free(batch);
+    free(reader);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = elapsedSeconds(start, end);
+    char logBuffer[512];
+    snprintf(logBuffer, sizeof(logBuffer), "%s %llu grades from %s into %s, %llu lines rejected.",
+             failed ? "Import failed after" : "Imported", (unsigned long long)imported,
+             fromStdin ? "standard input" : sourcePath, targetPath, (unsigned long long)rejected);
+    logMessage("operations.log", "bulkImport", logBuffer);
+    printf("%s\n", logBuffer);
+    printf("%.3f s, %.0f records/s\n", seconds, seconds > 0 ? imported / seconds : 0.0);
+}
+
+void exportGrades(const char* storePath, const char* textPath) {
+    logMessage("operations.log", "exportGrades", "Operation started.");
+
+    GradeStore store;
+    if (storeOpen(&store, storePath) == -1) {
+        logMessage("operations.log", "exportGrades", "Export failed.");
+        return;
+    }
+    FILE* output = fopen(textPath, "w");
+    if (output == NULL) {
+        perror("Failed to open file for writing");
+        storeClose(&store);
+        logMessage("operations.log", "exportGrades", "Export failed.");
+        return;
+    }
+    uint64_t written = 0;
+    CountedQuery query = {.range = {0, UINT64_MAX}, .written = &written};
+    storeRead(&store, queryRangeCounted, &query, output);
+    fclose(output);
+
+    char logBuffer[256];
+    snprintf(logBuffer, sizeof(logBuffer), "Exported %llu grades to %s.", (unsigned long long)written, textPath);
+    storeClose(&store);
+    logMessage("operations.log", "exportGrades", logBuffer);
+    printf("%s\n", logBuffer);
+}
+
+
+static int clientQueueInit(ClientQueue* queue, int size) {
+    queue->clients = malloc(size * sizeof(int));
+    if (queue->clients == NULL) {
+        return -1;
+    }
+    queue->size = size;
+    queue->in = queue->out = queue->count = 0;
+    queue->done = 0;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return 0;
+}
+
+static void clientQueueDestroy(ClientQueue* queue) {
+    while (queue->count > 0) {
+        close(queue->clients[queue->out]);
+        queue->out = (queue->out + 1) % queue->size;
+        queue->count--;
+    }
+    free(queue->clients);
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+}
+
+static void clientQueuePush(ClientQueue* queue, int clientFd) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->size && !queue->done) {
+        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    }
+    if (queue->done) {
+        close(clientFd);
+    } else {
+        queue->clients[queue->in] = clientFd;
+        queue->in = (queue->in + 1) % queue->size;
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Returns -1 once the queue is shut down and drained
+static int clientQueuePop(ClientQueue* queue) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && !queue->done) {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+    int clientFd = -1;
+    if (queue->count > 0) {
+        clientFd = queue->clients[queue->out];
+        queue->out = (queue->out + 1) % queue->size;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return clientFd;
+}
+
+static void serverStop(GradeServer* server) {
+    pthread_mutex_lock(&server->queue.mutex);
+    server->stopping = 1;
+    server->queue.done = 1;
+    // Wake workers parked on idle connections so they can be joined
+    for (int i = 0; i < server->numThreads; i++) {
+        if (server->activeClients[i] != -1) {
+            shutdown(server->activeClients[i], SHUT_RD);
+        }
+    }
+    pthread_cond_broadcast(&server->queue.not_empty);
+    pthread_cond_broadcast(&server->queue.not_full);
+    pthread_mutex_unlock(&server->queue.mutex);
+    shutdown(server->listenFd, SHUT_RDWR);
+}
+
+// Group commit: each worker queues its record, and whichever worker finds no commit in
+// progress writes every queued record with one storeAppendBatch while the others wait
+static int serverAppend(GradeServer* server, const char* nameSurname, const char* grade) {
+    int result = 1;
+    pthread_mutex_lock(&server->commitMutex);
+    while (server->pendingCount == SERVER_COMMIT_BATCH) {
+        pthread_cond_wait(&server->commitDone, &server->commitMutex);
+    }
+    PendingAppend* entry = &server->pending[server->pendingCount++];
+    memset(&entry->student, 0, sizeof(entry->student));
+    snprintf(entry->student.name, sizeof(entry->student.name), "%s", nameSurname);
+    snprintf(entry->student.grade, sizeof(entry->student.grade), "%s", grade);
+    entry->result = &result;
+
+    while (result == 1) {
+        if (server->committing) {
+            pthread_cond_wait(&server->commitDone, &server->commitMutex);
+            continue;
+        }
+        PendingAppend batch[SERVER_COMMIT_BATCH];
+        StudentInfo students[SERVER_COMMIT_BATCH];
+        int count = server->pendingCount;
+        memcpy(batch, server->pending, count * sizeof(PendingAppend));
+        for (int i = 0; i < count; i++) {
+            students[i] = batch[i].student;
+        }
+        server->pendingCount = 0;
+        server->committing = 1;
+        pthread_cond_broadcast(&server->commitDone); // Room for the next batch to gather
+        pthread_mutex_unlock(&server->commitMutex);
+
+        pthread_rwlock_wrlock(&server->storeLock);
+        int committed = storeAppendBatch(&server->store, students, count);
+        pthread_rwlock_unlock(&server->storeLock);
+
+        pthread_mutex_lock(&server->commitMutex);
+        for (int i = 0; i < count; i++) {
+            *batch[i].result = committed;
+        }
+        server->committing = 0;
+        pthread_cond_broadcast(&server->commitDone);
+    }
+    pthread_mutex_unlock(&server->commitMutex);
+    return result;
+}
+
+// Reads share the rwlock with each other; if another process grew the store the mapping
+// is refreshed under the exclusive lock, since other threads may be reading it
+static int serverRead(GradeServer* server, StoreQuery query, const void* arg, FILE* out) {
+    while (1) {
+        pthread_rwlock_rdlock(&server->storeLock);
+        int result = storeTryRead(&server->store, query, arg, out);
+        pthread_rwlock_unlock(&server->storeLock);
+        if (result != STORE_STALE) {
+            return result;
+        }
+        pthread_rwlock_wrlock(&server->storeLock);
+        result = storeRefresh(&server->store);
+        pthread_rwlock_unlock(&server->storeLock);
+        if (result == -1) {
+            return -1;
+        }
+    }
+}
+
+// Background compaction: woken by deletes and updates, and every COMPACT_CHECK_SECONDS for
+// changes made by other processes. Clients only wait while the rewrite itself runs.
+static void* serverCompactor(void* arg) {
+    GradeServer* server = arg;
+    pthread_mutex_lock(&server->compactMutex);
+    while (!server->stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += COMPACT_CHECK_SECONDS;
+        pthread_cond_timedwait(&server->compactWake, &server->compactMutex, &deadline);
+        if (server->stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&server->compactMutex);
+
+        pthread_rwlock_rdlock(&server->storeLock);
+        int needed = storeNeedsCompaction(&server->store);
+        pthread_rwlock_unlock(&server->storeLock);
+        if (needed) {
+            pthread_rwlock_wrlock(&server->storeLock);
+            unsigned long long dead = server->store.header->deadCount;
+            if (storeNeedsCompaction(&server->store) && storeCompact(&server->store) == 0) {
+                char logBuffer[512];
+                snprintf(logBuffer, sizeof(logBuffer), "Compacted %s, %llu dead records removed.", server->store.path, dead);
+                logMessage("operations.log", "compact", logBuffer);
+            }
+            pthread_rwlock_unlock(&server->storeLock);
+        }
+        pthread_mutex_lock(&server->compactMutex);
+    }
+    pthread_mutex_unlock(&server->compactMutex);
+    return NULL;
+}
+
+// Runs one request line against the resident store; returns 1 when the client asked for shutdown
+static int serverExecute(GradeServer* server, char* line, FILE* out) {
+    char* args[10];
+    int argCount = 0;
+    char* savePtr;
+    char* token = strtok_r(line, " ", &savePtr);
+    while (token != NULL && argCount < 10) {
+        args[argCount++] = token;
+        token = strtok_r(NULL, " ", &savePtr);
+    }
+    if (argCount == 0) {
+        return 0;
+    }
+
+    char fullName[256] = "";
+    if (strcmp(args[0], "addStudentGrade") == 0 && argCount >= 3) {
+        for (int i = 1; i < argCount - 1; ++i) {
+            strcat(fullName, args[i]);
+            if (i < argCount - 2) strcat(fullName, " ");
+        }
+        int result = serverAppend(server, fullName, args[argCount - 1]);
+
+        char logBuffer[512];
+        if (result == 0) {
+            snprintf(logBuffer, sizeof(logBuffer), "Successfully added grade for %s.", fullName);
+            logMessage("operations.log", "addStudentGrade", logBuffer);
+            fprintf(out, "Student grade added successfully.\n");
+        } else {
+            logMessage("operations.log", "addStudentGrade", "Failed to add student grade.");
+            fprintf(out, "Failed to add student grade.\n");
+        }
+        return 0;
+    }
+    int update = strcmp(args[0], "updateStudentGrade") == 0;
+    if ((update && argCount >= 3) || (strcmp(args[0], "deleteStudent") == 0 && argCount >= 2)) {
+        int nameEnd = update ? argCount - 1 : argCount;
+        for (int i = 1; i < nameEnd; ++i) {
+            strcat(fullName, args[i]);
+            if (i < nameEnd - 1) strcat(fullName, " ");
+        }
+        pthread_rwlock_wrlock(&server->storeLock);
+        int replaced = storeRemove(&server->store, fullName, update ? args[argCount - 1] : NULL);
+        pthread_rwlock_unlock(&server->storeLock);
+
+        char logBuffer[512];
+        if (replaced == -1) {
+            snprintf(logBuffer, sizeof(logBuffer), "Failed to change %s.", fullName);
+        } else if (replaced == 0) {
+            snprintf(logBuffer, sizeof(logBuffer), "Student '%s' not found.", fullName);
+        } else if (update) {
+            snprintf(logBuffer, sizeof(logBuffer), "Updated grade for %s to %s.", fullName, args[argCount - 1]);
+        } else {
+            snprintf(logBuffer, sizeof(logBuffer), "Deleted %s.", fullName);
+        }
+        logMessage("operations.log", args[0], logBuffer);
+        fprintf(out, "%s\n", logBuffer);
+        if (replaced > 0) {
+            pthread_mutex_lock(&server->compactMutex);
+            pthread_cond_signal(&server->compactWake);
+            pthread_mutex_unlock(&server->compactMutex);
+        }
+        return 0;
+    }
+    if (strcmp(args[0], "shutdown") == 0) {
+        fprintf(out, "Server shutting down.\n");
+        return 1;
+    }
+    if (strcmp(args[0], "ping") == 0) {
+        fprintf(out, "pong\n");
+        return 0;
+    }
+
+    // Everything else only reads, so it runs concurrently with other readers
+    uint64_t range[2];
+    if (strcmp(args[0], "searchStudent") == 0 && argCount >= 2) {
+        for (int i = 1; i < argCount; ++i) {
+            strcat(fullName, args[i]);
+            if (i < argCount - 1) strcat(fullName, " ");
+        }
+        serverRead(server, querySearch, fullName, out);
+    } else if (strcmp(args[0], "sortAll") == 0) {
+        int sortMode = argCount >= 2 ? atoi(args[1]) : 1;
+        fprintf(out, "%s\n", sortModeTitle(sortMode));
+        serverRead(server, querySorted, &sortMode, out);
+    } else if (strcmp(args[0], "showAll") == 0) {
+        range[0] = 0;
+        range[1] = UINT64_MAX;
+        serverRead(server, queryRange, range, out);
+    } else if (strcmp(args[0], "listGrades") == 0) {
+        range[0] = 0;
+        range[1] = 5;
+        serverRead(server, queryRange, range, out);
+    } else if (strcmp(args[0], "gradeStats") == 0 || strcmp(args[0], "histogram") == 0) {
+        for (int i = 1; i < argCount; ++i) {
+            strcat(fullName, args[i]);
+            if (i < argCount - 1) strcat(fullName, " ");
+        }
+        serverRead(server, strcmp(args[0], "gradeStats") == 0 ? queryStats : queryHistogram, fullName, out);
+    } else if (strcmp(args[0], "listSome") == 0 && argCount == 3 && atoi(args[1]) > 0 && atoi(args[2]) > 0) {
+        range[0] = (uint64_t)(atoi(args[2]) - 1) * atoi(args[1]);
+        range[1] = atoi(args[1]);
+        serverRead(server, queryRange, range, out);
+    } else {
+        fprintf(out, "Invalid command!\n");
+    }
+    return 0;
+}
+
+static void serverHandleClient(GradeServer* server, int clientFd) {
+    FILE* in = fdopen(clientFd, "r");
+    FILE* out = fdopen(dup(clientFd), "w");
+    if (in == NULL || out == NULL) {
+        perror("fdopen");
+        if (in != NULL) fclose(in); else close(clientFd);
+        if (out != NULL) fclose(out);
+        return;
+    }
+
+    char line[512];
+    while (!server->stopping && fgets(line, sizeof(line), in) != NULL) {
+        line[strcspn(line, "\n")] = 0;
+        int stop = serverExecute(server, line, out);
+        fputs(SERVER_END_OF_REPLY, out);
+        fflush(out);
+        if (stop) {
+            serverStop(server);
+            break;
+        }
+    }
+    fclose(out);
+    fclose(in);
+}
+
+typedef struct {
+    GradeServer* server;
+    int id;
+} ServerWorkerArgs;
+
+static void* serverWorker(void* arg) {
+    ServerWorkerArgs* workerArgs = arg;
+    GradeServer* server = workerArgs->server;
+    int clientFd;
+    while ((clientFd = clientQueuePop(&server->queue)) != -1) {
+        pthread_mutex_lock(&server->queue.mutex);
+        server->activeClients[workerArgs->id] = clientFd;
+        if (server->stopping) {
+            shutdown(clientFd, SHUT_RD);
+        }
+        pthread_mutex_unlock(&server->queue.mutex);
+
+        serverHandleClient(server, clientFd);
+
+        pthread_mutex_lock(&server->queue.mutex);
+        server->activeClients[workerArgs->id] = -1;
+        pthread_mutex_unlock(&server->queue.mutex);
+    }
+    return NULL;
+}
+
+void serveGrades(const char* storePath, const char* socketPath, int numThreads) {
+    if (numThreads <= 0) {
+        numThreads = SERVER_DEFAULT_THREADS;
+    }
+    signal(SIGPIPE, SIG_IGN); // A client hanging up mid-reply must not kill the server
+
+    GradeServer server;
+    memset(&server, 0, sizeof(server));
+    server.numThreads = numThreads;
+    if (storeOpen(&server.store, storePath) == -1) {
+        return;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+    server.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath); // Remove a socket left behind by an earlier server
+    if (server.listenFd == -1 ||
+        bind(server.listenFd, (struct sockaddr*)&address, sizeof(address)) == -1 ||
+        listen(server.listenFd, SERVER_QUEUE_SIZE) == -1) {
+        perror("Failed to listen on socket");
+        if (server.listenFd != -1) close(server.listenFd);
+        storeClose(&server.store);
+        return;
+    }
+
+    pthread_rwlock_init(&server.storeLock, NULL);
+    pthread_mutex_init(&server.commitMutex, NULL);
+    pthread_cond_init(&server.commitDone, NULL);
+    pthread_mutex_init(&server.compactMutex, NULL);
+    pthread_cond_init(&server.compactWake, NULL);
+    pthread_create(&server.compactor, NULL, serverCompactor, &server);
+    clientQueueInit(&server.queue, SERVER_QUEUE_SIZE);
+    pthread_t* threads = malloc(numThreads * sizeof(pthread_t));
+    ServerWorkerArgs* workerArgs = malloc(numThreads * sizeof(ServerWorkerArgs));
+    server.activeClients = malloc(numThreads * sizeof(int));
+    for (int i = 0; i < numThreads; i++) {
+        server.activeClients[i] = -1;
+        workerArgs[i].server = &server;
+        workerArgs[i].id = i;
+        pthread_create(&threads[i], NULL, serverWorker, &workerArgs[i]);
+    }
+
+    char logBuffer[256];
+    snprintf(logBuffer, sizeof(logBuffer), "Serving %s on %s with %d threads.", storePath, socketPath, numThreads);
+    logMessage("operations.log", "serveGrades", logBuffer);
+    printf("%s\n", logBuffer);
+    fflush(stdout);
+
+    while (!server.stopping) {
+        int clientFd = accept(server.listenFd, NULL, NULL);
+        if (clientFd == -1) {
+            if (errno == EINTR) continue;
+            break; // serverStop() shut the listening socket down
+        }
+        clientQueuePush(&server.queue, clientFd);
+    }
+
+    serverStop(&server);
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_lock(&server.compactMutex);
+    pthread_cond_signal(&server.compactWake);
+    pthread_mutex_unlock(&server.compactMutex);
+    pthread_join(server.compactor, NULL);
+    close(server.listenFd);
+    unlink(socketPath);
+    clientQueueDestroy(&server.queue);
+    pthread_rwlock_destroy(&server.storeLock);
+    pthread_mutex_destroy(&server.commitMutex);
+    pthread_cond_destroy(&server.commitDone);
+    pthread_mutex_destroy(&server.compactMutex);
+    pthread_cond_destroy(&server.compactWake);
+    storeClose(&server.store);
+    free(server.activeClients);
+    free(workerArgs);
+    free(threads);
+
+    logMessage("operations.log", "serveGrades", "Server stopped.");
+    printf("Server stopped.\n");
+}
+
+static int connectToServer(const char* socketPath) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", socketPath);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+        perror("Failed to connect to server");
+        if (fd != -1) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Sends one request and copies the reply to out (or discards it when out is NULL)
+static int sendRequest(int fd, FILE* in, const char* request, FILE* out) {
+    char buffer[512];
+    int length = snprintf(buffer, sizeof(buffer), "%s\n", request);
+    if (write(fd, buffer, length) != length) {
+        return -1;
+    }
+    while (fgets(buffer, sizeof(buffer), in) != NULL) {
+        if (strcmp(buffer, SERVER_END_OF_REPLY) == 0) {
+            return 0;
+        }
+        if (out != NULL) {
+            fputs(buffer, out);
+        }
+    }
+    return -1;
+}
+
+void remoteCommand(const char* socketPath, const char* request) {
+    signal(SIGPIPE, SIG_IGN);
+    int fd = connectToServer(socketPath);
+    if (fd == -1) {
+        return;
+    }
+    FILE* in = fdopen(fd, "r");
+    if (sendRequest(fd, in, request, stdout) == -1) {
+        printf("Server closed the connection.\n");
+    }
+    fclose(in);
+}
+
+typedef struct {
+    const char* socketPath;
+    char (*names)[100];
+    int numNames;
+    int ops;
+    int failed;
+} BenchClientArgs;
+
+static void* benchClient(void* arg) {
+    BenchClientArgs* bench = arg;
+    int fd = connectToServer(bench->socketPath);
+    if (fd == -1) {
+        bench->failed = 1;
+        return NULL;
+    }
+    FILE* in = fdopen(fd, "r");
+    char request[256];
+    for (int i = 0; i < bench->ops; i++) {
+        snprintf(request, sizeof(request), "searchStudent %s", bench->names[i % bench->numNames]);
+        if (sendRequest(fd, in, request, NULL) == -1) {
+            bench->failed = 1;
+            break;
+        }
+    }
+    fclose(in);
+    return NULL;
+}
+
+// Compares searchStudent throughput of a running server against the fork-per-command path
+void benchServer(const char* socketPath, const char* textPath, int ops, int numClients) {
+    if (ops <= 0 || numClients <= 0) {
+        printf("Invalid benchmark size.\n");
+        return;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    FILE* input = fopen(textPath, "r");
+    if (input == NULL) {
+        perror("Failed to open file for reading");
+        return;
+    }
+    char (*names)[100] = malloc(BENCH_MAX_NAMES * sizeof(*names));
+    char grade[3], line[256];
+    int numNames = 0;
+    while (numNames < BENCH_MAX_NAMES && fgets(line, sizeof(line), input) != NULL) {
+        if (sscanf(line, "%99[^,], %2s", names[numNames], grade) == 2) {
+            size_t length = strlen(names[numNames]);
+            while (length > 0 && names[numNames][length - 1] == ' ') names[numNames][--length] = '\0';
+            numNames++;
+        }
+    }
+    fclose(input);
+    if (numNames == 0) {
+        printf("No names to search for in %s.\n", textPath);
+        free(names);
+        return;
+    }
+
+    pthread_t* threads = malloc(numClients * sizeof(pthread_t));
+    BenchClientArgs* clients = malloc(numClients * sizeof(BenchClientArgs));
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numClients; i++) {
+        clients[i].socketPath = socketPath;
+        clients[i].names = names;
+        clients[i].numNames = numNames;
+        clients[i].ops = ops / numClients + (i < ops % numClients);
+        clients[i].failed = 0;
+        pthread_create(&threads[i], NULL, benchClient, &clients[i]);
+    }
+    int failed = 0;
+    for (int i = 0; i < numClients; i++) {
+        pthread_join(threads[i], NULL);
+        failed |= clients[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double serverSeconds = elapsedSeconds(start, end);
+    free(clients);
+    free(threads);
+    if (failed) {
+        printf("Server benchmark failed; is serveGrades running on %s?\n", socketPath);
+        free(names);
+        return;
+    }
+
+    // The fork model is orders of magnitude slower, so it gets a smaller sample
+    int forkOps = ops < BENCH_MAX_FORK_OPS ? ops : BENCH_MAX_FORK_OPS;
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < forkOps; i++) {
+        searchStudent(names[i % numNames], textPath);
+    }
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    close(devNull);
+    double forkSeconds = elapsedSeconds(start, end);
+
+    printf("Server: %d searches from %d clients in %.3f s (%.0f ops/s)\n",
+           ops, numClients, serverSeconds, ops / serverSeconds);
+    printf("Fork model: %d searches in %.3f s (%.0f ops/s)\n", forkOps, forkSeconds, forkOps / forkSeconds);
+    free(names);
+}
+
+// Finds or opens the store a script reads; NULL makes the command run in order instead
+static ScriptStore* scriptStoreFor(ScriptStore** stores, const char* path) {
+    for (ScriptStore* entry = *stores; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    ScriptStore* entry = calloc(1, sizeof(ScriptStore));
+    if (entry == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    if (storeOpen(&entry->store, path) == -1) {
+        free(entry);
+        return NULL;
+    }
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    pthread_rwlock_init(&entry->lock, NULL);
+    entry->next = *stores;
+    *stores = entry;
+    return entry;
+}
+
+// Turns a read-only store command into a job for the pool. Returns 0 for anything that has
+// to run in order: writes, text files, output files and commands with bad arguments.
+static int scriptPrepare(ScriptJob* job, char* args[], int argCount, ScriptStore** stores) {
+    memset(job, 0, sizeof(*job));
+    const char* path = args[argCount - 1];
+    if (argCount < 2) {
+        return 0;
+    }
+    if (strcmp(args[0], "searchStudent") == 0 && argCount >= 3) {
+        for (int i = 1; i < argCount - 1; ++i) {
+            strcat(job->text, args[i]);
+            if (i < argCount - 2) strcat(job->text, " ");
+        }
+        job->query = querySearch;
+    } else if (strcmp(args[0], "sortAll") == 0 && argCount <= 3) {
+        path = args[1];
+        job->sortMode = argCount == 3 ? atoi(args[2]) : 1;
+        job->title = sortModeTitle(job->sortMode);
+        job->query = querySorted;
+    } else if (strcmp(args[0], "showAll") == 0 && argCount == 2) {
+        job->range[1] = UINT64_MAX;
+        job->query = queryRange;
+    } else if (strcmp(args[0], "listGrades") == 0 && argCount == 2) {
+        job->range[1] = 5;
+        job->query = queryRange;
+    } else if (strcmp(args[0], "listSome") == 0 && argCount == 4 && atoi(args[1]) > 0 && atoi(args[2]) > 0) {
+        job->range[0] = (uint64_t)(atoi(args[2]) - 1) * atoi(args[1]);
+        job->range[1] = atoi(args[1]);
+        job->query = queryRange;
+    } else if (strcmp(args[0], "gradeStats") == 0 || strcmp(args[0], "histogram") == 0) {
+        path = args[1];
+        for (int i = 2; i < argCount; ++i) {
+            strcat(job->text, args[i]);
+            if (i < argCount - 1) strcat(job->text, " ");
+        }
+        job->query = strcmp(args[0], "gradeStats") == 0 ? queryStats : queryHistogram;
+    } else {
+        return 0;
+    }
+    if (!useGradeStore(path) || (job->store = scriptStoreFor(stores, path)) == NULL) {
+        return 0;
+    }
+    return 1;
+}
+
+// Same retry loop as serverRead, with the script's per-store lock
+static void scriptRunJob(ScriptJob* job) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    FILE* out = open_memstream(&job->output, &job->outputSize);
+    if (out == NULL) {
+        perror("open_memstream");
+        return;
+    }
+    if (job->title != NULL) {
+        fprintf(out, "%s\n", job->title);
+    }
+    const void* arg = job->query == querySorted ? (const void*)&job->sortMode :
+                      job->query == queryRange ? (const void*)job->range : (const void*)job->text;
+    while (1) {
+        pthread_rwlock_rdlock(&job->store->lock);
+        int result = storeTryRead(&job->store->store, job->query, arg, out);
+        pthread_rwlock_unlock(&job->store->lock);
+        if (result != STORE_STALE) {
+            break;
+        }
+        pthread_rwlock_wrlock(&job->store->lock);
+        result = storeRefresh(&job->store->store);
+        pthread_rwlock_unlock(&job->store->lock);
+        if (result == -1) {
+            break;
+        }
+    }
+    fclose(out);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    job->seconds = elapsedSeconds(start, end);
+}
+
+static void* scriptWorker(void* arg) {
+    ScriptPool* pool = arg;
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (pool->next >= pool->count && !pool->stopping) {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (pool->next >= pool->count) {
+            break;
+        }
+        ScriptJob* job = &pool->jobs[pool->next++];
+        pthread_mutex_unlock(&pool->mutex);
+        scriptRunJob(job);
+        pthread_mutex_lock(&pool->mutex);
+        job->done = 1;
+        pthread_cond_broadcast(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static int scriptRecordLatency(double** latencies, size_t* count, size_t* capacity, double seconds) {
+    if (*count == *capacity) {
+        size_t newCapacity = *capacity == 0 ? 1024 : *capacity * 2;
+        double* grown = realloc(*latencies, newCapacity * sizeof(double));
+        if (grown == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        *latencies = grown;
+        *capacity = newCapacity;
+    }
+    (*latencies)[(*count)++] = seconds;
+    return 0;
+}
+
+// Waits for the queued jobs and prints their output in script order
+static void scriptDrain(ScriptPool* pool, double** latencies, size_t* count, size_t* capacity) {
+    pthread_mutex_lock(&pool->mutex);
+    for (int i = 0; i < pool->count; i++) {
+        ScriptJob* job = &pool->jobs[i];
+        while (!job->done) {
+            pthread_cond_wait(&pool->finished, &pool->mutex);
+        }
+        fwrite(job->output, 1, job->outputSize, stdout);
+        free(job->output);
+        scriptRecordLatency(latencies, count, capacity, job->seconds);
+    }
+    pool->count = pool->next = 0;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static int compareSeconds(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double* sorted, size_t count, int percent) {
+    size_t rank = (count * percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// Runs a file of shell commands. Consecutive read-only commands against grade stores run
+// concurrently; anything else waits for them and then runs alone, so writes stay ordered.
+// The script is read with a LineReader rather than stdio: text commands fork, and a child's
+// exit() would seek a shared FILE's descriptor back to where the child thinks it is.
+void runScript(const char* scriptPath, int numThreads) {
+    int script = open(scriptPath, O_RDONLY);
+    LineReader* reader = malloc(sizeof(LineReader));
+    if (script == -1 || reader == NULL) {
+        perror("Failed to open script");
+        if (script != -1) close(script);
+        free(reader);
+        return;
+    }
+    lineReaderInit(reader, script);
+    if (numThreads <= 0) {
+        numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (numThreads < 1) {
+        numThreads = 1;
+    } else if (numThreads > SCRIPT_MAX_THREADS) {
+        numThreads = SCRIPT_MAX_THREADS;
+    }
+    logMessage("operations.log", "runScript", "Operation started.");
+
+    ScriptPool* pool = calloc(1, sizeof(ScriptPool));
+    pthread_t threads[SCRIPT_MAX_THREADS];
+    if (pool == NULL) {
+        perror("calloc");
+        close(script);
+        free(reader);
+        return;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    for (int i = 0; i < numThreads; i++) {
+        pthread_create(&threads[i], NULL, scriptWorker, pool);
+    }
+
+    ScriptStore* stores = NULL;
+    double* latencies = NULL;
+    size_t latencyCount = 0, latencyCapacity = 0, concurrent = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    char line[512];
+    char* text;
+    size_t length;
+    int stop = 0;
+    while (!stop && lineReaderNext(reader, &text, &length)) {
+        if (length >= sizeof(line)) {
+            length = sizeof(line) - 1;
+        }
+        memcpy(line, text, length);
+        line[length] = '\0';
+        char* args[10];
+        int argCount = 0;
+        char* savePtr;
+        char* token = strtok_r(line, " ", &savePtr);
+        while (token != NULL && argCount < 10) {
+            args[argCount++] = token;
+            token = strtok_r(NULL, " ", &savePtr);
+        }
+        if (argCount == 0 || args[0][0] == '#') {
+            continue;
+        }
+
+        ScriptJob job;
+        if (scriptPrepare(&job, args, argCount, &stores)) {
+            if (pool->count == SCRIPT_WINDOW) {
+                scriptDrain(pool, &latencies, &latencyCount, &latencyCapacity);
+            }
+            pthread_mutex_lock(&pool->mutex);
+            pool->jobs[pool->count++] = job;
+            pthread_cond_signal(&pool->work);
+            pthread_mutex_unlock(&pool->mutex);
+            concurrent++;
+            continue;
+        }
+
+        // A barrier: earlier reads finish and print first, later ones see this command's effect
+        scriptDrain(pool, &latencies, &latencyCount, &latencyCapacity);
+        fflush(stdout);
+        struct timespec commandStart, commandEnd;
+        clock_gettime(CLOCK_MONOTONIC, &commandStart);
+        stop = runCommand(args, argCount);
+        fflush(stdout);
+        clock_gettime(CLOCK_MONOTONIC, &commandEnd);
+        scriptRecordLatency(&latencies, &latencyCount, &latencyCapacity, elapsedSeconds(commandStart, commandEnd));
+    }
+    scriptDrain(pool, &latencies, &latencyCount, &latencyCapacity);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(script);
+    free(reader);
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < numThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->finished);
+    free(pool);
+    while (stores != NULL) {
+        ScriptStore* next = stores->next;
+        storeClose(&stores->store);
+        pthread_rwlock_destroy(&stores->lock);
+        free(stores);
+        stores = next;
+    }
+
+    double seconds = elapsedSeconds(start, end);
+    char logBuffer[512];
+    snprintf(logBuffer, sizeof(logBuffer), "Ran %zu commands from %s (%zu concurrently on %d threads) in %.3f s.",
+             latencyCount, scriptPath, concurrent, numThreads, seconds);
+    logMessage("operations.log", "runScript", logBuffer);
+    printf("%s\n", logBuffer);
+    if (latencyCount > 0) {
+        qsort(latencies, latencyCount, sizeof(double), compareSeconds);
+        printf("%.0f commands/s, latency ms p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+               seconds > 0 ? latencyCount / seconds : 0, percentile(latencies, latencyCount, 50) * 1000,
+               percentile(latencies, latencyCount, 95) * 1000, percentile(latencies, latencyCount, 99) * 1000,
+               latencies[latencyCount - 1] * 1000);
+    }
+    free(latencies);
+}
+
+
+void lineReaderInit(LineReader* reader, int fd) {
+    reader->fd = fd;
+    reader->start = reader->end = 0;
+    reader->eof = 0;
+    reader->limit = UINT64_MAX;
+}
+
+// Returns the next line without its newline; lines are never split across read() chunks
+int lineReaderNext(LineReader* reader, char** line, size_t* length) {
+    while (1) {
+        char* newline = memchr(reader->buffer + reader->start, '\n', reader->end - reader->start);
+        if (newline != NULL) {
+            *line = reader->buffer + reader->start;
+            *length = newline - *line;
+            reader->start += *length + 1;
+            return 1;
+        }
+        if (reader->eof) {
+            if (reader->start == reader->end) {
+                return 0;
+            }
+            // Last line without a trailing newline
+            *line = reader->buffer + reader->start;
+            *length = reader->end - reader->start;
+            reader->start = reader->end;
+            return 1;
+        }
+
+        // Move the partial line to the front and read more behind it
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+        if (reader->end == sizeof(reader->buffer)) {
+            // Overlong line: hand it out in buffer-sized pieces
+            *line = reader->buffer;
+            *length = reader->end;
+            reader->start = reader->end;
+            return 1;
+        }
+        size_t space = sizeof(reader->buffer) - reader->end;
+        if (space > reader->limit) {
+            space = reader->limit;
+        }
+        ssize_t bytesRead = space > 0 ? read(reader->fd, reader->buffer + reader->end, space) : 0;
+        if (bytesRead == -1 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            reader->eof = 1;
+        } else {
+            reader->end += bytesRead;
+            reader->limit -= bytesRead;
+        }
+    }
+}
+
+int textLockWrite(int fd) {
+    struct flock lock = {.l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    while (fcntl(fd, F_SETLKW, &lock) == -1) {
+        if (errno != EINTR) {
+            perror("fcntl");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void textUnlock(int fd) {
+    struct flock lock = {.l_type = F_UNLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    fcntl(fd, F_SETLK, &lock);
+}
+
+// Bytes of a text file that readers should look at. While another process holds the
+// write lock, a last line without its newline is still being written and is left out.
+uint64_t textStableSize(int fd, uint64_t size) {
+    char last;
+    if (size == 0 || pread(fd, &last, 1, size - 1) != 1 || last == '\n') {
+        return size;
+    }
+    struct flock lock = {.l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    if (fcntl(fd, F_GETLK, &lock) == -1 || lock.l_type == F_UNLCK) {
+        return size; // Nobody is writing: the file really ends without a newline
+    }
+    char buffer[4096];
+    while (size > 0) {
+        size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+        if (pread(fd, buffer, chunk, size - chunk) != (ssize_t)chunk) {
+            return 0;
+        }
+        const char* newline = memrchr(buffer, '\n', chunk);
+        if (newline != NULL) {
+            return size - chunk + (newline - buffer) + 1;
+        }
+        size -= chunk;
+    }
+    return 0;
+}
+
+// Parses a "Name Surname, GR" line; returns 0 for blank or malformed lines
+int parseStudentLine(const char* line, size_t length, StudentInfo* student) {
+    char copy[256];
+    if (length >= sizeof(copy)) {
+        length = sizeof(copy) - 1;
+    }
+    memcpy(copy, line, length);
+    copy[length] = '\0';
+    memset(student, 0, sizeof(*student));
+    return sscanf(copy, "%99[^,], %2s", student->name, student->grade) == 2;
+}
+
+int gradeIndex(const char* grade) {
+    for (int i = 0; i < NUM_GRADES; i++) {
+        if (strcmp(grade, gradeNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void tallyAdd(GradeTally* tally, const char* grade) {
+    int index = gradeIndex(grade);
+    if (index == -1) {
+        tally->counts[NUM_GRADES]++;
+        return;
+    }
+    tally->counts[index]++;
+    tally->points += gradePoints[index];
+}
+
+void tallyRemove(GradeTally* tally, const char* grade) {
+    int index = gradeIndex(grade);
+    if (index == -1) {
+        tally->counts[NUM_GRADES]--;
+        return;
+    }
+    tally->counts[index]--;
+    tally->points -= gradePoints[index];
+}
+
+void printGradeStats(const GradeTally* tally, const char* prefix, FILE* out) {
+    uint64_t graded = 0;
+    for (int i = 0; i < NUM_GRADES; i++) {
+        graded += tally->counts[i];
+    }
+    uint64_t total = graded + tally->counts[NUM_GRADES];
+    if (prefix != NULL && prefix[0] != '\0') {
+        fprintf(out, "Students: %llu (names starting with \"%s\")\n", (unsigned long long)total, prefix);
+    } else {
+        fprintf(out, "Students: %llu\n", (unsigned long long)total);
+    }
+    if (total == 0) {
+        return;
+    }
+    if (graded > 0) {
+        fprintf(out, "Average grade point: %.2f\n", tally->points / 10.0 / graded);
+    }
+    for (int i = 0; i <= NUM_GRADES; i++) {
+        if (i == NUM_GRADES && tally->counts[i] == 0) {
+            break;
+        }
+        fprintf(out, "%s: %llu (%.1f%%)\n", i < NUM_GRADES ? gradeNames[i] : "Other",
+                (unsigned long long)tally->counts[i], 100.0 * tally->counts[i] / total);
+    }
+}
+
+void printHistogram(const GradeTally* tally, FILE* out) {
+    const int width = 40;
+    uint64_t largest = 0;
+    for (int i = 0; i <= NUM_GRADES; i++) {
+        if (tally->counts[i] > largest) {
+            largest = tally->counts[i];
+        }
+    }
+    for (int i = 0; i <= NUM_GRADES; i++) {
+        if (i == NUM_GRADES && tally->counts[i] == 0) {
+            break;
+        }
+        int bar = largest > 0 ? (int)((tally->counts[i] * width + largest / 2) / largest) : 0;
+        fprintf(out, "%-5s |%.*s%*s %llu\n", i < NUM_GRADES ? gradeNames[i] : "Other",
+                bar, "########################################", width - bar, "",
+                (unsigned long long)tally->counts[i]);
+    }
+}
+
+// Strict form of parseStudentLine for imports: exactly one comma, a non-empty name
+// that fits the record and a known letter grade; surrounding blanks are dropped
+int parseGradeRecord(const char* line, size_t length, StudentInfo* student) {
+    const char* comma = memchr(line, ',', length);
+    if (comma == NULL || memchr(comma + 1, ',', line + length - comma - 1) != NULL) {
+        return 0;
+    }
+    const char* name = line;
+    const char* nameEnd = comma;
+    const char* grade = comma + 1;
+    const char* gradeEnd = line + length;
+    while (name < nameEnd && (*name == ' ' || *name == '\t')) name++;
+    while (nameEnd > name && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+    while (grade < gradeEnd && (*grade == ' ' || *grade == '\t')) grade++;
+    while (gradeEnd > grade && (gradeEnd[-1] == ' ' || gradeEnd[-1] == '\t' || gradeEnd[-1] == '\r')) gradeEnd--;
+
+    memset(student, 0, sizeof(*student));
+    if (nameEnd == name || (size_t)(nameEnd - name) >= sizeof(student->name) ||
+        gradeEnd - grade != 2) {
+        return 0;
+    }
+    memcpy(student->name, name, nameEnd - name);
+    memcpy(student->grade, grade, 2);
+    return gradeIndex(student->grade) != -1;
+}
+
+const char* sortModeTitle(int sortMode) {
+    switch (sortMode) {
+        case 2: return "Students sorted descending ordered by name.";
+        case 3: return "Students sorted descending ordered by grades.";
+        case 4: return "Students sorted asscending ordered by grades.";
+        default: return "Students sorted ascending ordered by name.";
+    }
+}
+
+static int (*sortComparator(int sortMode))(const void*, const void*) {
+    switch (sortMode) {
+        case 2: return compareByNameDesc;
+        case 3: return compareByGradeDesc;
+        case 4: return compareByGradeAsc;
+        default: return compareByNameAsc; // Default to name ascending
+    }
+}
+
+static int writeFully(int fd, const void* data, size_t size) {
+    const char* bytes = data;
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+// Runs live in anonymous temporary files that disappear when closed
+static int createRunFile() {
+    const char* directory = getenv("TMPDIR");
+    char path[512];
+    snprintf(path, sizeof(path), "%s/gtu-sortrun-XXXXXX", directory != NULL ? directory : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    unlink(path);
+    return fd;
+}
+
+typedef struct {
+    int fd;
+    StudentInfo* buffer;
+    size_t count;
+    size_t position;
+} SortRun;
+
+// Makes buffer[position] the run's next record; returns 0 when the run is exhausted
+static int sortRunFill(SortRun* run) {
+    if (run->position < run->count) {
+        return 1;
+    }
+    ssize_t bytesRead;
+    do {
+        bytesRead = read(run->fd, run->buffer, SORT_MERGE_BUFFER * sizeof(StudentInfo));
+    } while (bytesRead == -1 && errno == EINTR);
+    if (bytesRead <= 0) {
+        return 0;
+    }
+    run->count = bytesRead / sizeof(StudentInfo);
+    run->position = 0;
+    return run->count > 0;
+}
+
+static int mergeHeapLess(SortRun* runs, int a, int b, int sortMode) {
+    int result = compareForMode(&runs[a].buffer[runs[a].position], &runs[b].buffer[runs[b].position], sortMode);
+    return result < 0 || (result == 0 && a < b); // Ties go to the lower run so the merge order is deterministic
+}
+
+static void mergeHeapDown(int* heap, int size, int i, SortRun* runs, int sortMode) {
+    while (1) {
+        int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+        if (left < size && mergeHeapLess(runs, heap[left], heap[smallest], sortMode)) smallest = left;
+        if (right < size && mergeHeapLess(runs, heap[right], heap[smallest], sortMode)) smallest = right;
+        if (smallest == i) return;
+        int swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+// k-way merges runs through a min-heap, either as text to out or as records to outFd
+static int64_t mergeRuns(int* runFds, int numRuns, int sortMode, FILE* out, int outFd) {
+    SortRun* runs = calloc(numRuns, sizeof(SortRun));
+    int* heap = malloc(numRuns * sizeof(int));
+    StudentInfo* outBuffer = malloc(SORT_MERGE_BUFFER * sizeof(StudentInfo));
+    if (runs == NULL || heap == NULL || outBuffer == NULL) {
+        perror("malloc");
+        free(runs);
+        free(heap);
+        free(outBuffer);
+        return -1;
+    }
+
+    int heapSize = 0;
+    int64_t merged = 0;
+    for (int i = 0; i < numRuns; i++) {
+        runs[i].fd = runFds[i];
+        runs[i].buffer = malloc(SORT_MERGE_BUFFER * sizeof(StudentInfo));
+        if (runs[i].buffer == NULL) {
+            perror("malloc");
+            merged = -1;
+            break;
+        }
+        lseek(runs[i].fd, 0, SEEK_SET);
+        if (sortRunFill(&runs[i])) {
+            heap[heapSize++] = i;
+        }
+    }
+    for (int i = heapSize / 2 - 1; i >= 0 && merged != -1; i--) {
+        mergeHeapDown(heap, heapSize, i, runs, sortMode);
+    }
+
+    size_t buffered = 0;
+    while (heapSize > 0 && merged != -1) {
+        SortRun* run = &runs[heap[0]];
+        const StudentInfo* student = &run->buffer[run->position++];
+        if (out != NULL) {
+            fprintf(out, "%s, %s\n", student->name, student->grade);
+        } else {
+            outBuffer[buffered++] = *student;
+            if (buffered == SORT_MERGE_BUFFER) {
+                if (writeFully(outFd, outBuffer, buffered * sizeof(StudentInfo)) == -1) {
+                    perror("write");
+                    merged = -1;
+                    break;
+                }
+                buffered = 0;
+            }
+        }
+        merged++;
+
+        if (!sortRunFill(run)) {
+            heap[0] = heap[--heapSize];
+        }
+        mergeHeapDown(heap, heapSize, 0, runs, sortMode);
+    }
+    if (merged != -1 && out == NULL && writeFully(outFd, outBuffer, buffered * sizeof(StudentInfo)) == -1) {
+        perror("write");
+        merged = -1;
+    }
+
+    for (int i = 0; i < numRuns; i++) {
+        free(runs[i].buffer);
+    }
+    free(runs);
+    free(heap);
+    free(outBuffer);
+    return merged;
+}
+
+// Sorts a text grade file of any size: sorted runs of SORT_RUN_RECORDS go to
+// temporary files, then get k-way merged (in several passes past SORT_MAX_FANIN runs)
+int64_t externalSortGrades(int inputFd, int sortMode, FILE* out) {
+    StudentInfo* students = malloc(SORT_RUN_RECORDS * sizeof(StudentInfo));
+    LineReader* reader = malloc(sizeof(LineReader));
+    int* runFds = NULL;
+    int numRuns = 0, runCapacity = 0;
+    int64_t result = 0;
+    if (students == NULL || reader == NULL) {
+        perror("malloc");
+        free(students);
+        free(reader);
+        return -1;
+    }
+    lineReaderInit(reader, inputFd);
+    struct stat st;
+    if (fstat(inputFd, &st) == 0 && S_ISREG(st.st_mode)) {
+        reader->limit = textStableSize(inputFd, st.st_size);
+    }
+
+    char* line;
+    size_t length;
+    int more = 1;
+    while (more) {
+        size_t count = 0;
+        while (count < SORT_RUN_RECORDS && (more = lineReaderNext(reader, &line, &length))) {
+            count += parseStudentLine(line, length, &students[count]);
+        }
+        sortStudents(students, count, sortMode);
+
+        if (numRuns == 0 && !more) {
+            // Everything fit in memory: no temporary files needed
+            for (size_t i = 0; i < count; i++) {
+                fprintf(out, "%s, %s\n", students[i].name, students[i].grade);
+            }
+            result = count;
+            break;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        if (numRuns == runCapacity) {
+            runCapacity = runCapacity == 0 ? 16 : runCapacity * 2;
+            int* grown = realloc(runFds, runCapacity * sizeof(int));
+            if (grown == NULL) {
+                perror("realloc");
+                result = -1;
+                break;
+            }
+            runFds = grown;
+        }
+        int fd = createRunFile();
+        if (fd == -1 || writeFully(fd, students, count * sizeof(StudentInfo)) == -1) {
+            if (fd != -1) close(fd);
+            result = -1;
+            break;
+        }
+        runFds[numRuns++] = fd;
+    }
+    free(students);
+    free(reader);
+
+    // Merge passes until few enough runs remain to merge straight into the output
+    while (result != -1 && numRuns > SORT_MAX_FANIN) {
+        int merged = 0;
+        for (int first = 0; first < numRuns && result != -1; first += SORT_MAX_FANIN) {
+            int group = numRuns - first < SORT_MAX_FANIN ? numRuns - first : SORT_MAX_FANIN;
+            int fd = createRunFile();
+            if (fd == -1 || mergeRuns(&runFds[first], group, sortMode, NULL, fd) == -1) {
+                if (fd != -1) close(fd);
+                result = -1;
+                break;
+            }
+            for (int i = first; i < first + group; i++) {
+                close(runFds[i]);
+                runFds[i] = -1;
+            }
+            runFds[merged++] = fd;
+        }
+        if (result != -1) {
+            numRuns = merged;
+        }
+    }
+    if (result != -1 && numRuns > 0) {
+        result = mergeRuns(runFds, numRuns, sortMode, out, -1);
+    }
+
+    for (int i = 0; i < numRuns; i++) {
+        if (runFds[i] != -1) close(runFds[i]);
+    }
+    free(runFds);
+    return result;
+}
+
+
+// Total order used by every sort path: grade modes break ties by name
+int compareForMode(const StudentInfo* a, const StudentInfo* b, int sortMode) {
+    int result;
+    if (sortMode == 3 || sortMode == 4) {
+        result = strcmp(a->grade, b->grade);
+        if (result == 0) {
+            result = strcmp(a->name, b->name);
+        }
+    } else {
+        result = strcmp(a->name, b->name);
+    }
+    return sortMode == 2 || sortMode == 4 ? -result : result;
+}
+
+static int compareStudentsForMode(const void* a, const void* b, void* arg) {
+    return compareForMode(a, b, *(const int*)arg);
+}
+
+// Packs bytes big-endian so comparing keys as integers matches strcmp on the prefix
+static uint64_t packPrefix(const char* text, int bytes, int shift) {
+    uint64_t key = 0;
+    for (int i = 0; i < bytes && text[i] != '\0'; i++) {
+        key |= (uint64_t)(unsigned char)text[i] << (shift - 8 * i);
+    }
+    return key;
+}
+
+// Name bytes covered by the keys of depths 0..depth
+static size_t sortKeyNameBytes(int sortMode, int depth) {
+    return (sortMode == 3 || sortMode == 4 ? 6 : 8) + 8 * depth;
+}
+
+// Depth 0 is the key kept in SortKey; deeper keys continue 8 name bytes further
+static uint64_t sortKeyAtDepth(const StudentInfo* student, int sortMode, int depth) {
+    uint64_t key;
+    if (depth > 0) {
+        size_t offset = sortKeyNameBytes(sortMode, depth - 1);
+        key = strnlen(student->name, offset) < offset ? 0 : packPrefix(student->name + offset, 8, 56);
+    } else if (sortMode == 3 || sortMode == 4) {
+        // Grade in the top 16 bits, then the first 6 bytes of the name
+        key = packPrefix(student->grade, 2, 56) | packPrefix(student->name, 6, 40);
+    } else {
+        key = packPrefix(student->name, 8, 56);
+    }
+    return sortMode == 2 || sortMode == 4 ? ~key : key;
+}
+
+uint64_t sortKeyFor(const StudentInfo* student, int sortMode) {
+    return sortKeyAtDepth(student, sortMode, 0);
+}
+
+static int compareSortKeys(const void* a, const void* b, void* arg) {
+    const SortKey* keyA = a;
+    const SortKey* keyB = b;
+    if (keyA->key != keyB->key) {
+        return keyA->key < keyB->key ? -1 : 1;
+    }
+    return compareForMode(keyA->record, keyB->record, *(const int*)arg);
+}
+
+// LSD radix sort on the 64-bit keys, skipping bytes every key shares. Runs of
+// equal keys are re-keyed on the next 8 name bytes and sorted again, or handed
+// to a comparison sort once they are small
+static void radixSortKeys(SortKey* keys, SortKey* scratch, size_t count, int sortMode, int depth) {
+    SortKey* source = keys;
+    SortKey* target = scratch;
+    for (int shift = 0; shift < 64; shift += 8) {
+        size_t counts[256] = {0};
+        for (size_t i = 0; i < count; i++) {
+            counts[(source[i].key >> shift) & 0xFF]++;
+        }
+        if (count == 0 || counts[(source[0].key >> shift) & 0xFF] == count) {
+            continue;
+        }
+        size_t offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t digitCount = counts[digit];
+            counts[digit] = offset;
+            offset += digitCount;
+        }
+        for (size_t i = 0; i < count; i++) {
+            target[counts[(source[i].key >> shift) & 0xFF]++] = source[i];
+        }
+        SortKey* swap = source;
+        source = target;
+        target = swap;
+    }
+    if (source != keys) {
+        memcpy(keys, source, count * sizeof(SortKey));
+    }
+
+    for (size_t start = 0; start < count;) {
+        size_t end = start + 1;
+        while (end < count && keys[end].key == keys[start].key) {
+            end++;
+        }
+        size_t runLength = end - start;
+        const StudentInfo* first = keys[start].record;
+        if (runLength > 1 && strnlen(first->name, sizeof(first->name)) >= sortKeyNameBytes(sortMode, depth)) {
+            if (runLength <= SORT_SMALL_RUN) {
+                qsort_r(&keys[start], runLength, sizeof(SortKey), compareSortKeys, &sortMode);
+            } else {
+                for (size_t i = start; i < end; i++) {
+                    keys[i].key = sortKeyAtDepth(keys[i].record, sortMode, depth + 1);
+                }
+                radixSortKeys(&keys[start], &scratch[start], runLength, sortMode, depth + 1);
+                // Callers compare depth-0 keys, so put them back
+                for (size_t i = start; i < end; i++) {
+                    keys[i].key = sortKeyAtDepth(keys[i].record, sortMode, depth);
+                }
+            }
+        }
+        start = end;
+    }
+}
+
+typedef struct {
+    SortKey* source;
+    SortKey* target;
+    size_t start;
+    size_t middle;
+    size_t end;
+    int sortMode;
+} SortTask;
+
+static void* sortChunkWorker(void* arg) {
+    SortTask* task = arg;
+    radixSortKeys(task->source + task->start, task->target + task->start, task->end - task->start,
+                  task->sortMode, 0);
+    return NULL;
+}
+
+static void* mergeChunksWorker(void* arg) {
+    SortTask* task = arg;
+    size_t left = task->start, right = task->middle, out = task->start;
+    while (left < task->middle && right < task->end) {
+        if (compareSortKeys(&task->source[right], &task->source[left], &task->sortMode) < 0) {
+            task->target[out++] = task->source[right++];
+        } else {
+            task->target[out++] = task->source[left++];
+        }
+    }
+    memcpy(&task->target[out], &task->source[left], (task->middle - left) * sizeof(SortKey));
+    out += task->middle - left;
+    memcpy(&task->target[out], &task->source[right], (task->end - right) * sizeof(SortKey));
+    return NULL;
+}
+
+static int sortThreadCount(size_t count) {
+    if (count < SORT_PARALLEL_THRESHOLD) {
+        return 1;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+    if (cpus > SORT_MAX_THREADS) cpus = SORT_MAX_THREADS;
+    return (int)cpus;
+}
+
+// Sorts count records by building compact (key, record) pairs and sorting those:
+// each thread radix sorts a chunk, then pairs of chunks are merged in parallel rounds
+SortKey* sortStudentKeys(const StudentInfo* students, size_t count, int sortMode) {
+    SortKey* keys = malloc((count + 1) * sizeof(SortKey));
+    SortKey* scratch = malloc((count + 1) * sizeof(SortKey));
+    if (keys == NULL || scratch == NULL) {
+        perror("malloc");
+        free(keys);
+        free(scratch);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        keys[i].key = sortKeyFor(&students[i], sortMode);
+        keys[i].record = &students[i];
+    }
+
+    int numThreads = sortThreadCount(count);
+    pthread_t threads[SORT_MAX_THREADS];
+    SortTask tasks[SORT_MAX_THREADS];
+    size_t bounds[SORT_MAX_THREADS + 1];
+    for (int i = 0; i <= numThreads; i++) {
+        bounds[i] = count * i / numThreads;
+    }
+    for (int i = 0; i < numThreads; i++) {
+        tasks[i] = (SortTask){keys, scratch, bounds[i], 0, bounds[i + 1], sortMode};
+        if (i == numThreads - 1 || pthread_create(&threads[i], NULL, sortChunkWorker, &tasks[i]) != 0) {
+            sortChunkWorker(&tasks[i]); // The calling thread takes the last chunk
+            threads[i] = 0;
+        }
+    }
+    for (int i = 0; i < numThreads; i++) {
+        if (threads[i] != 0) pthread_join(threads[i], NULL);
+    }
+
+    SortKey* source = keys;
+    SortKey* target = scratch;
+    int numChunks = numThreads;
+    while (numChunks > 1) {
+        int numMerges = numChunks / 2;
+        for (int i = 0; i < numMerges; i++) {
+            tasks[i] = (SortTask){source, target, bounds[2 * i], bounds[2 * i + 1], bounds[2 * i + 2], sortMode};
+            if (i == numMerges - 1 || pthread_create(&threads[i], NULL, mergeChunksWorker, &tasks[i]) != 0) {
+                mergeChunksWorker(&tasks[i]);
+                threads[i] = 0;
+            }
+        }
+        if (numChunks % 2 == 1) {
+            // An odd chunk out is carried into the next round unchanged
+            memcpy(&target[bounds[numChunks - 1]], &source[bounds[numChunks - 1]],
+                   (bounds[numChunks] - bounds[numChunks - 1]) * sizeof(SortKey));
+        }
+        for (int i = 0; i < numMerges; i++) {
+            if (threads[i] != 0) pthread_join(threads[i], NULL);
+        }
+        for (int i = 0; i <= numMerges; i++) {
+            bounds[i] = bounds[2 * i];
+        }
+        if (numChunks % 2 == 1) {
+            bounds[numMerges + 1] = bounds[numChunks];
+        }
+        numChunks = numMerges + numChunks % 2;
+        SortKey* swap = source;
+        source = target;
+        target = swap;
+    }
+
+    free(target);
+    return source;
+}
+
+void sortStudents(StudentInfo* students, size_t count, int sortMode) {
+    SortKey* keys = sortStudentKeys(students, count, sortMode);
+    StudentInfo* sorted = malloc((count + 1) * sizeof(StudentInfo));
+    if (keys == NULL || sorted == NULL) {
+        // Not enough memory for the key array; sort the records in place instead
+        free(keys);
+        free(sorted);
+        qsort_r(students, count, sizeof(StudentInfo), compareStudentsForMode, &sortMode);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        sorted[i] = *keys[i].record;
+    }
+    memcpy(students, sorted, count * sizeof(StudentInfo));
+    free(sorted);
+    free(keys);
+}
+
+// Times the original qsort comparators against the parallel key sort at growing sizes
+void benchSort(size_t maxCount, int sortMode) {
+    static const char* grades[] = {"AA", "BA", "BB", "CB", "CC", "DC", "DD", "FD", "FF"};
+    if (maxCount < 10000) {
+        maxCount = 10000;
+    }
+    StudentInfo* students = malloc(maxCount * sizeof(StudentInfo));
+    StudentInfo* copy = malloc(maxCount * sizeof(StudentInfo));
+    if (students == NULL || copy == NULL) {
+        perror("malloc");
+        free(students);
+        free(copy);
+        return;
+    }
+    unsigned int seed = 344;
+    for (size_t i = 0; i < maxCount; i++) {
+        // "Name Surname" made of random lowercase letters after a capital
+        memset(&students[i], 0, sizeof(StudentInfo));
+        int nameLength = 3 + rand_r(&seed) % 6, surnameLength = 4 + rand_r(&seed) % 8, position = 0;
+        for (int part = 0; part < 2; part++) {
+            int length = part == 0 ? nameLength : surnameLength;
+            students[i].name[position++] = 'A' + rand_r(&seed) % 26;
+            for (int j = 1; j < length; j++) {
+                students[i].name[position++] = 'a' + rand_r(&seed) % 26;
+            }
+            students[i].name[position++] = part == 0 ? ' ' : '\0';
+        }
+        strcpy(students[i].grade, grades[rand_r(&seed) % 9]);
+    }
+
+    printf("%s (%d threads)\n", sortModeTitle(sortMode), sortThreadCount(maxCount));
+    printf("%10s %12s %12s %8s\n", "records", "qsort ms", "keysort ms", "speedup");
+    for (size_t count = 10000; count <= maxCount; count *= 10) {
+        struct timespec start, end;
+        memcpy(copy, students, count * sizeof(StudentInfo));
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        qsort(copy, count, sizeof(StudentInfo), sortComparator(sortMode));
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double qsortSeconds = elapsedSeconds(start, end);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        SortKey* keys = sortStudentKeys(students, count, sortMode);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double keySeconds = elapsedSeconds(start, end);
+        if (keys == NULL) {
+            break;
+        }
+
+        // The primary field must come out in the same order as with qsort
+        int (*compare)(const void*, const void*) = sortComparator(sortMode);
+        for (size_t i = 0; i < count; i++) {
+            if (compare(keys[i].record, &copy[i]) != 0) {
+                printf("Mismatch at record %zu.\n", i);
+                break;
+            }
+        }
+        free(keys);
+        printf("%10zu %12.2f %12.2f %7.2fx\n", count, qsortSeconds * 1000, keySeconds * 1000,
+               qsortSeconds / keySeconds);
+    }
+    free(students);
+    free(copy);
+}
+
+
+// Lowercases and collapses runs of spaces so "ali  VELI " and "Ali Veli" hash alike
+size_t normalizeName(const char* name, char* out, size_t size) {
+    size_t length = 0;
+    int pendingSpace = 0;
+    for (const char* c = name; *c != '\0' && length + 1 < size; c++) {
+        if (*c == ' ' || *c == '\t') {
+            pendingSpace = length > 0;
+            continue;
+        }
+        if (pendingSpace && length + 2 < size) {
+            out[length++] = ' ';
+        }
+        pendingSpace = 0;
+        out[length++] = (*c >= 'A' && *c <= 'Z') ? *c - 'A' + 'a' : *c;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+static uint32_t hashBytes(const char* data, size_t length) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const unsigned char* c = (const unsigned char*)data; c < (const unsigned char*)data + length; c++) {
+        hash = (hash ^ *c) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hashName(const char* normalized) {
+    return hashBytes(normalized, strlen(normalized));
+}
+
+// Maps <store>.hash with room for slotCount slots
+static int hashMap(GradeStore* store, uint64_t slotCount) {
+    if (store->hashHeader != NULL) {
+        munmap(store->hashHeader, store->hashMapSize);
+        store->hashHeader = NULL;
+    }
+    store->hashMapSize = sizeof(HashHeader) + slotCount * sizeof(HashSlot);
+    void* data = mmap(NULL, store->hashMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, store->hashFd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    store->hashHeader = data;
+    store->hashSlots = (HashSlot*)((char*)data + sizeof(HashHeader));
+    return 0;
+}
+
+static void hashInsert(GradeStore* store, uint64_t recordNumber) {
+    char normalized[sizeof(store->records[0].name)];
+    normalizeName(store->records[recordNumber].name, normalized, sizeof(normalized));
+    uint32_t hash = hashName(normalized);
+    uint64_t mask = store->hashHeader->slotCount - 1;
+    uint64_t slot = hash & mask;
+    while (store->hashSlots[slot].recordPlusOne != 0) {
+        slot = (slot + 1) & mask; // Linear probing
+    }
+    store->hashSlots[slot].hash = hash;
+    store->hashSlots[slot].recordPlusOne = (uint32_t)recordNumber + 1;
+    store->hashHeader->recordCount = recordNumber + 1;
+}
+
+static void hashClose(GradeStore* store) {
+    if (store->hashHeader != NULL) {
+        munmap(store->hashHeader, store->hashMapSize);
+        store->hashHeader = NULL;
+        store->hashSlots = NULL;
+    }
+    if (store->hashFd != -1) {
+        close(store->hashFd);
+        store->hashFd = -1;
+    }
+}
+
+// Rebuilds the hash table with enough slots for the store at HASH_MAX_LOAD. The new table
+// is written under a temporary name and renamed over the old one, so processes still
+// reading the old table keep a complete copy until they notice the new generation.
+static int hashRebuild(GradeStore* store, uint64_t minimumRecords) {
+    uint64_t slotCount = HASH_INITIAL_SLOTS;
+    while (slotCount * HASH_MAX_LOAD / 100 <= minimumRecords) {
+        slotCount *= 2;
+    }
+    char hashPath[512], tempPath[600];
+    snprintf(hashPath, sizeof(hashPath), "%s.hash", store->path);
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", hashPath);
+    int fd = mkstemp(tempPath);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(HashHeader) + slotCount * sizeof(HashSlot)) == -1 || fchmod(fd, 0644) == -1) {
+        perror("ftruncate");
+        close(fd);
+        unlink(tempPath);
+        return -1;
+    }
+    hashClose(store);
+    store->hashFd = fd;
+    if (hashMap(store, slotCount) == -1) {
+        unlink(tempPath);
+        hashClose(store);
+        return -1;
+    }
+    memcpy(store->hashHeader->magic, HASH_MAGIC, sizeof(store->hashHeader->magic));
+    store->hashHeader->slotCount = slotCount;
+    store->hashHeader->recordCount = 0;
+    for (uint64_t i = 0; i < store->header->recordCount; i++) {
+        hashInsert(store, i);
+    }
+    if (rename(tempPath, hashPath) == -1) {
+        perror("rename");
+        unlink(tempPath);
+        hashClose(store);
+        return -1;
+    }
+    store->hashGeneration = atomic_fetch_add(&store->header->hashGeneration, 1) + 1;
+    return 0;
+}
+
+// Maps <store>.hash. Returns 1, with no table mapped, when it is missing or out of step
+// with the records; only a writer holding the lock may then rebuild it.
+int hashOpen(GradeStore* store) {
+    char hashPath[512];
+    snprintf(hashPath, sizeof(hashPath), "%s.hash", store->path);
+    hashClose(store);
+    store->hashGeneration = atomic_load(&store->header->hashGeneration);
+    store->hashFd = open(hashPath, O_RDWR);
+    if (store->hashFd == -1) {
+        if (errno == ENOENT) {
+            return 1;
+        }
+        perror("open");
+        return -1;
+    }
+
+    HashHeader header;
+    struct stat st;
+    fstat(store->hashFd, &st);
+    if (pread(store->hashFd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, HASH_MAGIC, sizeof(header.magic)) != 0 ||
+        header.slotCount == 0 || (header.slotCount & (header.slotCount - 1)) != 0 ||
+        (uint64_t)st.st_size != sizeof(HashHeader) + header.slotCount * sizeof(HashSlot) ||
+        header.recordCount != store->header->recordCount) {
+        hashClose(store);
+        return 1;
+    }
+    return hashMap(store, header.slotCount);
+}
+
+// Hashes records firstRecord .. firstRecord + count - 1, which must already be in the store
+int hashAdd(GradeStore* store, uint64_t firstRecord, uint64_t count) {
+    if ((firstRecord + count) * 100 > store->hashHeader->slotCount * HASH_MAX_LOAD) {
+        return hashRebuild(store, firstRecord + count);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        hashInsert(store, firstRecord + i);
+    }
+    return 0;
+}
+
+// Calls found() for every record whose normalized name equals the query; returns the match count
+uint64_t storeFindExact(const GradeStore* store, const char* nameSurname,
+                        void (*found)(const StudentInfo* student, void* context), void* context) {
+    char query[sizeof(store->records[0].name)];
+    char candidate[sizeof(store->records[0].name)];
+    if (store->hashHeader == NULL || store->hashHeader->recordCount != store->header->recordCount) {
+        return 0; // Table is being rebuilt; the caller's scan still finds the record
+    }
+    normalizeName(nameSurname, query, sizeof(query));
+    uint32_t hash = hashName(query);
+    uint64_t mask = store->hashHeader->slotCount - 1;
+    uint64_t matches = 0;
+    for (uint64_t slot = hash & mask; store->hashSlots[slot].recordPlusOne != 0; slot = (slot + 1) & mask) {
+        if (store->hashSlots[slot].hash != hash) {
+            continue;
+        }
+        uint32_t recordNumber = store->hashSlots[slot].recordPlusOne - 1;
+        if (storeIsDead(store, recordNumber)) {
+            continue;
+        }
+        const StudentInfo* student = &store->records[recordNumber < store->capacity ? recordNumber : 0];
+        normalizeName(student->name, candidate, sizeof(candidate));
+        if (strcmp(candidate, query) == 0) {
+            found(student, context);
+            matches++;
+        }
+    }
+    return matches;
+}
+
+static char foldCase(char c) {
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static int foldedEqual(const char* a, const char* b, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (foldCase(a[i]) != foldCase(b[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#ifdef __SSE2__
+// Lowercases the ASCII letters of 16 bytes: 'A'..'Z' are the bytes that land below
+// -128 + 26 once shifted so 'A' becomes -128
+static __m128i foldCase16(__m128i block) {
+    __m128i shifted = _mm_add_epi8(block, _mm_set1_epi8((char)(0x80 - 'A')));
+    __m128i upper = _mm_cmplt_epi8(shifted, _mm_set1_epi8((char)(0x80 + 26)));
+    return _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+// Finds needle in haystack ignoring ASCII case, the same rule normalizeName applies to
+// exact lookups. With SSE2, 16 candidate positions are tested at a time by comparing the
+// needle's folded first and last bytes before any full comparison.
+const char* scanSubstring(const char* haystack, size_t length, const char* needle, size_t needleLength) {
+    if (needleLength == 0) {
+        return haystack;
+    }
+    if (needleLength > length) {
+        return NULL;
+    }
+    char firstByte = foldCase(needle[0]), lastByte = foldCase(needle[needleLength - 1]);
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(firstByte);
+    const __m128i last = _mm_set1_epi8(lastByte);
+    for (; i + needleLength - 1 + 16 <= length; i += 16) {
+        __m128i blockFirst = foldCase16(_mm_loadu_si128((const __m128i*)(haystack + i)));
+        __m128i blockLast = foldCase16(_mm_loadu_si128((const __m128i*)(haystack + i + needleLength - 1)));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first),
+                                                            _mm_cmpeq_epi8(blockLast, last)));
+        while (mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if (needleLength <= 2 || foldedEqual(haystack + i + bit + 1, needle + 1, needleLength - 2)) {
+                return haystack + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i + needleLength <= length; i++) {
+        if (foldCase(haystack[i]) == firstByte && foldCase(haystack[i + needleLength - 1]) == lastByte &&
+            foldedEqual(haystack + i + 1, needle + 1, needleLength - (needleLength > 1 ? 2 : 1))) {
+            return haystack + i;
+        }
+    }
+    return NULL;
+}
+
+// Substring search over the record area; names are NUL-padded, so matches never span fields
+uint64_t storeScanNames(const GradeStore* store, const char* needle,
+                        void (*found)(const StudentInfo* student, void* context), void* context) {
+    const char* area = (const char*)store->records;
+    size_t length = storeVisibleCount(store) * sizeof(StudentInfo);
+    size_t needleLength = strlen(needle);
+    uint64_t matches = 0;
+    size_t position = 0;
+    const char* match;
+    while (position < length && (match = scanSubstring(area + position, length - position, needle, needleLength)) != NULL) {
+        size_t offset = match - area;
+        uint64_t recordNumber = offset / sizeof(StudentInfo);
+        if (offset % sizeof(StudentInfo) < sizeof(store->records[0].name) && !storeIsDead(store, recordNumber)) {
+            found(&store->records[recordNumber], context);
+            matches++;
+        }
+        position = (recordNumber + 1) * sizeof(StudentInfo); // One hit per record
+    }
+    return matches;
+}
+
+void printStudent(const StudentInfo* student, void* context) {
+    fprintf((FILE*)context, "%s, %s\n", student->name, student->grade);
+}
+
+
+// The sidecar describes the data file as it was when indexed; any difference means rebuild
+static int lineIndexMatches(const LineIndexHeader* header, const struct stat* st) {
+    return memcmp(header->magic, LINE_INDEX_MAGIC, sizeof(header->magic)) == 0 &&
+           header->dataSize == (uint64_t)st->st_size &&
+           header->dataInode == (uint64_t)st->st_ino &&
+           header->mtimeSeconds == (int64_t)st->st_mtim.tv_sec &&
+           header->mtimeNanoseconds == (int64_t)st->st_mtim.tv_nsec;
+}
+
+static void lineIndexStamp(LineIndexHeader* header, const struct stat* st) {
+    memcpy(header->magic, LINE_INDEX_MAGIC, sizeof(header->magic));
+    header->dataSize = st->st_size;
+    header->dataInode = st->st_ino;
+    header->mtimeSeconds = st->st_mtim.tv_sec;
+    header->mtimeNanoseconds = st->st_mtim.tv_nsec;
+}
+
+// Scans the data file once and writes the offset of every line start
+static int lineIndexRebuild(LineIndex* index, int dataFd, const struct stat* st) {
+    LineIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    uint64_t* offsets = malloc(LINE_INDEX_BATCH * sizeof(uint64_t));
+    if (offsets == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    const char* data = NULL;
+    if (st->st_size > 0) {
+        data = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, dataFd, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap");
+            free(offsets);
+            return -1;
+        }
+        madvise((void*)data, st->st_size, MADV_SEQUENTIAL);
+    }
+
+    size_t batched = 0;
+    off_t position = sizeof(header);
+    int result = 0;
+    for (uint64_t lineStart = 0; lineStart < (uint64_t)st->st_size && result == 0;) {
+        offsets[batched++] = lineStart;
+        header.lineCount++;
+        const char* newline = memchr(data + lineStart, '\n', st->st_size - lineStart);
+        lineStart = newline != NULL ? (uint64_t)(newline - data) + 1 : (uint64_t)st->st_size;
+        if (batched == LINE_INDEX_BATCH || lineStart >= (uint64_t)st->st_size) {
+            if (pwrite(index->fd, offsets, batched * sizeof(uint64_t), position) != (ssize_t)(batched * sizeof(uint64_t))) {
+                perror("Failed to write line index");
+                result = -1;
+            }
+            position += batched * sizeof(uint64_t);
+            batched = 0;
+        }
+    }
+    if (data != NULL) {
+        munmap((void*)data, st->st_size);
+    }
+    free(offsets);
+
+    // The header goes last so a half-written index never looks valid
+    lineIndexStamp(&header, st);
+    if (result == 0 && pwrite(index->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        perror("Failed to write line index");
+        result = -1;
+    }
+    index->header = header;
+    return result;
+}
+
+// Opens "<file>.lidx" for a data file that is already open, rebuilding it if stale.
+// Returns 1 when the index is stale while another process is writing the data file;
+// the caller then scans the file instead of waiting for the writer.
+int lineIndexOpen(LineIndex* index, const char* filePath, int dataFd) {
+    char indexPath[512];
+    snprintf(indexPath, sizeof(indexPath), "%s%s", filePath, LINE_INDEX_EXTENSION);
+    index->fd = open(indexPath, O_RDONLY);
+
+    // A sidecar cut short, say by a full disk, is rebuilt like a stale one
+    struct stat st, indexSt;
+    fstat(dataFd, &st);
+    if (index->fd != -1 && pread(index->fd, &index->header, sizeof(index->header), 0) == (ssize_t)sizeof(index->header) &&
+        lineIndexMatches(&index->header, &st) && fstat(index->fd, &indexSt) == 0 &&
+        index->header.lineCount <= ((uint64_t)indexSt.st_size - sizeof(LineIndexHeader)) / sizeof(uint64_t)) {
+        return 0;
+    }
+    lineIndexClose(index);
+
+    // A shared lock keeps writers out while the file is indexed; the new index is
+    // built under a temporary name so other readers never see it half written
+    struct flock lock = {.l_type = F_RDLCK, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0};
+    if (fcntl(dataFd, F_SETLK, &lock) == -1) {
+        return 1;
+    }
+    char tempPath[600];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", indexPath);
+    index->fd = mkstemp(tempPath);
+    int result = 0;
+    if (index->fd == -1) {
+        perror("mkstemp");
+        result = -1;
+    } else if (fstat(dataFd, &st) == -1 || lineIndexRebuild(index, dataFd, &st) == -1 ||
+               fchmod(index->fd, 0644) == -1 || rename(tempPath, indexPath) == -1) {
+        unlink(tempPath);
+        lineIndexClose(index);
+        result = -1;
+    }
+    lock.l_type = F_UNLCK;
+    fcntl(dataFd, F_SETLK, &lock);
+    return result;
+}
+
+void lineIndexClose(LineIndex* index) {
+    if (index->fd != -1) {
+        close(index->fd);
+        index->fd = -1;
+    }
+}
+
+// Byte range [*start, *end) of lines firstLine .. firstLine + count - 1, clamped to the file.
+// Returns -1 if the offsets cannot be read or do not fit the file; the caller then scans.
+int lineIndexRange(const LineIndex* index, uint64_t firstLine, uint64_t count, uint64_t* start, uint64_t* end) {
+    uint64_t lastLine = firstLine + count;
+    if (firstLine >= index->header.lineCount) {
+        *start = *end = index->header.dataSize;
+        return 0;
+    }
+    if (pread(index->fd, start, sizeof(*start), sizeof(LineIndexHeader) + firstLine * sizeof(uint64_t)) !=
+        (ssize_t)sizeof(*start)) {
+        return -1;
+    }
+    if (lastLine >= index->header.lineCount || lastLine < firstLine) {
+        *end = index->header.dataSize;
+    } else if (pread(index->fd, end, sizeof(*end), sizeof(LineIndexHeader) + lastLine * sizeof(uint64_t)) !=
+               (ssize_t)sizeof(*end)) {
+        return -1;
+    }
+    return *start <= *end && *end <= index->header.dataSize ? 0 : -1;
+}
+
+// Records lines appended by this process starting at offsets[0]. before/after are the data
+// file's stat around the write; if anything else touched the file the index is left to be rebuilt.
+void lineIndexAppend(const char* filePath, const struct stat* before, const struct stat* after,
+                     const uint64_t* offsets, uint64_t count) {
+    char indexPath[512];
+    snprintf(indexPath, sizeof(indexPath), "%s%s", filePath, LINE_INDEX_EXTENSION);
+    int fd = open(indexPath, O_RDWR);
+    if (fd == -1) {
+        return; // No index yet; the next reader builds one
+    }
+    LineIndexHeader header;
+    if (count > 0 && pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+        lineIndexMatches(&header, before) && offsets[0] == (uint64_t)before->st_size &&
+        (before->st_size == 0 || header.lineCount > 0)) {
+        size_t size = count * sizeof(uint64_t);
+        if (pwrite(fd, offsets, size, sizeof(header) + header.lineCount * sizeof(uint64_t)) == (ssize_t)size) {
+            header.lineCount += count;
+            lineIndexStamp(&header, after);
+            pwrite(fd, &header, sizeof(header), 0);
+        }
+    }
+    close(fd);
+}
+
+// Finds the same byte range as lineIndexRange by reading the file, for when the index is unusable
+static int lineScanRange(int fd, uint64_t firstLine, uint64_t count, uint64_t* start, uint64_t* end) {
+    struct stat st;
+    fstat(fd, &st);
+    uint64_t size = textStableSize(fd, st.st_size);
+    char* buffer = malloc(LINE_READER_BUFFER);
+    if (buffer == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    uint64_t line = 0, position = 0;
+    *start = *end = size;
+    while (position < size && line < firstLine + count) {
+        size_t chunk = size - position < LINE_READER_BUFFER ? size - position : LINE_READER_BUFFER;
+        ssize_t bytesRead = pread(fd, buffer, chunk, position);
+        if (bytesRead <= 0) {
+            break;
+        }
+        for (const char* p = buffer; (p = memchr(p, '\n', buffer + bytesRead - p)) != NULL; p++) {
+            line++;
+            if (line == firstLine) {
+                *start = position + (p - buffer) + 1;
+            } else if (line == firstLine + count) {
+                *end = position + (p - buffer) + 1;
+                break;
+            }
+        }
+        position += bytesRead;
+    }
+    if (firstLine == 0) {
+        *start = 0;
+    }
+    free(buffer);
+    return 0;
+}
+
+// Copies lines firstLine .. firstLine + count - 1 of a text grade file to stdout with one pread
+int printLineRange(const char* filePath, uint64_t firstLine, uint64_t count) {
+    int file = open(filePath, O_RDONLY);
+    if (file == -1) {
+        perror("Failed to open file");
+        return -1;
+    }
+    LineIndex index;
+    uint64_t start, end;
+    int opened = lineIndexOpen(&index, filePath, file);
+    if (opened == -1) {
+        close(file);
+        return -1;
+    } else if (opened == 0) {
+        opened = lineIndexRange(&index, firstLine, count, &start, &end) == -1;
+        lineIndexClose(&index);
+    }
+    if (opened == 1 && lineScanRange(file, firstLine, count, &start, &end) == -1) {
+        close(file);
+        return -1;
+    }
+
+    int result = 0;
+    char last;
+    if (end > start) {
+        fflush(stdout);
+        result = streamFileRange(file, start, end, STDOUT_FILENO);
+        if (result == 0 && pread(file, &last, 1, end - 1) == 1 && last != '\n') {
+            writeFully(STDOUT_FILENO, "\n", 1); // Last line of a file without a trailing newline
+        }
+    }
+    close(file);
+    return result;
+}
+
+// Copies bytes [start, end) of fd to outFd without a user-space buffer. sendfile covers
+// files, pipes and sockets; terminals (which sendfile refuses) get the range mapped and
+// written in one go, as does anything else sendfile cannot handle.
+int streamFileRange(int fd, uint64_t start, uint64_t end, int outFd) {
+    if (end <= start) {
+        return 0; // mmap refuses a zero length
+    }
+    if (!isatty(outFd)) {
+        off_t offset = start;
+        while ((uint64_t)offset < end) {
+            size_t chunk = end - offset < STREAM_CHUNK ? end - offset : STREAM_CHUNK;
+            ssize_t sent = sendfile(outFd, fd, &offset, chunk);
+            if (sent > 0 || (sent == -1 && errno == EINTR)) {
+                continue;
+            } else if (sent == 0) {
+                return 0; // The file got shorter under us
+            } else if (errno != EINVAL && errno != ENOSYS) {
+                perror("sendfile");
+                return -1;
+            }
+            break;
+        }
+        start = offset;
+        if (start >= end) {
+            return 0;
+        }
+    }
+
+    uint64_t base = start & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t length = end - base;
+    char* map = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, base);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(map, length, MADV_SEQUENTIAL);
+    int result = writeFully(outFd, map + (start - base), end - start);
+    if (result == -1) {
+        perror("write");
+    }
+    munmap(map, length);
+    return result;
+}
+
+// The old showAll: a forked child copying the file in 256-byte read/write pairs
+static int showAllForked(const char* filePath, uint64_t size, int outFd) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    } else if (pid == 0) {
+        int file = open(filePath, O_RDONLY);
+        if (file == -1) {
+            _exit(EXIT_FAILURE);
+        }
+        char buffer[256];
+        ssize_t bytesRead;
+        while (size > 0 && (bytesRead = read(file, buffer, size < sizeof(buffer) ? size : sizeof(buffer))) > 0) {
+            if (write(outFd, buffer, bytesRead) != bytesRead) {
+                _exit(EXIT_FAILURE);
+            }
+            size -= bytesRead;
+        }
+        _exit(EXIT_SUCCESS);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Times the forked 256-byte copy against streamFileRange, writing to outputPath (/dev/null by default)
+void benchShowAll(const char* filePath, int runs, const char* outputPath) {
+    int file = open(filePath, O_RDONLY);
+    if (file == -1) {
+        perror("Failed to open file");
+        return;
+    }
+    int out = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out == -1) {
+        perror("Failed to open output");
+        close(file);
+        return;
+    }
+    if (runs <= 0) {
+        runs = BENCH_SHOW_RUNS;
+    }
+
+    struct stat st;
+    fstat(file, &st);
+    uint64_t size = textStableSize(file, st.st_size), rows = 0;
+    char* buffer = malloc(LINE_READER_BUFFER);
+    for (uint64_t position = 0; buffer != NULL && position < size; position += LINE_READER_BUFFER) {
+        ssize_t bytesRead = pread(file, buffer, LINE_READER_BUFFER, position);
+        if (bytesRead <= 0) {
+            break;
+        }
+        if ((uint64_t)bytesRead > size - position) {
+            bytesRead = size - position;
+        }
+        for (const char* p = buffer; (p = memchr(p, '\n', buffer + bytesRead - p)) != NULL; p++) {
+            rows++;
+        }
+    }
+    free(buffer);
+
+    printf("%llu rows, %.1f MB, best of %d runs into %s\n", (unsigned long long)rows, size / 1048576.0, runs, outputPath);
+    printf("%-22s %10s %14s\n", "path", "ms", "rows/s");
+    double best[2] = {0, 0};
+    for (int method = 0; method < 2; method++) {
+        for (int run = 0; run < runs; run++) {
+            struct timespec start, end;
+            if (ftruncate(out, 0) == 0) {
+                lseek(out, 0, SEEK_SET); // Regular output files restart empty each run
+            }
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            int result = method == 0 ? showAllForked(filePath, size, out) : streamFileRange(file, 0, size, out);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (result == -1) {
+                printf("Run failed.\n");
+                break;
+            }
+            double seconds = elapsedSeconds(start, end);
+            if (run == 0 || seconds < best[method]) {
+                best[method] = seconds;
+            }
+        }
+        printf("%-22s %10.2f %14.0f\n", method == 0 ? "fork + 256 B read/write" : "sendfile/mmap stream",
+               best[method] * 1000, best[method] > 0 ? rows / best[method] : 0);
+    }
+    if (best[1] > 0) {
+        printf("Speedup: %.1fx\n", best[0] / best[1]);
+    }
+    close(out);
+    close(file);
+}
+
+// Accumulates rows for a snapshot: the grade enum and name id columns plus the dictionary
+static void snapshotBuilderReset(SnapshotBuilder* builder) {
+    builder->rowCount = builder->nameCount = builder->stringsSize = 0;
+    if (builder->slots != NULL) {
+        memset(builder->slots, 0, builder->slotCount * sizeof(uint32_t));
+    }
+}
+
+static void snapshotBuilderFree(SnapshotBuilder* builder) {
+    free(builder->grades);
+    free(builder->nameIds);
+    free(builder->nameStarts);
+    free(builder->strings);
+    free(builder->slots);
+    memset(builder, 0, sizeof(*builder));
+}
+
+static int snapshotGrow(void** array, uint64_t* capacity, uint64_t needed, size_t elementSize) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    uint64_t newCapacity = *capacity == 0 ? 4096 : *capacity;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+    void* grown = realloc(*array, newCapacity * elementSize);
+    if (grown == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    *array = grown;
+    *capacity = newCapacity;
+    return 0;
+}
+
+// Length of dictionary entry id without its terminator
+static size_t snapshotBuilderNameLength(const SnapshotBuilder* builder, uint64_t id) {
+    uint64_t end = id + 1 < builder->nameCount ? builder->nameStarts[id + 1] : builder->stringsSize;
+    return end - builder->nameStarts[id] - 1;
+}
+
+// Doubles the dictionary's hash slots and reinserts every name
+static int snapshotRehash(SnapshotBuilder* builder) {
+    uint64_t slotCount = builder->slotCount == 0 ? HASH_INITIAL_SLOTS : builder->slotCount * 2;
+    uint32_t* slots = calloc(slotCount, sizeof(uint32_t));
+    if (slots == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    for (uint64_t id = 0; id < builder->nameCount; id++) {
+        uint64_t slot = hashBytes(builder->strings + builder->nameStarts[id], snapshotBuilderNameLength(builder, id)) &
+                        (slotCount - 1);
+        while (slots[slot] != 0) {
+            slot = (slot + 1) & (slotCount - 1);
+        }
+        slots[slot] = id + 1;
+    }
+    free(builder->slots);
+    builder->slots = slots;
+    builder->slotCount = slotCount;
+    return 0;
+}
+
+// Appends one row; the name, length bytes that need not be NUL-terminated, is looked up
+// in the dictionary and added on first sight
+static int snapshotBuilderAddName(SnapshotBuilder* builder, const char* name, size_t length, int grade) {
+    if ((builder->nameCount + 1) * 100 > builder->slotCount * HASH_MAX_LOAD && snapshotRehash(builder) == -1) {
+        return -1;
+    }
+    uint64_t slot = hashBytes(name, length) & (builder->slotCount - 1);
+    uint32_t id;
+    while ((id = builder->slots[slot]) != 0) {
+        if (snapshotBuilderNameLength(builder, id - 1) == length &&
+            memcmp(builder->strings + builder->nameStarts[id - 1], name, length) == 0) {
+            break;
+        }
+        slot = (slot + 1) & (builder->slotCount - 1);
+    }
+    if (id == 0) {
+        if (snapshotGrow((void**)&builder->nameStarts, &builder->nameCapacity, builder->nameCount + 1, sizeof(uint64_t)) == -1 ||
+            snapshotGrow((void**)&builder->strings, &builder->stringsCapacity, builder->stringsSize + length + 1, 1) == -1) {
+            return -1;
+        }
+        builder->nameStarts[builder->nameCount] = builder->stringsSize;
+        memcpy(builder->strings + builder->stringsSize, name, length);
+        builder->strings[builder->stringsSize + length] = '\0';
+        builder->stringsSize += length + 1;
+        id = ++builder->nameCount;
+        builder->slots[slot] = id;
+    }
+    if (snapshotGrow((void**)&builder->grades, &builder->gradeCapacity, builder->rowCount + 1, 1) == -1 ||
+        snapshotGrow((void**)&builder->nameIds, &builder->idCapacity, builder->rowCount + 1, sizeof(uint32_t)) == -1) {
+        return -1;
+    }
+    builder->grades[builder->rowCount] = grade;
+    builder->nameIds[builder->rowCount++] = id - 1;
+    return 0;
+}
+
+static int snapshotBuilderAdd(SnapshotBuilder* builder, const char* name, int grade) {
+    return snapshotBuilderAddName(builder, name, strlen(name), grade);
+}
+
+static uint64_t snapshotAlign(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1);
+}
+
+// Writes the columns next to a temporary name and renames it over path when complete
+static int snapshotBuilderWrite(const SnapshotBuilder* builder, const char* path) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.rowCount = builder->rowCount;
+    header.nameCount = builder->nameCount;
+    header.gradeOffset = snapshotAlign(sizeof(header));
+    header.nameIdOffset = snapshotAlign(header.gradeOffset + builder->rowCount);
+    header.dictionaryOffset = snapshotAlign(header.nameIdOffset + builder->rowCount * sizeof(uint32_t));
+    header.stringsOffset = header.dictionaryOffset + (builder->nameCount + 1) * sizeof(uint64_t);
+    header.fileSize = header.stringsOffset + builder->stringsSize;
+
+    char tempPath[512];
+    snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", path);
+    int fd = mkstemp(tempPath);
+    if (fd == -1) {
+        perror("mkstemp");
+        return -1;
+    }
+    uint64_t end = builder->stringsSize;
+    struct { const void* data; uint64_t size, offset; } parts[] = {
+        {&header, sizeof(header), 0},
+        {builder->grades, builder->rowCount, header.gradeOffset},
+        {builder->nameIds, builder->rowCount * sizeof(uint32_t), header.nameIdOffset},
+        {builder->nameStarts, builder->nameCount * sizeof(uint64_t), header.dictionaryOffset},
+        {&end, sizeof(end), header.dictionaryOffset + builder->nameCount * sizeof(uint64_t)},
+        {builder->strings, builder->stringsSize, header.stringsOffset},
+    };
+    int result = ftruncate(fd, header.fileSize);
+    for (size_t i = 0; result == 0 && i < sizeof(parts) / sizeof(parts[0]); i++) {
+        if (parts[i].size > 0 && (lseek(fd, parts[i].offset, SEEK_SET) == -1 ||
+                                  writeFully(fd, parts[i].data, parts[i].size) == -1)) {
+            result = -1;
+        }
+    }
+    if (result == -1 || fchmod(fd, 0644) == -1 || rename(tempPath, path) == -1) {
+        perror("Failed to write snapshot");
+        unlink(tempPath);
+        result = -1;
+    }
+    close(fd);
+    return result;
+}
+
+// storeRead adapter: may run more than once, so it starts from an empty builder each time
+static int querySnapshot(const GradeStore* store, const void* arg, FILE* out) {
+    (void)out;
+    SnapshotBuilder* builder = (SnapshotBuilder*)arg;
+    snapshotBuilderReset(builder);
+    uint64_t count = storeVisibleCount(store);
+    for (uint64_t i = 0; i < count; i++) {
+        const StudentInfo* student = storeIndexed(store, i);
+        if (storeIsDead(store, student - store->records)) {
+            continue;
+        }
+        int grade = gradeIndex(student->grade);
+        if (snapshotBuilderAdd(builder, student->name, grade == -1 ? NUM_GRADES : grade) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Every column has to fit inside the file and in front of the next one. Each bound is checked
+// as a difference against what is left of the file, so huge counts or offsets cannot wrap.
+static int snapshotHeaderValid(const SnapshotHeader* header, uint64_t size) {
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->fileSize != size ||
+        header->gradeOffset < sizeof(SnapshotHeader) || header->gradeOffset > size ||
+        header->rowCount > size - header->gradeOffset) {
+        return 0;
+    }
+    if (header->nameIdOffset > size || header->nameIdOffset % sizeof(uint32_t) != 0 ||
+        header->gradeOffset + header->rowCount > header->nameIdOffset ||
+        header->rowCount > (size - header->nameIdOffset) / sizeof(uint32_t)) {
+        return 0;
+    }
+    if (header->dictionaryOffset > size || header->dictionaryOffset % sizeof(uint64_t) != 0 ||
+        header->nameIdOffset + header->rowCount * sizeof(uint32_t) > header->dictionaryOffset ||
+        header->nameCount >= (size - header->dictionaryOffset) / sizeof(uint64_t)) {
+        return 0;
+    }
+    if (header->stringsOffset > size ||
+        header->dictionaryOffset + (header->nameCount + 1) * sizeof(uint64_t) != header->stringsOffset) {
+        return 0;
+    }
+    const uint64_t* dictionary = (const uint64_t*)((const char*)header + header->dictionaryOffset);
+    return dictionary[header->nameCount] <= size - header->stringsOffset;
+}
+
+int snapshotOpen(Snapshot* snapshot, const char* path) {
+    memset(snapshot, 0, sizeof(*snapshot));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Failed to open snapshot");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (uint64_t)st.st_size < sizeof(SnapshotHeader)) {
+        fprintf(stderr, "%s is not a grade snapshot.\n", path);
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    const SnapshotHeader* header = map;
+    if (!snapshotHeaderValid(header, st.st_size)) {
+        fprintf(stderr, "%s is not a grade snapshot.\n", path);
+        munmap(map, st.st_size);
+        return -1;
+    }
+    snapshot->header = header;
+    snapshot->size = st.st_size;
+    snapshot->grades = (const uint8_t*)map + header->gradeOffset;
+    snapshot->nameIds = (const uint32_t*)((const char*)map + header->nameIdOffset);
+    snapshot->dictionary = (const uint64_t*)((const char*)map + header->dictionaryOffset);
+    snapshot->strings = (const char*)map + header->stringsOffset;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+void snapshotClose(Snapshot* snapshot) {
+    if (snapshot->header != NULL) {
+        munmap((void*)snapshot->header, snapshot->size);
+        snapshot->header = NULL;
+    }
+}
+
+// Name of a row, with its length. snapshotOpen has checked that the blob ends inside the file,
+// so an id or dictionary entry that points past it reads back as an empty name.
+const char* snapshotName(const Snapshot* snapshot, uint64_t row, size_t* length) {
+    uint32_t id = snapshot->nameIds[row];
+    uint64_t stringsSize = snapshot->dictionary[snapshot->header->nameCount];
+    if (id >= snapshot->header->nameCount || snapshot->dictionary[id] >= snapshot->dictionary[id + 1] ||
+        snapshot->dictionary[id + 1] > stringsSize) {
+        *length = 0;
+        return "";
+    }
+    *length = snapshot->dictionary[id + 1] - snapshot->dictionary[id] - 1;
+    return snapshot->strings + snapshot->dictionary[id];
+}
+
+// Rows in [start, end) whose grade bit is set in gradeMask. SSE2 compares 16 grades per
+// step against each wanted grade and turns the hits into row numbers from the bit mask.
+uint64_t snapshotFilter(const Snapshot* snapshot, uint16_t gradeMask, uint64_t start, uint64_t end, uint32_t* rows) {
+    const uint8_t* grades = snapshot->grades;
+    uint64_t count = 0, row = start;
+#ifdef __SSE2__
+    __m128i wanted[NUM_GRADES + 1];
+    int wantedCount = 0;
+    for (int grade = 0; grade <= NUM_GRADES; grade++) {
+        if (gradeMask & (1u << grade)) {
+            wanted[wantedCount++] = _mm_set1_epi8(grade);
+        }
+    }
+    for (; row + 16 <= end; row += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(grades + row));
+        __m128i hits = _mm_setzero_si128();
+        for (int i = 0; i < wantedCount; i++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, wanted[i]));
+        }
+        unsigned bits = _mm_movemask_epi8(hits);
+        while (bits != 0) {
+            rows[count++] = row + __builtin_ctz(bits);
+            bits &= bits - 1;
+        }
+    }
+#endif
+    for (; row < end; row++) {
+        if (grades[row] <= NUM_GRADES && (gradeMask & (1u << grades[row]))) {
+            rows[count++] = row;
+        }
+    }
+    return count;
+}
+
+// "all" or a comma separated list such as AA,BA; returns 0 for an unknown grade
+static uint16_t parseGradeMask(const char* list) {
+    if (list == NULL || strcmp(list, "all") == 0) {
+        return (1u << (NUM_GRADES + 1)) - 1;
+    }
+    uint16_t mask = 0;
+    char copy[128];
+    snprintf(copy, sizeof(copy), "%s", list);
+    char* savePtr;
+    for (char* grade = strtok_r(copy, ",", &savePtr); grade != NULL; grade = strtok_r(NULL, ",", &savePtr)) {
+        int index = gradeIndex(grade);
+        if (index == -1) {
+            return 0;
+        }
+        mask |= 1u << index;
+    }
+    return mask;
+}
+
+void exportSnapshot(const char* sourcePath, const char* snapshotPath) {
+    logMessage("operations.log", "exportSnapshot", "Operation started.");
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    SnapshotBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    int result = 0;
+    uint64_t rejected = 0;
+    if (useGradeStore(sourcePath)) {
+        GradeStore store;
+        result = storeOpen(&store, sourcePath);
+        if (result == 0) {
+            result = storeRead(&store, querySnapshot, &builder, stdout);
+            storeClose(&store);
+        }
+    } else {
+        int file = open(sourcePath, O_RDONLY);
+        LineReader* reader = malloc(sizeof(LineReader));
+        if (file == -1 || reader == NULL) {
+            perror("Failed to open file");
+            result = -1;
+        } else {
+            struct stat st;
+            fstat(file, &st);
+            lineReaderInit(reader, file);
+            reader->limit = textStableSize(file, st.st_size);
+            char* line;
+            size_t length;
+            StudentInfo student;
+            while (result == 0 && lineReaderNext(reader, &line, &length)) {
+                if (!parseStudentLine(line, length, &student)) {
+                    rejected += length > 0;
+                    continue;
+                }
+                int grade = gradeIndex(student.grade);
+                result = snapshotBuilderAdd(&builder, student.name, grade == -1 ? NUM_GRADES : grade);
+            }
+        }
+        if (file != -1) close(file);
+        free(reader);
+    }
+    if (result == 0) {
+        result = snapshotBuilderWrite(&builder, snapshotPath);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    char logBuffer[512];
+    if (result == 0) {
+        snprintf(logBuffer, sizeof(logBuffer), "Exported %llu grades (%llu distinct names) from %s to %s, %llu lines skipped.",
+                 (unsigned long long)builder.rowCount, (unsigned long long)builder.nameCount, sourcePath, snapshotPath,
+                 (unsigned long long)rejected);
+        printf("%s\n%.3f s\n", logBuffer, elapsedSeconds(start, end));
+    } else {
+        snprintf(logBuffer, sizeof(logBuffer), "Snapshot export failed.");
+        printf("%s\n", logBuffer);
+    }
+    logMessage("operations.log", "exportSnapshot", logBuffer);
+    snapshotBuilderFree(&builder);
+}
+
+// Writes matching rows as "Name, GR" lines, four iovecs per row and BULK_IOV_MAX per writev
+static int snapshotWriteText(const Snapshot* snapshot, const uint32_t* rows, uint64_t count, int fd) {
+    static const char* const separators[2] = {", ", "\n"};
+    struct iovec iov[BULK_IOV_MAX];
+    int used = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        size_t length;
+        const char* name = snapshotName(snapshot, rows[i], &length);
+        uint8_t grade = snapshot->grades[rows[i]];
+        iov[used++] = (struct iovec){(void*)name, length};
+        iov[used++] = (struct iovec){(void*)separators[0], 2};
+        iov[used++] = (struct iovec){(void*)(grade < NUM_GRADES ? gradeNames[grade] : "--"), 2};
+        iov[used++] = (struct iovec){(void*)separators[1], 1};
+        if (used + 4 > BULK_IOV_MAX) {
+            if (writevFully(fd, iov, used) == -1) {
+                return -1;
+            }
+            used = 0;
+        }
+    }
+    return used > 0 ? writevFully(fd, iov, used) : 0;
+}
+
+// Filters a snapshot by grade. Without an output it prints the grade counts of the matches;
+// a .gcol output gets a smaller snapshot of the matching rows, anything else text lines.
+void scanSnapshot(const char* snapshotPath, const char* gradeList, const char* outputPath) {
+    uint16_t mask = parseGradeMask(gradeList);
+    if (mask == 0) {
+        printf("Unknown grade in %s.\n", gradeList);
+        return;
+    }
+    logMessage("operations.log", "scanSnapshot", "Operation started.");
+    Snapshot snapshot;
+    if (snapshotOpen(&snapshot, snapshotPath) == -1) {
+        logMessage("operations.log", "scanSnapshot", "Scan failed.");
+        return;
+    }
+
+    size_t pathLength = outputPath != NULL ? strlen(outputPath) : 0;
+    int columnar = pathLength > strlen(SNAPSHOT_EXTENSION) &&
+                   strcmp(outputPath + pathLength - strlen(SNAPSHOT_EXTENSION), SNAPSHOT_EXTENSION) == 0;
+    int out = -1;
+    if (outputPath != NULL && !columnar && (out = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        perror("Failed to open file for writing");
+        snapshotClose(&snapshot);
+        logMessage("operations.log", "scanSnapshot", "Scan failed.");
+        return;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t* rows = malloc(SNAPSHOT_SCAN_ROWS * sizeof(uint32_t));
+    SnapshotBuilder builder;
+    memset(&builder, 0, sizeof(builder));
+    GradeTally tally;
+    memset(&tally, 0, sizeof(tally));
+    uint64_t matched = 0, rowCount = snapshot.header->rowCount;
+    int result = rows != NULL ? 0 : -1;
+    for (uint64_t first = 0; result == 0 && first < rowCount; first += SNAPSHOT_SCAN_ROWS) {
+        uint64_t last = first + SNAPSHOT_SCAN_ROWS < rowCount ? first + SNAPSHOT_SCAN_ROWS : rowCount;
+        uint64_t count = snapshotFilter(&snapshot, mask, first, last, rows);
+        matched += count;
+        if (out != -1) {
+            result = snapshotWriteText(&snapshot, rows, count, out);
+        } else if (columnar) {
+            for (uint64_t i = 0; result == 0 && i < count; i++) {
+                size_t length;
+                const char* name = snapshotName(&snapshot, rows[i], &length);
+                result = snapshotBuilderAddName(&builder, name, length, snapshot.grades[rows[i]]);
+            }
+        } else {
+            for (uint64_t i = 0; i < count; i++) {
+                uint8_t grade = snapshot.grades[rows[i]];
+                tally.counts[grade]++;
+                tally.points += grade < NUM_GRADES ? gradePoints[grade] : 0;
+            }
+        }
+    }
+    if (result == 0 && columnar) {
+        result = snapshotBuilderWrite(&builder, outputPath);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(rows);
+    snapshotBuilderFree(&builder);
+    if (out != -1) {
+        close(out);
+    }
+    snapshotClose(&snapshot);
+
+    if (result == -1) {
+        printf("Snapshot scan failed.\n");
+        logMessage("operations.log", "scanSnapshot", "Scan failed.");
+        return;
+    }
+    if (outputPath == NULL) {
+        printGradeStats(&tally, NULL, stdout);
+    }
+    double seconds = elapsedSeconds(start, end);
+    char logBuffer[512];
+    snprintf(logBuffer, sizeof(logBuffer), "Scanned %llu rows of %s, %llu matched%s%s.",
+             (unsigned long long)rowCount, snapshotPath, (unsigned long long)matched,
+             outputPath != NULL ? " and written to " : "", outputPath != NULL ? outputPath : "");
+    logMessage("operations.log", "scanSnapshot", logBuffer);
+    printf("%s\n%.3f s, %.0f rows/s\n", logBuffer, seconds, seconds > 0 ? rowCount / seconds : 0);
+}
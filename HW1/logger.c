@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include "logger.h"
+
+#define LOG_RING_SIZE 1024 // Must be a power of two
+#define LOG_RECORD_SIZE 384
+#define LOG_BATCH_SIZE 64
+#define LOG_ROTATE_SIZE (4 * 1024 * 1024)
+#define LOG_ROTATE_KEEP 3
+
+typedef struct {
+    _Atomic uint64_t sequence; // Ticket that may fill the slot, or ticket + 1 once it is filled
+    int length;
+    char text[LOG_RECORD_SIZE];
+} LogRecord;
+
+typedef struct {
+    LogRecord records[LOG_RING_SIZE];
+    _Atomic uint64_t head;    // Next ticket handed to a producer
+    _Atomic uint64_t written; // Tickets below this are on disk
+    uint64_t tail;            // Next record the writer thread drains
+    _Atomic int sleeping;
+    int started;
+    int stopping;
+    int hooksInstalled;
+    int fd;
+    off_t fileSize;
+    char path[256];
+    pthread_t writerThread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t drained;
+    pthread_mutex_t startMutex;
+} AsyncLogger;
+
+static AsyncLogger asyncLogger = {
+    .fd = -1,
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .drained = PTHREAD_COND_INITIALIZER,
+    .startMutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+// Appends a batch to the log file, finishing any short writev piece by piece
+static void logWriteBatch(struct iovec* iov, int count) {
+    ssize_t total = 0;
+    for (int i = 0; i < count; i++) {
+        total += iov[i].iov_len;
+    }
+    ssize_t written = writev(asyncLogger.fd, iov, count);
+    if (written == total) {
+        asyncLogger.fileSize += written;
+        return;
+    }
+    if (written < 0) {
+        written = 0;
+    }
+    asyncLogger.fileSize += written;
+    for (int i = 0; i < count; i++) {
+        if ((size_t)written >= iov[i].iov_len) {
+            written -= iov[i].iov_len;
+            continue;
+        }
+        const char* data = (const char*)iov[i].iov_base + written;
+        size_t remaining = iov[i].iov_len - written;
+        written = 0;
+        while (remaining > 0) {
+            ssize_t result = write(asyncLogger.fd, data, remaining);
+            if (result <= 0) {
+                if (result == -1 && errno == EINTR) continue;
+                perror("Failed to write log entry");
+                return;
+            }
+            data += result;
+            remaining -= result;
+            asyncLogger.fileSize += result;
+        }
+    }
+}
+
+// Renames operations.log to operations.log.1 (shifting older ones up) and starts a new file
+static void logRotate() {
+    char from[sizeof(asyncLogger.path) + 12], to[sizeof(asyncLogger.path) + 12]; // Room for ".%d" of any int
+    close(asyncLogger.fd);
+    for (int i = LOG_ROTATE_KEEP - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", asyncLogger.path, i);
+        snprintf(to, sizeof(to), "%s.%d", asyncLogger.path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", asyncLogger.path);
+    rename(asyncLogger.path, to);
+    asyncLogger.fd = open(asyncLogger.path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    asyncLogger.fileSize = 0;
+}
+
+static void* logWriter(void* arg) {
+    (void)arg;
+    struct iovec iov[LOG_BATCH_SIZE];
+    while (1) {
+        // Gather every published record at the tail, up to one batch
+        int count = 0;
+        size_t batchBytes = 0;
+        while (count < LOG_BATCH_SIZE) {
+            LogRecord* record = &asyncLogger.records[(asyncLogger.tail + count) & (LOG_RING_SIZE - 1)];
+            if (atomic_load_explicit(&record->sequence, memory_order_acquire) != asyncLogger.tail + count + 1) {
+                break;
+            }
+            iov[count].iov_base = record->text;
+            iov[count].iov_len = record->length;
+            batchBytes += record->length;
+            count++;
+        }
+
+        if (count > 0) {
+            if (asyncLogger.fd != -1) {
+                if (asyncLogger.fileSize > 0 && asyncLogger.fileSize + (off_t)batchBytes > LOG_ROTATE_SIZE) {
+                    logRotate();
+                }
+                if (asyncLogger.fd != -1) {
+                    logWriteBatch(iov, count);
+                }
+            }
+            // Hand the slots back to producers
+            for (int i = 0; i < count; i++) {
+                LogRecord* record = &asyncLogger.records[(asyncLogger.tail + i) & (LOG_RING_SIZE - 1)];
+                atomic_store_explicit(&record->sequence, asyncLogger.tail + i + LOG_RING_SIZE, memory_order_release);
+            }
+            asyncLogger.tail += count;
+            atomic_store_explicit(&asyncLogger.written, asyncLogger.tail, memory_order_release);
+            continue;
+        }
+
+        pthread_mutex_lock(&asyncLogger.mutex);
+        pthread_cond_broadcast(&asyncLogger.drained);
+        if (asyncLogger.stopping) {
+            pthread_mutex_unlock(&asyncLogger.mutex);
+            break;
+        }
+        // Producers only pay for a wakeup when the writer is actually asleep
+        atomic_store(&asyncLogger.sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        LogRecord* next = &asyncLogger.records[asyncLogger.tail & (LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&next->sequence, memory_order_acquire) != asyncLogger.tail + 1) {
+            pthread_cond_wait(&asyncLogger.wake, &asyncLogger.mutex);
+        }
+        atomic_store(&asyncLogger.sleeping, 0);
+        pthread_mutex_unlock(&asyncLogger.mutex);
+    }
+    return NULL;
+}
+
+void logFlush() {
+    if (!asyncLogger.started) {
+        return;
+    }
+    uint64_t target = atomic_load(&asyncLogger.head);
+    pthread_mutex_lock(&asyncLogger.mutex);
+    while (atomic_load_explicit(&asyncLogger.written, memory_order_acquire) < target) {
+        pthread_cond_signal(&asyncLogger.wake);
+        pthread_cond_wait(&asyncLogger.drained, &asyncLogger.mutex);
+    }
+    pthread_mutex_unlock(&asyncLogger.mutex);
+}
+
+void logShutdown() {
+    if (!asyncLogger.started) {
+        return;
+    }
+    pthread_mutex_lock(&asyncLogger.mutex);
+    asyncLogger.stopping = 1;
+    pthread_cond_signal(&asyncLogger.wake);
+    pthread_mutex_unlock(&asyncLogger.mutex);
+    pthread_join(asyncLogger.writerThread, NULL);
+    close(asyncLogger.fd);
+    asyncLogger.started = 0;
+}
+
+static void logResetRing() {
+    for (uint64_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_store(&asyncLogger.records[i].sequence, i);
+    }
+    atomic_store(&asyncLogger.head, 0);
+    atomic_store(&asyncLogger.written, 0);
+    asyncLogger.tail = 0;
+}
+
+// Nothing pending may be copied into a child, or both processes would write it
+static void logBeforeFork() {
+    logFlush();
+}
+
+static void logInChild() {
+    // The writer thread does not exist in the child; start a fresh one on first use
+    pthread_mutex_init(&asyncLogger.mutex, NULL);
+    pthread_cond_init(&asyncLogger.wake, NULL);
+    pthread_cond_init(&asyncLogger.drained, NULL);
+    pthread_mutex_init(&asyncLogger.startMutex, NULL);
+    if (asyncLogger.started) {
+        close(asyncLogger.fd);
+        asyncLogger.started = 0;
+    }
+    logResetRing();
+}
+
+int logInit(const char* logFilePath) {
+    pthread_mutex_lock(&asyncLogger.startMutex);
+    if (!asyncLogger.started) {
+        if (!asyncLogger.hooksInstalled) {
+            pthread_atfork(logBeforeFork, NULL, logInChild);
+            atexit(logShutdown);
+            logResetRing();
+            asyncLogger.hooksInstalled = 1;
+        }
+        snprintf(asyncLogger.path, sizeof(asyncLogger.path), "%s", logFilePath);
+        asyncLogger.fd = open(logFilePath, O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (asyncLogger.fd == -1) {
+            perror("Failed to open log file");
+            pthread_mutex_unlock(&asyncLogger.startMutex);
+            return -1;
+        }
+        struct stat st;
+        fstat(asyncLogger.fd, &st);
+        asyncLogger.fileSize = st.st_size;
+        asyncLogger.stopping = 0;
+        if (pthread_create(&asyncLogger.writerThread, NULL, logWriter, NULL) != 0) {
+            close(asyncLogger.fd);
+            pthread_mutex_unlock(&asyncLogger.startMutex);
+            return -1;
+        }
+        asyncLogger.started = 1;
+    }
+    pthread_mutex_unlock(&asyncLogger.startMutex);
+    return 0;
+}
+
+// Formats the "[time] operation: message" line, reusing the time text within a second
+static int logFormat(char* buffer, size_t size, const char* operation, const char* message) {
+    static __thread time_t cachedSecond = -1;
+    static __thread char cachedTime[32];
+    time_t now = time(NULL);
+    if (now != cachedSecond) {
+        ctime_r(&now, cachedTime);
+        cachedTime[24] = '\0'; // Remove the newline at the end of the time string
+        cachedSecond = now;
+    }
+    int length = snprintf(buffer, size, "[%s] %s: %s\n", cachedTime, operation, message);
+    if (length >= (int)size) {
+        length = size - 1;
+        buffer[length - 1] = '\n'; // Keep truncated entries on their own line
+    }
+    return length;
+}
+
+void logMessage(const char* logFilePath, const char* operation, const char* message) {
+    if (!asyncLogger.started && logInit(logFilePath) == -1) {
+        return;
+    }
+
+    if (strcmp(logFilePath, asyncLogger.path) != 0) {
+        // Only one log file is buffered; any other path is appended directly
+        char logEntry[LOG_RECORD_SIZE];
+        int length = logFormat(logEntry, sizeof(logEntry), operation, message);
+        int fd = open(logFilePath, O_WRONLY | O_CREAT | O_APPEND, 0666);
+        if (fd == -1 || write(fd, logEntry, length) != length) {
+            perror("Failed to write log entry");
+        }
+        if (fd != -1) close(fd);
+        return;
+    }
+
+    // Claim a slot: its sequence equals our ticket while it is free
+    LogRecord* record;
+    uint64_t ticket = atomic_load_explicit(&asyncLogger.head, memory_order_relaxed);
+    while (1) {
+        record = &asyncLogger.records[ticket & (LOG_RING_SIZE - 1)];
+        uint64_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        int64_t difference = (int64_t)(sequence - ticket);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&asyncLogger.head, &ticket, ticket + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            // Ring is full: make sure the writer is awake and let it catch up
+            pthread_mutex_lock(&asyncLogger.mutex);
+            pthread_cond_signal(&asyncLogger.wake);
+            pthread_mutex_unlock(&asyncLogger.mutex);
+            sched_yield();
+            ticket = atomic_load_explicit(&asyncLogger.head, memory_order_relaxed);
+        } else {
+            ticket = atomic_load_explicit(&asyncLogger.head, memory_order_relaxed);
+        }
+    }
+
+    record->length = logFormat(record->text, sizeof(record->text), operation, message);
+    atomic_store_explicit(&record->sequence, ticket + 1, memory_order_release);
+
+    atomic_thread_fence(memory_order_seq_cst); // Pairs with the writer announcing it is going to sleep
+    if (atomic_load(&asyncLogger.sleeping)) {
+        pthread_mutex_lock(&asyncLogger.mutex);
+        pthread_cond_signal(&asyncLogger.wake);
+        pthread_mutex_unlock(&asyncLogger.mutex);
+    }
+}
@@ -0,0 +1,21 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+// Asynchronous logger: callers fill slots of a lock-free ring, one writer thread
+// drains it to the log file in writev batches and rotates the file by size.
+// Link with -pthread. logMessage starts the logger on first use, so logInit is only
+// needed to report an unusable log file up front; the writer is stopped at exit.
+
+// Opens logFilePath (appending) and starts the writer thread; -1 on failure
+int logInit(const char* logFilePath);
+
+// Queues "[time] operation: message"; lines for any other path are appended directly
+void logMessage(const char* logFilePath, const char* operation, const char* message);
+
+// Waits until everything logged so far has reached the file
+void logFlush();
+
+// Drains the ring, stops the writer thread and closes the file
+void logShutdown();
+
+#endif
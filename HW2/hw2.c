@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -5,190 +6,2475 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 #include <signal.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define FIFO1 "fifo1"
 #define FIFO2 "fifo2"
 
-volatile sig_atomic_t child_counter = 0;
+// Shared-memory transport: single-producer/single-consumer rings of ints in one
+// shm_open segment, with eventfds to wake a side that found its ring empty or full
+#define SHM_NAME "/hw2_rings"
+#define RING_CAPACITY (1 << 16) // Elements per ring, must be a power of two
+#define RING_BATCH 4096         // Most elements published at once
+#define PRINT_LIMIT 20          // Generated numbers echoed by the parent
+#define BENCH_DEFAULT_EXPONENT 7
 
-void sigchld_handler(int signo)
+enum transport
+{
+    TRANSPORT_FIFO,   // One int per write()
+    TRANSPORT_FRAMED, // Batched frames
+    TRANSPORT_SHM
+};
+
+// Reduction engine (-r): the array is split into one chunk per worker, every worker runs
+// the requested stages over its chunk and the parent combines the partial results
+#define REDUCE_MAX_WORKERS 256
+#define REDUCE_SCALING_RUNS 3 // Best of, per worker count
+#define HISTOGRAM_BINS 11     // Values 0..10; one extra bin counts everything else
+#define REDUCE_BIT(op) (1 << (op))
+
+enum reduce_op
+{
+    REDUCE_SUM,
+    REDUCE_PRODUCT,
+    REDUCE_MIN,
+    REDUCE_MAX,
+    REDUCE_HISTOGRAM,
+    REDUCE_OPS
+};
+
+static const char *const reduce_names[REDUCE_OPS] = {"sum", "product", "min", "max", "histogram"};
+
+// One worker's result, cache-line aligned so thread workers do not share lines.
+// Its product is a bignum kept outside, as forked workers cannot share the limbs.
+typedef struct
+{
+    _Alignas(64) uint64_t count;
+    __int128 sum; // Exact for any element count
+    int min, max;
+    uint64_t histogram[HISTOGRAM_BINS + 1];
+} reduce_partial;
+
+// Exact products: magnitudes in base 10^9 limbs, least significant first, so printing
+// needs no base conversion. Length 0 is zero.
+#define BIGNUM_BASE 1000000000u
+#define BIGNUM_DIGITS 9
+#define KARATSUBA_THRESHOLD 32 // Limbs of the shorter operand below which schoolbook wins
+#define BIGNUM_PRINT_DIGITS 60 // Longer numbers print their first and last 20 digits
+#define PRODUCT_LEVELS 64
+#define PRODUCT_BLOCK 65536 // Values between checks for a zero found by another worker
+#define SUM_BLOCK (1u << 31) // Values summed in 64-bit lanes before folding into 128 bits
+
+typedef struct
+{
+    uint32_t *limbs;
+    size_t length;
+    size_t capacity;
+    int negative;
+} bignum;
+
+// Pending partial products of a product tree, built as values stream in
+typedef struct
+{
+    bignum items[PRODUCT_LEVELS];
+    int levels[PRODUCT_LEVELS];
+    int count;
+    int zero;      // A zero was seen: the product is 0 whatever follows
+    int negative;  // Odd number of negative factors so far
+    uint64_t leaf; // Factors not yet pushed, a single limb
+} product_stack;
+
+// Streaming input: numbers are produced and sent a chunk at a time, so the parent's
+// memory does not grow with the input
+#define STREAM_CHUNK 65536  // Numbers per chunk
+#define SOURCE_BUFFER 65536 // Bytes of input text read at a time
+#define NUMBER_TEXT_MAX 16  // Longest token accepted as an int
+
+typedef struct
+{
+    int fd;             // Text input, or -1 to generate
+    uint64_t remaining; // Numbers left to generate
+    size_t start, end;  // Unparsed text in buffer
+    int eof, error;
+    char buffer[SOURCE_BUFFER];
+} number_source;
+
+// FIFO pipeline handshake: single-byte messages on anonymous pipes replace the sleeps
+#define READY_CHILD1 '1'        // Child 1 has FIFO1 open for reading
+#define READY_CHILD2 '2'        // Child 2 has FIFO2 open for reading
+#define MESSAGE_GO 'G'          // Parent to Child 1: both readers are in place, open FIFO2
+#define MESSAGE_WRITER_OPEN 'O' // Child 1 to parent: FIFO2 stays open until the sum is in it
+#define HANDSHAKE_TIMEOUT_MS 10000
+#define OLD_SLEEP_SECONDS 32 // sleep(12) before the second fork + the parent's sleep(10) + waits for open
+
+// Parent event loop: one epoll set holds the children's pidfds (or a SIGCHLD signalfd)
+// and the FIFOs being written; the tag in each event says which one became ready
+#define EVENT_MAX 8
+#define LOOP_CHILDREN 2
+#define EVENT_TAG(kind, index) ((uint64_t)(kind) << 32 | (uint32_t)(index))
+
+enum event_kind
+{
+    EVENT_STREAM,
+    EVENT_CHILD,
+    EVENT_SIGNAL
+};
+
+typedef struct
+{
+    int epoll_fd;
+    int signal_fd; // SIGCHLD fallback; -1 when the children have pidfds
+    pid_t pids[LOOP_CHILDREN]; // 0 once reaped
+    int pidfds[LOOP_CHILDREN];
+    int children, exited;
+    int failed; // A child failed or a FIFO reader went away
+} event_loop;
+
+// Framed FIFO messages: an 8-byte header, then at most PIPE_BUF - 8 payload bytes, so a
+// frame always goes into a pipe with one atomic write even when processes share the FIFO
+#define FRAME_MAGIC 0x4846 // "FH" in memory
+#define FRAME_MAX_PAYLOAD (PIPE_BUF - sizeof(frame_header))
+#define FRAME_MAX_NUMBERS (FRAME_MAX_PAYLOAD / sizeof(int))
+#define FRAME_BATCH 64 // Frames gathered into one writev() on a FIFO with a single writer
+#define FRAME_READ_BUFFER 65536
+#define COMMAND_MAX 64
+#define DEFAULT_COMMAND "multiply"
+
+enum frame_type
+{
+    FRAME_NUMBERS = 1, // A batch of ints
+    FRAME_END,         // uint64_t count of the ints sent before it
+    FRAME_COMMAND,     // Command name, NUL-padded to a multiple of 4 bytes
+    FRAME_SUM,         // Child 1's sum, __int128
+    FRAME_TYPES
+};
+
+typedef struct
+{
+    uint16_t magic;
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t length; // Payload bytes after the header
+} frame_header;
+
+enum stream_stage
+{
+    STREAM_NUMBERS,
+    STREAM_DONE,   // Everything framed, maybe not yet written
+    STREAM_WRITTEN // Written; the FIFO is closed unless more batches follow
+};
+
+// Outgoing side of a FIFO: an optional COMMAND frame, batches of NUMBERS frames and an
+// END frame once the last batch is out
+typedef struct
+{
+    int fd;
+    int exclusive; // No other process writes this FIFO, so frames may share a writev()
+    const int *numbers;
+    size_t count;
+    size_t next;   // Numbers of this batch already framed
+    int more;      // Another batch follows: no END yet and the FIFO stays open
+    uint64_t sent; // Numbers framed over all batches
+    const char *command; // Cleared once sent
+    enum stream_stage stage;
+    uint64_t end_count;
+    char command_frame[COMMAND_MAX];
+    frame_header headers[FRAME_BATCH];
+    struct iovec iov[2 * FRAME_BATCH];
+    int iov_count, iov_index;
+} frame_stream;
+
+typedef struct
+{
+    int fd;
+    size_t start, end; // Unconsumed bytes in buffer
+    _Alignas(8) char buffer[FRAME_READ_BUFFER];
+} frame_reader;
+
+typedef struct
+{
+    _Atomic uint64_t head; // Next element the producer writes
+    char pad_head[56];
+    _Atomic uint64_t tail; // Next element the consumer reads
+    char pad_tail[56];
+    _Atomic int consumer_waiting;
+    _Atomic int producer_waiting;
+    _Atomic int closed;
+    int data[RING_CAPACITY];
+} shm_ring;
+
+typedef struct
+{
+    shm_ring *ring;
+    int data_fd;  // Signalled by the producer after publishing
+    int space_fd; // Signalled by the consumer after freeing space
+} ring_channel;
+
+// Maps count rings in a fresh shared-memory segment; the name is unlinked at once
+// because children reach the segment through the mapping they inherit from fork()
+static shm_ring *shm_rings_create(int count)
+{
+    size_t size = count * sizeof(shm_ring);
+    int fd = shm_open(SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        perror("shm_open");
+        return NULL;
+    }
+    shm_unlink(SHM_NAME);
+    if (ftruncate(fd, size) < 0)
+    {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    shm_ring *rings = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (rings == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    return rings; // ftruncate zero-filled it: every ring starts empty and open
+}
+
+static int ring_channel_init(ring_channel *channel, shm_ring *ring)
+{
+    channel->ring = ring;
+    channel->data_fd = eventfd(0, 0);
+    channel->space_fd = eventfd(0, 0);
+    if (channel->data_fd < 0 || channel->space_fd < 0)
+    {
+        perror("eventfd");
+        return -1;
+    }
+    return 0;
+}
+
+static void ring_channel_close(ring_channel *channel)
+{
+    close(channel->data_fd);
+    close(channel->space_fd);
+}
+
+static void event_signal(int fd)
+{
+    uint64_t one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+static void event_wait(int fd)
+{
+    uint64_t count;
+    while (read(fd, &count, sizeof(count)) < 0 && errno == EINTR)
+        ;
+}
+
+// Copies values into the ring in batches, sleeping on space_fd only when the ring is full.
+// The waiting flags make the eventfd calls rare: a side only signals when the other one
+// announced it is about to sleep, and both flag and index accesses are sequentially consistent.
+static void ring_send(ring_channel *channel, const int *values, size_t count)
+{
+    shm_ring *ring = channel->ring;
+    while (count > 0)
+    {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint64_t space = RING_CAPACITY - (head - atomic_load(&ring->tail));
+        if (space == 0)
+        {
+            atomic_store(&ring->producer_waiting, 1);
+            if (RING_CAPACITY - (head - atomic_load(&ring->tail)) == 0)
+            {
+                event_wait(channel->space_fd);
+            }
+            atomic_store(&ring->producer_waiting, 0);
+            continue;
+        }
+        size_t batch = count < space ? count : space;
+        if (batch > RING_BATCH)
+        {
+            batch = RING_BATCH;
+        }
+        size_t start = head & (RING_CAPACITY - 1);
+        size_t first = batch < RING_CAPACITY - start ? batch : RING_CAPACITY - start;
+        memcpy(&ring->data[start], values, first * sizeof(int));
+        memcpy(&ring->data[0], values + first, (batch - first) * sizeof(int));
+        atomic_store(&ring->head, head + batch);
+        if (atomic_load(&ring->consumer_waiting))
+        {
+            event_signal(channel->data_fd);
+        }
+        values += batch;
+        count -= batch;
+    }
+}
+
+// No more data: a consumer that drained the ring returns 0 from ring_receive
+static void ring_close(ring_channel *channel)
+{
+    atomic_store(&channel->ring->closed, 1);
+    event_signal(channel->data_fd);
+}
+
+// Copies up to max elements out of the ring; returns 0 once it is closed and empty
+static size_t ring_receive(ring_channel *channel, int *values, size_t max)
+{
+    shm_ring *ring = channel->ring;
+    while (1)
+    {
+        uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        uint64_t available = atomic_load(&ring->head) - tail;
+        if (available == 0)
+        {
+            if (atomic_load(&ring->closed))
+            {
+                if (atomic_load(&ring->head) == tail)
+                {
+                    return 0;
+                }
+                continue;
+            }
+            atomic_store(&ring->consumer_waiting, 1);
+            if (atomic_load(&ring->head) == tail && !atomic_load(&ring->closed))
+            {
+                event_wait(channel->data_fd);
+            }
+            atomic_store(&ring->consumer_waiting, 0);
+            continue;
+        }
+        size_t batch = available < max ? available : max;
+        size_t start = tail & (RING_CAPACITY - 1);
+        size_t first = batch < RING_CAPACITY - start ? batch : RING_CAPACITY - start;
+        memcpy(values, &ring->data[start], first * sizeof(int));
+        memcpy(values + first, &ring->data[0], (batch - first) * sizeof(int));
+        atomic_store(&ring->tail, tail + batch);
+        if (atomic_load(&ring->producer_waiting))
+        {
+            event_signal(channel->space_fd);
+        }
+        return batch;
+    }
+}
+
+static double elapsed_seconds(struct timespec start, struct timespec end)
+{
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void print_numbers(const int *array, int size)
+{
+    for (int i = 0; i < size && i < PRINT_LIMIT; ++i)
+    {
+        printf("%d ", array[i]);
+    }
+    if (size > PRINT_LIMIT)
+    {
+        printf("... (%d more)", size - PRINT_LIMIT);
+    }
+}
+
+// Numbers come from a text file (fd 0 for "-") or, without a path, from rand()
+static int source_open(number_source *source, const char *path, uint64_t count)
+{
+    *source = (number_source){.fd = -1, .remaining = count};
+    if (path == NULL)
+    {
+        srand(time(NULL));
+        return 0;
+    }
+    source->fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+    if (source->fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static void source_close(number_source *source)
+{
+    if (source->fd > STDIN_FILENO)
+    {
+        close(source->fd);
+    }
+}
+
+// Keeps the unparsed tail of the buffer and appends the next read; returns 0 at end of
+// input or on an error
+static int source_fill(number_source *source)
+{
+    memmove(source->buffer, source->buffer + source->start, source->end - source->start);
+    source->end -= source->start;
+    source->start = 0;
+    if (source->end == sizeof(source->buffer))
+    {
+        fprintf(stderr, "Input: token too long\n");
+        source->error = 1;
+        return 0;
+    }
+    ssize_t n;
+    while ((n = read(source->fd, source->buffer + source->end, sizeof(source->buffer) - source->end)) < 0 &&
+           errno == EINTR)
+        ;
+    if (n <= 0)
+    {
+        if (n < 0)
+        {
+            perror("read");
+            source->error = 1;
+        }
+        source->eof = 1;
+        return 0;
+    }
+    source->end += n;
+    return 1;
+}
+
+// Fills values with up to max numbers; returns 0 at the end of the input. Text is read
+// a buffer at a time, so input of any length takes constant memory.
+static size_t source_next(number_source *source, int *values, size_t max)
+{
+    size_t count = 0;
+    if (source->fd < 0)
+    {
+        for (; count < max && source->remaining > 0; source->remaining--)
+        {
+            values[count++] = rand() % 11; // Random numbers between 0 and 10
+        }
+        return count;
+    }
+    while (count < max && !source->error)
+    {
+        while (source->start < source->end && isspace((unsigned char)source->buffer[source->start]))
+        {
+            source->start++;
+        }
+        size_t end = source->start;
+        while (end < source->end && !isspace((unsigned char)source->buffer[end]))
+        {
+            end++;
+        }
+        if (end == source->end && !source->eof)
+        {
+            source_fill(source); // The token may continue in the next read
+            continue;
+        }
+        if (end == source->start)
+        {
+            break; // End of input
+        }
+
+        char text[NUMBER_TEXT_MAX + 1], *stop;
+        size_t length = end - source->start;
+        memcpy(text, source->buffer + source->start, length < NUMBER_TEXT_MAX ? length : NUMBER_TEXT_MAX);
+        text[length < NUMBER_TEXT_MAX ? length : NUMBER_TEXT_MAX] = '\0';
+        errno = 0;
+        long value = strtol(text, &stop, 10);
+        if (length > NUMBER_TEXT_MAX || *stop != '\0' || errno != 0 || value < INT_MIN || value > INT_MAX)
+        {
+            fprintf(stderr, "Input: '%s' is not an int\n", text);
+            source->error = 1;
+            break;
+        }
+        values[count++] = value;
+        source->start = end;
+    }
+    return count;
+}
+
+// Echoes the first PRINT_LIMIT numbers of a stream; seen counts the numbers before values
+static void print_stream_numbers(const int *values, size_t n, uint64_t seen)
+{
+    for (size_t i = 0; i < n && seen + i < PRINT_LIMIT; ++i)
+    {
+        printf("%d ", values[i]);
+    }
+}
+
+// Waits with poll() and reads once; returns 0 at end of file or on an error.
+// A FIFO opened with O_NONBLOCK does not report hang-up before its first writer
+// connects, so poll() also covers the window before the writer opens its end.
+static size_t read_some(int fd, void *buffer, size_t size)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    while (1)
+    {
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return 0;
+        }
+        ssize_t n = read(fd, buffer, size);
+        if (n >= 0)
+        {
+            return n; // 0: every writer closed
+        }
+        if (errno != EAGAIN && errno != EINTR)
+        {
+            perror("read");
+            return 0;
+        }
+    }
+}
+
+// Reads up to size bytes; stops early only at end of file
+static size_t read_fully(int fd, void *buffer, size_t size)
+{
+    size_t done = 0, n;
+    while (done < size && (n = read_some(fd, (char *)buffer + done, size - done)) > 0)
+    {
+        done += n;
+    }
+    return done;
+}
+
+static int write_fully(int fd, const void *buffer, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(fd, buffer, size);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buffer = (const char *)buffer + n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Opens a FIFO without blocking, then makes later reads and writes blocking
+static int open_fifo(const char *path, int flags)
+{
+    int fd = open(path, flags | O_NONBLOCK);
+    if (fd < 0)
+    {
+        perror(path);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
+
+// Waits for a handshake byte from the children; returns 0 on timeout or a closed pipe
+static char wait_handshake(int fd)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    char message;
+    int ready;
+    while ((ready = poll(&pfd, 1, HANDSHAKE_TIMEOUT_MS)) < 0 && errno == EINTR)
+        ;
+    if (ready <= 0 || read(fd, &message, 1) != 1)
+    {
+        return 0;
+    }
+    return message;
+}
+
+static double milliseconds_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return elapsed_seconds(start, now) * 1000;
+}
+
+// Structural checks only: a pipe neither reorders nor corrupts bytes, so a frame that
+// fails them means a writer broke the protocol, which a checksum would not add to.
+// Payload lengths are multiples of 4, so every payload in a reader's buffer is int-aligned.
+static int frame_valid(const frame_header *header)
+{
+    if (header->magic != FRAME_MAGIC || header->type == 0 || header->type >= FRAME_TYPES ||
+        header->length > FRAME_MAX_PAYLOAD || header->length % sizeof(int) != 0)
+    {
+        return 0;
+    }
+    switch (header->type)
+    {
+    case FRAME_NUMBERS:
+        return header->length > 0;
+    case FRAME_END:
+        return header->length == sizeof(uint64_t);
+    case FRAME_SUM:
+        return header->length == sizeof(__int128);
+    default: // FRAME_COMMAND
+        return header->length > 0 && header->length <= COMMAND_MAX;
+    }
+}
+
+// Sends one frame with a single writev(); at most PIPE_BUF bytes, so it is never
+// interleaved with frames from other writers of the same FIFO
+static int frame_write(int fd, int type, const void *payload, uint32_t length)
+{
+    frame_header header = {FRAME_MAGIC, type, 0, length};
+    struct iovec iov[2] = {{&header, sizeof(header)}, {(void *)payload, length}};
+    ssize_t written;
+    while ((written = writev(fd, iov, 2)) < 0 && errno == EINTR)
+        ;
+    return written == (ssize_t)(sizeof(header) + length) ? 0 : -1;
+}
+
+// Frames the next batch of the stream into iov; returns 0 once everything was framed
+static int frame_stream_fill(frame_stream *stream)
+{
+    int limit = stream->exclusive ? FRAME_BATCH : 1;
+    int frames = 0;
+    stream->iov_count = stream->iov_index = 0;
+    while (frames < limit && stream->stage != STREAM_DONE)
+    {
+        if (stream->command == NULL && stream->next == stream->count && stream->more)
+        {
+            stream->stage = STREAM_DONE;
+            break;
+        }
+        frame_header *header = &stream->headers[frames++];
+        struct iovec *iov = &stream->iov[stream->iov_count];
+        header->magic = FRAME_MAGIC;
+        header->reserved = 0;
+        if (stream->command != NULL)
+        { // The command goes first so the reader knows what to compute
+            size_t length = strlen(stream->command);
+            memset(stream->command_frame, 0, sizeof(stream->command_frame));
+            memcpy(stream->command_frame, stream->command, length);
+            header->type = FRAME_COMMAND;
+            header->length = (length + sizeof(int) - 1) / sizeof(int) * sizeof(int);
+            iov[1].iov_base = stream->command_frame;
+            stream->command = NULL;
+        }
+        else if (stream->next < stream->count)
+        {
+            size_t batch = stream->count - stream->next;
+            if (batch > FRAME_MAX_NUMBERS)
+            {
+                batch = FRAME_MAX_NUMBERS;
+            }
+            header->type = FRAME_NUMBERS;
+            header->length = batch * sizeof(int);
+            iov[1].iov_base = (void *)(stream->numbers + stream->next);
+            stream->next += batch;
+            stream->sent += batch;
+        }
+        else
+        {
+            stream->end_count = stream->sent;
+            header->type = FRAME_END;
+            header->length = sizeof(stream->end_count);
+            iov[1].iov_base = &stream->end_count;
+            stream->stage = STREAM_DONE;
+        }
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(*header);
+        iov[1].iov_len = header->length;
+        stream->iov_count += 2;
+    }
+    return stream->iov_count > 0;
+}
+
+// Writes as much of the stream as the FIFO takes; returns 1 when all of it went out,
+// 0 when a non-blocking FIFO is full and -1 on an error
+static int frame_stream_pump(frame_stream *stream)
+{
+    while (1)
+    {
+        if (stream->iov_index == stream->iov_count && !frame_stream_fill(stream))
+        {
+            return 1;
+        }
+        int count = stream->iov_count - stream->iov_index;
+        ssize_t written = writev(stream->fd, &stream->iov[stream->iov_index], count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                return 0;
+            perror("writev");
+            return -1;
+        }
+        // Only an exclusive stream can be cut short, as a shared one writes <= PIPE_BUF bytes
+        while (written > 0)
+        {
+            struct iovec *iov = &stream->iov[stream->iov_index];
+            if ((size_t)written >= iov->iov_len)
+            {
+                written -= iov->iov_len;
+                stream->iov_index++;
+            }
+            else
+            {
+                iov->iov_base = (char *)iov->iov_base + written;
+                iov->iov_len -= written;
+                written = 0;
+            }
+        }
+    }
+}
+
+// Starts the next batch of a stream once the previous one was written
+static void frame_stream_batch(frame_stream *stream, const int *numbers, size_t count, int more)
+{
+    stream->numbers = numbers;
+    stream->count = count;
+    stream->next = 0;
+    stream->more = more;
+    stream->stage = STREAM_NUMBERS;
+}
+
+// pidfd_open(2) through syscall(), as older C libraries have no wrapper
+static int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Sets up the parent's event loop before any fork(). Children are watched through
+// pidfds; a kernel without them gets one signalfd for SIGCHLD instead, and SIGCHLD is
+// blocked first so an early exit stays pending for it.
+static int event_loop_init(event_loop *loop)
+{
+    *loop = (event_loop){.signal_fd = -1};
+    signal(SIGPIPE, SIG_IGN); // A reader that went away shows up as EPIPE
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0)
+    {
+        perror("epoll_create1");
+        return -1;
+    }
+    int probe = open_pidfd(getpid());
+    if (probe >= 0)
+    {
+        close(probe);
+        return 0;
+    }
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    loop->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = EVENT_TAG(EVENT_SIGNAL, 0)};
+    if (loop->signal_fd < 0 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->signal_fd, &event) < 0)
+    {
+        perror("signalfd");
+        return -1;
+    }
+    printf("Parent: pidfd_open unavailable, watching children with a signalfd\n");
+    return 0;
+}
+
+// Adds a forked child; its pidfd becomes readable once it exits
+static int event_loop_watch(event_loop *loop, pid_t pid)
+{
+    int index = loop->children++;
+    loop->pids[index] = pid;
+    loop->pidfds[index] = -1;
+    if (loop->signal_fd >= 0)
+    {
+        return 0;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = EVENT_TAG(EVENT_CHILD, index)};
+    loop->pidfds[index] = open_pidfd(pid);
+    if (loop->pidfds[index] < 0 || epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->pidfds[index], &event) < 0)
+    {
+        perror("pidfd_open");
+        return -1;
+    }
+    return 0;
+}
+
+// Collects child index if it has exited; the messages are the old SIGCHLD handler's,
+// now printed outside signal context
+static void event_loop_reap(event_loop *loop, int index)
 {
     int status;
-    pid_t pid;
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    if (loop->pids[index] <= 0 || waitpid(loop->pids[index], &status, WNOHANG) != loop->pids[index])
+    {
+        return;
+    }
+    printf("Parent: Child with PID %d exited, status: %d\n", loop->pids[index], WEXITSTATUS(status));
+    loop->pids[index] = 0;
+    loop->failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    if (loop->pidfds[index] >= 0)
+    {
+        close(loop->pidfds[index]); // Also drops it from the epoll set
+        loop->pidfds[index] = -1;
+    }
+    if (++loop->exited == loop->children)
+    {
+        printf("Parent: Finished, all child processes exited.\n");
+    }
+}
+
+// Stops writing a stream whose reader is gone; the child's exit is reaped as usual
+static void event_loop_drop(event_loop *loop, frame_stream *stream)
+{
+    fprintf(stderr, "Parent: reader of a FIFO went away\n");
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+    close(stream->fd);
+    stream->fd = -1;
+    stream->stage = STREAM_WRITTEN;
+    loop->failed = 1;
+}
+
+// One epoll_wait() round: reaps exited children and pumps every writable stream.
+// Returns the number of streams that completed their batch, or -1 on an error.
+static int event_loop_dispatch(event_loop *loop, frame_stream *streams)
+{
+    struct epoll_event events[EVENT_MAX];
+    int ready = epoll_wait(loop->epoll_fd, events, EVENT_MAX, -1), completed = 0;
+    if (ready < 0)
+    {
+        if (errno == EINTR)
+            return 0;
+        perror("epoll_wait");
+        return -1;
+    }
+    for (int i = 0; i < ready; ++i)
+    {
+        int kind = events[i].data.u64 >> 32, index = (uint32_t)events[i].data.u64;
+        if (kind == EVENT_SIGNAL)
+        {
+            struct signalfd_siginfo info;
+            while (read(loop->signal_fd, &info, sizeof(info)) == sizeof(info))
+                ; // SIGCHLDs coalesce, so every child is checked below
+            for (int child = 0; child < loop->children; ++child)
+            {
+                event_loop_reap(loop, child);
+            }
+        }
+        else if (kind == EVENT_CHILD)
+        {
+            event_loop_reap(loop, index);
+        }
+        else
+        {
+            frame_stream *stream = &streams[index];
+            int status = events[i].events & EPOLLERR ? -1 : frame_stream_pump(stream);
+            if (status < 0)
+            {
+                event_loop_drop(loop, stream);
+                completed++;
+            }
+            else if (status == 1)
+            {
+                epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+                if (!stream->more)
+                {
+                    close(stream->fd);
+                }
+                stream->stage = STREAM_WRITTEN;
+                completed++;
+            }
+        }
+    }
+    return completed;
+}
+
+// Writes the current batch of every stream as its FIFO accepts data, reaping children
+// that exit meanwhile, and closes each FIFO after its last batch
+static int event_loop_flush(event_loop *loop, frame_stream *streams, int count)
+{
+    int remaining = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        struct epoll_event event = {.events = EPOLLOUT, .data.u64 = EVENT_TAG(EVENT_STREAM, i)};
+        if (streams[i].fd < 0)
+        {
+            streams[i].stage = STREAM_WRITTEN; // Dropped earlier
+            continue;
+        }
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, streams[i].fd, &event) < 0)
+        {
+            perror("epoll_ctl");
+            return -1;
+        }
+        remaining++;
+    }
+    while (remaining > 0)
+    {
+        int completed = event_loop_dispatch(loop, streams);
+        if (completed < 0)
+        {
+            return -1;
+        }
+        remaining -= completed;
+    }
+    return 0;
+}
+
+// Runs the loop until every watched child has been reaped
+static int event_loop_wait(event_loop *loop)
+{
+    while (loop->exited < loop->children)
+    {
+        if (event_loop_dispatch(loop, NULL) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void event_loop_close(event_loop *loop)
+{
+    for (int i = 0; i < loop->children; ++i)
+    {
+        if (loop->pidfds[i] >= 0)
+        {
+            close(loop->pidfds[i]);
+        }
+    }
+    if (loop->signal_fd >= 0)
+    {
+        close(loop->signal_fd);
+    }
+    close(loop->epoll_fd);
+}
+
+// Makes at least want bytes available, pulling as many frames as one read() returns
+static int frame_reader_fill(frame_reader *reader, size_t want)
+{
+    if (reader->start + want > sizeof(reader->buffer))
+    {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    while (reader->end - reader->start < want)
+    {
+        size_t got = read_some(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end);
+        if (got == 0)
+        {
+            return 0;
+        }
+        reader->end += got;
+    }
+    return 1;
+}
+
+// Returns 1 with the next frame, 0 at a clean end of stream and -1 on a malformed or
+// truncated frame. The payload points into the reader and is valid until the next call.
+static int frame_next(frame_reader *reader, frame_header *header, const char **payload)
+{
+    if (!frame_reader_fill(reader, sizeof(*header)))
+    {
+        return reader->end == reader->start ? 0 : -1;
+    }
+    memcpy(header, reader->buffer + reader->start, sizeof(*header));
+    if (!frame_valid(header) || !frame_reader_fill(reader, sizeof(*header) + header->length))
+    {
+        return -1;
+    }
+    *payload = reader->buffer + reader->start + sizeof(*header);
+    reader->start += sizeof(*header) + header->length;
+    return 1;
+}
+
+// Sum of values in 64 bits; n below 2^32 cannot overflow it. SSE2 sign-extends
+// four ints at a time into two pairs of 64-bit lanes.
+static int64_t reduce_sum(const int *values, size_t n)
+{
+    int64_t sum = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        __m128i sign = _mm_srai_epi32(v, 31);
+        low = _mm_add_epi64(low, _mm_unpacklo_epi32(v, sign));
+        high = _mm_add_epi64(high, _mm_unpackhi_epi32(v, sign));
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, _mm_add_epi64(low, high));
+    sum = lanes[0] + lanes[1];
+#endif
+    for (; i < n; ++i)
+    {
+        sum += values[i];
+    }
+    return sum;
+}
+
+// Exact sum of any number of values: 64-bit SIMD sums of blocks folded into 128 bits
+static __int128 reduce_sum128(const int *values, size_t n)
+{
+    __int128 sum = 0;
+    for (size_t i = 0; i < n; i += SUM_BLOCK)
+    {
+        sum += reduce_sum(values + i, n - i < SUM_BLOCK ? n - i : SUM_BLOCK);
+    }
+    return sum;
+}
+
+// SSE2 has no 32-bit min/max, so compare and blend with and/andnot/or
+static void reduce_min_max(const int *values, size_t n, int *min_out, int *max_out)
+{
+    int min = INT_MAX, max = INT_MIN;
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i vmin = _mm_set1_epi32(INT_MAX), vmax = _mm_set1_epi32(INT_MIN);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        __m128i less = _mm_cmplt_epi32(v, vmin);
+        __m128i greater = _mm_cmpgt_epi32(v, vmax);
+        vmin = _mm_or_si128(_mm_and_si128(less, v), _mm_andnot_si128(less, vmin));
+        vmax = _mm_or_si128(_mm_and_si128(greater, v), _mm_andnot_si128(greater, vmax));
+    }
+    int lanes_min[4], lanes_max[4];
+    _mm_storeu_si128((__m128i *)lanes_min, vmin);
+    _mm_storeu_si128((__m128i *)lanes_max, vmax);
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        min = lanes_min[lane] < min ? lanes_min[lane] : min;
+        max = lanes_max[lane] > max ? lanes_max[lane] : max;
+    }
+#endif
+    for (; i < n; ++i)
+    {
+        min = values[i] < min ? values[i] : min;
+        max = values[i] > max ? values[i] : max;
+    }
+    *min_out = min;
+    *max_out = max;
+}
+
+// Index of the first zero, or n; SSE2 tests four values per compare
+static size_t reduce_find_zero(const int *values, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, _mm_setzero_si128())));
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < n && values[i] != 0; ++i)
+        ;
+    return i;
+}
+
+// Four interleaved tables break the store-to-load dependency of repeated values
+static void reduce_histogram(const int *values, size_t n, uint64_t *histogram)
+{
+    uint64_t tables[4][HISTOGRAM_BINS + 1] = {{0}};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        for (int t = 0; t < 4; ++t)
+        {
+            unsigned bin = values[i + t];
+            tables[t][bin < HISTOGRAM_BINS ? bin : HISTOGRAM_BINS]++;
+        }
+    }
+    for (; i < n; ++i)
+    {
+        unsigned bin = values[i];
+        tables[0][bin < HISTOGRAM_BINS ? bin : HISTOGRAM_BINS]++;
+    }
+    for (int bin = 0; bin <= HISTOGRAM_BINS; ++bin)
+    {
+        histogram[bin] = tables[0][bin] + tables[1][bin] + tables[2][bin] + tables[3][bin];
+    }
+}
+
+static uint32_t *limbs_alloc(size_t count)
+{
+    uint32_t *limbs = calloc(count ? count : 1, sizeof(uint32_t));
+    if (limbs == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    return limbs;
+}
+
+static size_t limbs_trim(const uint32_t *limbs, size_t length)
+{
+    while (length > 0 && limbs[length - 1] == 0)
+    {
+        length--;
+    }
+    return length;
+}
+
+static int limbs_compare(const uint32_t *a, size_t na, const uint32_t *b, size_t nb)
+{
+    if (na != nb)
+    {
+        return na < nb ? -1 : 1;
+    }
+    while (na-- > 0)
+    {
+        if (a[na] != b[na])
+        {
+            return a[na] < b[na] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// dst[0..dn) += src[0..sn) with dn >= sn; the sum must fit in dn limbs
+static void limbs_add(uint32_t *dst, size_t dn, const uint32_t *src, size_t sn)
+{
+    uint32_t carry = 0;
+    size_t i = 0;
+    for (; i < sn; ++i)
+    {
+        uint32_t t = dst[i] + src[i] + carry;
+        carry = t >= BIGNUM_BASE;
+        dst[i] = carry ? t - BIGNUM_BASE : t;
+    }
+    for (; carry && i < dn; ++i)
+    {
+        carry = dst[i] == BIGNUM_BASE - 1;
+        dst[i] = carry ? 0 : dst[i] + 1;
+    }
+}
+
+// dst[0..dn) -= src[0..sn); src must not exceed dst
+static void limbs_sub(uint32_t *dst, size_t dn, const uint32_t *src, size_t sn)
+{
+    uint32_t borrow = 0;
+    size_t i = 0;
+    for (; i < sn; ++i)
+    {
+        uint32_t s = src[i] + borrow;
+        borrow = dst[i] < s;
+        dst[i] = borrow ? dst[i] + BIGNUM_BASE - s : dst[i] - s;
+    }
+    for (; borrow && i < dn; ++i)
+    {
+        borrow = dst[i] == 0;
+        dst[i] = borrow ? BIGNUM_BASE - 1 : dst[i] - 1;
+    }
+}
+
+// out[0..na+nb) = a * b; out must be zeroed
+static void limbs_mul_schoolbook(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out)
+{
+    for (size_t i = 0; i < na; ++i)
+    {
+        uint64_t carry = 0, digit = a[i];
+        if (digit == 0)
+            continue;
+        for (size_t j = 0; j < nb; ++j)
+        {
+            uint64_t t = out[i + j] + digit * b[j] + carry;
+            out[i + j] = t % BIGNUM_BASE;
+            carry = t / BIGNUM_BASE;
+        }
+        out[i + nb] = carry;
+    }
+}
+
+// out[0..na+nb) = a * b for na >= nb; out must be zeroed. Karatsuba splits operands of
+// similar length; a much longer a is first cut into nb-limb slices.
+static void limbs_mul(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out)
+{
+    if (nb < KARATSUBA_THRESHOLD)
+    {
+        limbs_mul_schoolbook(a, na, b, nb, out);
+        return;
+    }
+    if (na >= 2 * nb)
+    {
+        uint32_t *slice = limbs_alloc(2 * nb);
+        for (size_t offset = 0; offset < na; offset += nb)
+        {
+            size_t n = na - offset < nb ? na - offset : nb;
+            memset(slice, 0, 2 * nb * sizeof(uint32_t));
+            limbs_mul(b, nb, a + offset, n, slice);
+            limbs_add(out + offset, na + nb - offset, slice, n + nb);
+        }
+        free(slice);
+        return;
+    }
+
+    // a = a1 * B^m + a0, b = b1 * B^m + b0 with nb > m:
+    // a * b = z2 * B^2m + (z1 - z2 - z0) * B^m + z0, z1 = (a0 + a1)(b0 + b1)
+    size_t m = na / 2, na1 = na - m, nb1 = nb - m;
+    size_t nsa = na1 + 1, nsb = (m > nb1 ? m : nb1) + 1;
+    uint32_t *sa = limbs_alloc(nsa), *sb = limbs_alloc(nsb);
+    memcpy(sa, a + m, na1 * sizeof(uint32_t));
+    limbs_add(sa, nsa, a, m);
+    if (m >= nb1)
+    {
+        memcpy(sb, b, m * sizeof(uint32_t));
+        limbs_add(sb, nsb, b + m, nb1);
+    }
+    else
+    {
+        memcpy(sb, b + m, nb1 * sizeof(uint32_t));
+        limbs_add(sb, nsb, b, m);
+    }
+    limbs_mul(a, m, b, m, out);                      // z0 into out[0..2m)
+    limbs_mul(a + m, na1, b + m, nb1, out + 2 * m); // z2 into out[2m..na+nb)
+
+    size_t nz1 = nsa + nsb;
+    uint32_t *z1 = limbs_alloc(nz1);
+    size_t la = limbs_trim(sa, nsa), lb = limbs_trim(sb, nsb);
+    if (la >= lb)
+        limbs_mul(sa, la, sb, lb, z1);
+    else
+        limbs_mul(sb, lb, sa, la, z1);
+    limbs_sub(z1, nz1, out, 2 * m);
+    limbs_sub(z1, nz1, out + 2 * m, na1 + nb1);
+    limbs_add(out + m, na + nb - m, z1, limbs_trim(z1, nz1));
+    free(sa);
+    free(sb);
+    free(z1);
+}
+
+static void bignum_free(bignum *number)
+{
+    free(number->limbs);
+    *number = (bignum){0};
+}
+
+static bignum bignum_from_i64(int64_t value)
+{
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    bignum number = {limbs_alloc(3), 0, 3, value < 0};
+    while (magnitude > 0)
+    {
+        number.limbs[number.length++] = magnitude % BIGNUM_BASE;
+        magnitude /= BIGNUM_BASE;
+    }
+    return number;
+}
+
+// 2^127 is below 10^45, so five limbs hold any 128-bit value
+static bignum bignum_from_i128(__int128 value)
+{
+    unsigned __int128 magnitude = value < 0 ? -(unsigned __int128)value : (unsigned __int128)value;
+    bignum number = {limbs_alloc(5), 0, 5, value < 0};
+    while (magnitude > 0)
+    {
+        number.limbs[number.length++] = magnitude % BIGNUM_BASE;
+        magnitude /= BIGNUM_BASE;
+    }
+    return number;
+}
+
+static bignum bignum_mul(const bignum *a, const bignum *b)
+{
+    bignum product = {0};
+    if (a->length == 0 || b->length == 0)
+    {
+        return product;
+    }
+    product.capacity = a->length + b->length;
+    product.limbs = limbs_alloc(product.capacity);
+    if (a->length >= b->length)
+        limbs_mul(a->limbs, a->length, b->limbs, b->length, product.limbs);
+    else
+        limbs_mul(b->limbs, b->length, a->limbs, a->length, product.limbs);
+    product.length = limbs_trim(product.limbs, product.capacity);
+    product.negative = a->negative != b->negative;
+    return product;
+}
+
+// number += value
+static void bignum_add_i128(bignum *number, __int128 value)
+{
+    bignum other = bignum_from_i128(value);
+    size_t n = (number->length > other.length ? number->length : other.length) + 1;
+    if (number->capacity < n)
+    {
+        uint32_t *limbs = limbs_alloc(n);
+        memcpy(limbs, number->limbs, number->length * sizeof(uint32_t));
+        free(number->limbs);
+        number->limbs = limbs;
+        number->capacity = n;
+    }
+    if (number->length == 0 || number->negative == other.negative)
+    {
+        number->negative = other.negative;
+        limbs_add(number->limbs, n, other.limbs, other.length);
+    }
+    else if (limbs_compare(number->limbs, number->length, other.limbs, other.length) >= 0)
+    {
+        limbs_sub(number->limbs, n, other.limbs, other.length);
+    }
+    else
+    { // |value| is larger, so number has at most five limbs
+        uint32_t smaller[5];
+        size_t length = number->length;
+        memcpy(smaller, number->limbs, length * sizeof(uint32_t));
+        memset(number->limbs, 0, n * sizeof(uint32_t));
+        memcpy(number->limbs, other.limbs, other.length * sizeof(uint32_t));
+        limbs_sub(number->limbs, n, smaller, length);
+        number->negative = other.negative;
+    }
+    number->length = limbs_trim(number->limbs, n);
+    number->negative &= number->length > 0;
+    bignum_free(&other);
+}
+
+// Prints the number in full up to BIGNUM_PRINT_DIGITS digits, else its ends and length
+static void bignum_print(const bignum *number)
+{
+    if (number->length == 0)
+    {
+        printf("0");
+        return;
+    }
+    char *text = malloc(number->length * BIGNUM_DIGITS + 1);
+    if (text == NULL)
+    {
+        perror("malloc");
+        return;
+    }
+    int used = sprintf(text, "%u", number->limbs[number->length - 1]);
+    for (size_t i = number->length - 1; i-- > 0;)
+    {
+        used += sprintf(text + used, "%09u", number->limbs[i]);
+    }
+    const char *sign = number->negative ? "-" : "";
+    if (used <= BIGNUM_PRINT_DIGITS)
+        printf("%s%s", sign, text);
+    else
+        printf("%s%.20s...%s (%d digits)", sign, text, text + used - 20, used);
+    free(text);
+}
+
+static void product_init(product_stack *stack)
+{
+    *stack = (product_stack){.leaf = 1};
+}
+
+// Binary-counter product tree: two partial products of the same level are merged,
+// so every multiplication has operands of similar size and Karatsuba pays off
+static void product_push(product_stack *stack, bignum value)
+{
+    int level = 0;
+    while (stack->count > 0 && stack->levels[stack->count - 1] == level)
+    {
+        bignum *top = &stack->items[--stack->count];
+        bignum merged = bignum_mul(top, &value);
+        bignum_free(top);
+        bignum_free(&value);
+        value = merged;
+        level++;
+    }
+    stack->items[stack->count] = value;
+    stack->levels[stack->count++] = level;
+}
+
+// Multiplies values into the stack. Factors are packed into one-limb leaves, and a
+// zero settles the product at once.
+static void product_add_values(product_stack *stack, const int *values, size_t n)
+{
+    if (stack->zero || reduce_find_zero(values, n) < n)
+    {
+        stack->zero = 1;
+        return;
+    }
+    uint64_t leaf = stack->leaf;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t magnitude = values[i] < 0 ? -(int64_t)values[i] : values[i];
+        stack->negative ^= values[i] < 0;
+        if (leaf * magnitude >= BIGNUM_BASE) // Both are below 2^32
+        {
+            product_push(stack, bignum_from_i64(leaf));
+            leaf = magnitude;
+        }
+        else
+        {
+            leaf *= magnitude;
+        }
+    }
+    stack->leaf = leaf;
+}
+
+// Multiplies the remaining partial products, smallest first, and resets the stack
+static bignum product_finish(product_stack *stack)
+{
+    bignum result = {0};
+    if (!stack->zero)
+    {
+        result = bignum_from_i64(stack->leaf);
+        while (stack->count > 0)
+        {
+            bignum *top = &stack->items[--stack->count];
+            bignum merged = bignum_mul(top, &result);
+            bignum_free(top);
+            bignum_free(&result);
+            result = merged;
+        }
+        result.negative = result.negative != stack->negative && result.length > 0;
+    }
+    while (stack->count > 0)
+    {
+        bignum_free(&stack->items[--stack->count]);
+    }
+    product_init(stack);
+    return result;
+}
+
+// Writes a number as its length, sign and limbs; bignum_receive reads it back
+static int bignum_send(int fd, const bignum *number)
+{
+    uint64_t header[2] = {number->length, number->negative};
+    if (write_fully(fd, header, sizeof(header)) < 0 ||
+        write_fully(fd, number->limbs, number->length * sizeof(uint32_t)) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+static int bignum_receive(int fd, bignum *number)
+{
+    uint64_t header[2];
+    if (read_fully(fd, header, sizeof(header)) != sizeof(header))
+    {
+        return -1;
+    }
+    *number = (bignum){limbs_alloc(header[0]), header[0], header[0], (int)header[1]};
+    size_t bytes = header[0] * sizeof(uint32_t);
+    return read_fully(fd, number->limbs, bytes) == bytes ? 0 : -1;
+}
+
+// Decimal text of a 128-bit value; buffer needs 41 bytes
+static const char *format_int128(__int128 value, char *buffer)
+{
+    unsigned __int128 magnitude = value < 0 ? -(unsigned __int128)value : (unsigned __int128)value;
+    char *p = buffer + 40;
+    *p = '\0';
+    do
+    {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+    return p;
+}
+
+// Prints "Final Result: label: value + Sum: sum = total"; value becomes the total
+static void print_final_result(const char *label, bignum *value, __int128 sum)
+{
+    char digits[41];
+    printf("Final Result: %s: ", label);
+    bignum_print(value);
+    printf(" + Sum: %s = ", format_int128(sum, digits));
+    bignum_add_i128(value, sum);
+    bignum_print(value);
+    printf("\n");
+}
+
+// Same pipeline as the FIFO version over three rings: parent -> child 1 (sum),
+// parent -> child 2 (product) and child 1 -> child 2 (the sum). The numbers are streamed
+// from the source a chunk at a time.
+static int run_shm_pipeline(number_source *source)
+{
+    printf("Parent: Creating shared-memory rings\n");
+    shm_ring *rings = shm_rings_create(3);
+    ring_channel to_child1, to_child2, sum_channel;
+    if (rings == NULL || ring_channel_init(&to_child1, &rings[0]) < 0 ||
+        ring_channel_init(&to_child2, &rings[1]) < 0 || ring_channel_init(&sum_channel, &rings[2]) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    static int chunk[STREAM_CHUNK];
+    printf("Parent: Streaming numbers to the rings\n");
+    fflush(stdout); // Children must not inherit buffered output
+
+    event_loop loop;
+    if (event_loop_init(&loop) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid1 = fork();
+    if (pid1 == 0)
+    { // Child Process 1: Calculates sum
+        int batch[RING_BATCH];
+        size_t count;
+        char digits[41];
+        __int128 sum = 0; // Exact however long the stream is
+        while ((count = ring_receive(&to_child1, batch, RING_BATCH)) > 0)
+        {
+            sum += reduce_sum128(batch, count);
+        }
+        printf("Child 1: Sum calculated: %s\n", format_int128(sum, digits));
+        ring_send(&sum_channel, (const int *)&sum, sizeof(sum) / sizeof(int));
+        ring_close(&sum_channel);
+        exit(0);
+    }
+    pid_t pid2 = fork();
+    if (pid2 == 0)
+    { // Child Process 2: Handles multiplication and prints the final result
+        int batch[RING_BATCH];
+        size_t count;
+        char digits[41];
+        __int128 sumFromChild1 = 0;
+        product_stack stack;
+        product_init(&stack);
+        printf("Multiplication is processing...\n");
+        while ((count = ring_receive(&to_child2, batch, RING_BATCH)) > 0)
+        {
+            product_add_values(&stack, batch, count);
+        }
+        if (ring_receive(&sum_channel, (int *)&sumFromChild1, sizeof(sumFromChild1) / sizeof(int)) ==
+            sizeof(sumFromChild1) / sizeof(int))
+        {
+            printf("Child 2: Sum from Child 1 received: %s\n", format_int128(sumFromChild1, digits));
+        }
+        bignum product = product_finish(&stack);
+        print_final_result("Multiplication", &product, sumFromChild1);
+        bignum_free(&product);
+        exit(0);
+    }
+    if (pid1 < 0 || pid2 < 0)
+    {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (event_loop_watch(&loop, pid1) < 0 || event_loop_watch(&loop, pid2) < 0)
+    {
+        return EXIT_FAILURE;
+    }
+
+    // Alternate batches so both children work while the parent writes
+    uint64_t total = 0;
+    size_t count;
+    while ((count = source_next(source, chunk, STREAM_CHUNK)) > 0)
+    {
+        print_stream_numbers(chunk, count, total);
+        total += count;
+        for (size_t i = 0; i < count; i += RING_BATCH)
+        {
+            size_t batch = count - i < RING_BATCH ? count - i : RING_BATCH;
+            ring_send(&to_child1, chunk + i, batch);
+            ring_send(&to_child2, chunk + i, batch);
+        }
+    }
+    ring_close(&to_child1);
+    ring_close(&to_child2);
+    if (total > PRINT_LIMIT)
+    {
+        printf("... (%llu more)", (unsigned long long)(total - PRINT_LIMIT));
+    }
+    printf("\n");
+
+    int waited = event_loop_wait(&loop);
+    event_loop_close(&loop);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = elapsed_seconds(start, end);
+    printf("Parent: %llu elements in %.3f s (%.0f elements/s)%s\n", (unsigned long long)total, seconds,
+           seconds > 0 ? total / seconds : 0, source->error ? " (input error)" : "");
+
+    ring_channel_close(&to_child1);
+    ring_channel_close(&to_child2);
+    ring_channel_close(&sum_channel);
+    munmap(rings, 3 * sizeof(shm_ring));
+    return source->error || waited < 0 || loop.failed ? EXIT_FAILURE : 0;
+}
+
+// One producer, one summing consumer: the raw FIFO moves an int per write()/read() as the
+// first pipeline did, the framed FIFO and the ring move batches. Returns seconds, or -1.
+static double bench_transfer(int transport, const int *array, size_t size, long long *sum_out)
+{
+    int use_shm = transport == TRANSPORT_SHM;
+    int result_pipe[2];
+    shm_ring *ring = NULL;
+    ring_channel channel;
+    if (pipe(result_pipe) < 0)
+    {
+        perror("pipe");
+        return -1;
+    }
+    if (use_shm)
+    {
+        if ((ring = shm_rings_create(1)) == NULL || ring_channel_init(&channel, ring) < 0)
+        {
+            return -1;
+        }
+    }
+    else if (mkfifo(FIFO1, 0666) < 0)
+    {
+        perror("FIFO creation failed");
+        return -1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        long long sum = 0;
+        if (use_shm)
+        {
+            int batch[RING_BATCH];
+            size_t count;
+            while ((count = ring_receive(&channel, batch, RING_BATCH)) > 0)
+            {
+                for (size_t i = 0; i < count; ++i)
+                {
+                    sum += batch[i];
+                }
+            }
+        }
+        else if (transport == TRANSPORT_FRAMED)
+        {
+            static frame_reader reader;
+            frame_header header;
+            const char *payload;
+            reader.fd = open(FIFO1, O_RDONLY);
+            while (frame_next(&reader, &header, &payload) > 0)
+            {
+                if (header.type == FRAME_NUMBERS)
+                {
+                    sum += reduce_sum((const int *)payload, header.length / sizeof(int));
+                }
+            }
+            close(reader.fd);
+        }
+        else
+        {
+            int fifo = open(FIFO1, O_RDONLY), num;
+            while (read(fifo, &num, sizeof(num)) > 0)
+            {
+                sum += num;
+            }
+            close(fifo);
+        }
+        write(result_pipe[1], &sum, sizeof(sum));
+        _exit(0);
+    }
+    if (use_shm)
+    {
+        ring_send(&channel, array, size);
+        ring_close(&channel);
+    }
+    else if (transport == TRANSPORT_FRAMED)
+    {
+        // A blocking FIFO: one pump writes the whole stream
+        frame_stream stream = {.fd = open(FIFO1, O_WRONLY), .exclusive = 1, .numbers = array, .count = size};
+        if (frame_stream_pump(&stream) < 0)
+        {
+            *sum_out = -1;
+        }
+        close(stream.fd);
+    }
+    else
+    {
+        int fifo = open(FIFO1, O_WRONLY);
+        for (size_t i = 0; i < size; ++i)
+        {
+            write(fifo, &array[i], sizeof(array[i]));
+        }
+        close(fifo);
+    }
+    if (read(result_pipe[0], sum_out, sizeof(*sum_out)) != sizeof(*sum_out))
+    {
+        *sum_out = -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    waitpid(pid, NULL, 0);
+
+    close(result_pipe[0]);
+    close(result_pipe[1]);
+    if (use_shm)
+    {
+        ring_channel_close(&channel);
+        munmap(ring, sizeof(shm_ring));
+    }
+    else
+    {
+        unlink(FIFO1);
+    }
+    return elapsed_seconds(start, end);
+}
+
+// Elements/s of every transport for 10^3 .. 10^max_exponent elements
+static int run_benchmark(int max_exponent)
+{
+    size_t max_size = 1;
+    for (int i = 0; i < max_exponent; ++i)
+    {
+        max_size *= 10;
+    }
+    int *array = malloc(max_size * sizeof(int));
+    if (array == NULL)
     {
-        printf("Signal handler: Child with PID %d exited, status: %d\n", pid, WEXITSTATUS(status));
-        child_counter++;
-        printf("Current child counter: %d\n", child_counter); // Debug print
+        perror("malloc");
+        return EXIT_FAILURE;
     }
-    if (child_counter == 2)
+    srand(time(NULL));
+    for (size_t i = 0; i < max_size; ++i)
     {
-        printf("Parent: Finished, all child processes exited.\n");
-        unlink(FIFO1);
-        unlink(FIFO2);
+        array[i] = rand() % 11;
+    }
+
+    printf("%12s %16s %16s %16s %9s %9s\n", "elements", "fifo elem/s", "framed elem/s", "shm elem/s",
+           "framed", "shm");
+    for (size_t size = 1000; size <= max_size; size *= 10)
+    {
+        long long fifo_sum, framed_sum, shm_sum;
+        double fifo_seconds = bench_transfer(TRANSPORT_FIFO, array, size, &fifo_sum);
+        double framed_seconds = bench_transfer(TRANSPORT_FRAMED, array, size, &framed_sum);
+        double shm_seconds = bench_transfer(TRANSPORT_SHM, array, size, &shm_sum);
+        if (fifo_seconds < 0 || framed_seconds < 0 || shm_seconds < 0)
+        {
+            free(array);
+            return EXIT_FAILURE;
+        }
+        printf("%12zu %16.0f %16.0f %16.0f %8.1fx %8.1fx%s\n", size, size / fifo_seconds, size / framed_seconds,
+               size / shm_seconds, fifo_seconds / framed_seconds, fifo_seconds / shm_seconds,
+               fifo_sum == shm_sum && fifo_sum == framed_sum ? "" : "  (sums differ!)");
+    }
+    free(array);
+    return 0;
+}
+
+// Parses "low:high" for the generated values; rand() must be able to cover the range
+static int parse_value_range(const char *text, int *low, int *high)
+{
+    int a, b;
+    if (sscanf(text, "%d:%d", &a, &b) != 2 || a > b || (long long)b - a >= RAND_MAX)
+    {
+        return 0;
+    }
+    *low = a;
+    *high = b;
+    return 1;
+}
+
+// Parses "sum,product,..." into a mask of REDUCE_* bits; 0 if a name is unknown
+static int parse_reductions(const char *spec)
+{
+    char copy[256];
+    int mask = 0;
+    snprintf(copy, sizeof(copy), "%s", spec);
+    for (char *saveptr, *name = strtok_r(copy, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr))
+    {
+        int op = 0;
+        while (op < REDUCE_OPS && strcmp(name, reduce_names[op]) != 0)
+        {
+            op++;
+        }
+        if (op == REDUCE_OPS)
+        {
+            fprintf(stderr, "Unknown reduction '%s'\n", name);
+            return 0;
+        }
+        mask |= 1 << op;
+    }
+    return mask;
+}
+
+// One pass per requested stage over a worker's chunk. The product stops early once
+// any worker, this one included, has found a zero.
+static void reduce_chunk(int ops, const int *values, size_t n, reduce_partial *partial, bignum *product,
+                         _Atomic int *zero_seen)
+{
+    memset(partial, 0, sizeof(*partial));
+    partial->count = n;
+    partial->min = INT_MAX;
+    partial->max = INT_MIN;
+    if (ops & REDUCE_BIT(REDUCE_SUM))
+    {
+        partial->sum = reduce_sum128(values, n);
+    }
+    if (ops & REDUCE_BIT(REDUCE_PRODUCT))
+    {
+        product_stack stack;
+        product_init(&stack);
+        stack.zero = reduce_find_zero(values, n) < n;
+        for (size_t i = 0; i < n && !stack.zero; i += PRODUCT_BLOCK)
+        {
+            stack.zero = atomic_load_explicit(zero_seen, memory_order_relaxed);
+            product_add_values(&stack, values + i, n - i < PRODUCT_BLOCK ? n - i : PRODUCT_BLOCK);
+        }
+        if (stack.zero)
+        {
+            atomic_store_explicit(zero_seen, 1, memory_order_relaxed);
+        }
+        *product = product_finish(&stack);
+    }
+    if (ops & (REDUCE_BIT(REDUCE_MIN) | REDUCE_BIT(REDUCE_MAX)))
+    {
+        reduce_min_max(values, n, &partial->min, &partial->max);
+    }
+    if (ops & REDUCE_BIT(REDUCE_HISTOGRAM))
+    {
+        reduce_histogram(values, n, partial->histogram);
+    }
+}
+
+// Final stage: folds the workers' partials in order and multiplies their products
+// as one more product tree, consuming them
+static void reduce_combine(const reduce_partial *partials, bignum *products, int ops, int workers,
+                           reduce_partial *total, bignum *total_product)
+{
+    product_stack stack;
+    product_init(&stack);
+    memset(total, 0, sizeof(*total));
+    total->min = INT_MAX;
+    total->max = INT_MIN;
+    for (int w = 0; w < workers; ++w)
+    {
+        const reduce_partial *p = &partials[w];
+        total->count += p->count;
+        total->sum += p->sum;
+        if (ops & REDUCE_BIT(REDUCE_PRODUCT))
+        {
+            stack.zero |= products[w].length == 0;
+            product_push(&stack, products[w]);
+            products[w] = (bignum){0};
+        }
+        total->min = p->min < total->min ? p->min : total->min;
+        total->max = p->max > total->max ? p->max : total->max;
+        for (int bin = 0; bin <= HISTOGRAM_BINS; ++bin)
+        {
+            total->histogram[bin] += p->histogram[bin];
+        }
+    }
+    *total_product = product_finish(&stack);
+}
+
+typedef struct
+{
+    int ops;
+    const int *values;
+    size_t n;
+    reduce_partial *partial;
+    bignum *product;
+    _Atomic int *zero_seen;
+} reduce_task;
+
+static void *reduce_thread(void *arg)
+{
+    reduce_task *task = arg;
+    reduce_chunk(task->ops, task->values, task->n, task->partial, task->product, task->zero_seen);
+    return NULL;
+}
+
+// Splits values into one contiguous chunk per worker and reduces the chunks in
+// threads or forked processes. Process workers read values and write their partial
+// and the zero flag through MAP_SHARED memory, so those must come from reduce_alloc;
+// their products come back over a pipe each.
+static int reduce_run(int ops, const int *values, size_t size, int workers, int use_processes,
+                      reduce_partial *partials, _Atomic int *zero_seen, reduce_partial *total,
+                      bignum *total_product)
+{
+    pthread_t threads[REDUCE_MAX_WORKERS];
+    pid_t pids[REDUCE_MAX_WORKERS];
+    int product_pipes[REDUCE_MAX_WORKERS][2];
+    reduce_task tasks[REDUCE_MAX_WORKERS];
+    static bignum products[REDUCE_MAX_WORKERS];
+    int send_products = use_processes && (ops & REDUCE_BIT(REDUCE_PRODUCT));
+    size_t chunk = (size + workers - 1) / workers;
+    int started = 0, failed = 0;
+    atomic_store(zero_seen, 0);
+    for (int w = 0; w < workers; ++w)
+    {
+        size_t begin = w * chunk < size ? w * chunk : size;
+        size_t end = begin + chunk < size ? begin + chunk : size;
+        tasks[w] = (reduce_task){ops, values + begin, end - begin, &partials[w], &products[w], zero_seen};
+        if (use_processes)
+        {
+            if (send_products && pipe(product_pipes[w]) < 0)
+            {
+                perror("pipe");
+                failed = 1;
+                break;
+            }
+            pids[w] = fork();
+            if (pids[w] == 0)
+            {
+                // Only this worker's write end stays open, so a dead worker means EOF
+                // for the parent instead of a read that never returns
+                for (int p = 0; send_products && p <= w; ++p)
+                {
+                    close(product_pipes[p][0]);
+                }
+                reduce_thread(&tasks[w]);
+                _exit(send_products && bignum_send(product_pipes[w][1], &products[w]) < 0 ? EXIT_FAILURE : 0);
+            }
+            if (send_products)
+            {
+                close(product_pipes[w][1]);
+            }
+            if (pids[w] < 0)
+            {
+                perror("fork");
+                if (send_products)
+                {
+                    close(product_pipes[w][0]);
+                }
+                failed = 1;
+                break;
+            }
+        }
+        else if ((errno = pthread_create(&threads[w], NULL, reduce_thread, &tasks[w])) != 0)
+        {
+            perror("pthread_create");
+            failed = 1;
+            break;
+        }
+        started++;
+    }
+    for (int w = 0; w < started; ++w)
+    {
+        int status = 0;
+        if (use_processes)
+        {
+            // Drain the product first: a worker blocks on a full pipe until it is read
+            if (send_products)
+            {
+                failed |= bignum_receive(product_pipes[w][0], &products[w]) < 0;
+                close(product_pipes[w][0]);
+            }
+            while (waitpid(pids[w], &status, 0) < 0 && errno == EINTR)
+                ;
+            failed |= !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+        else
+        {
+            pthread_join(threads[w], NULL);
+        }
+    }
+    if (failed)
+    {
+        for (int w = 0; w < workers; ++w)
+        {
+            bignum_free(&products[w]);
+        }
+        return -1;
+    }
+    reduce_combine(partials, products, ops, workers, total, total_product);
+    return 0;
+}
+
+// Anonymous shared memory, visible to forked workers
+static void *reduce_alloc(size_t size)
+{
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    return memory;
+}
+
+static void print_reduction(int ops, const reduce_partial *total, const bignum *product)
+{
+    char digits[41];
+    if (ops & REDUCE_BIT(REDUCE_SUM))
+    {
+        printf("sum: %s\n", format_int128(total->sum, digits));
+    }
+    if (ops & REDUCE_BIT(REDUCE_PRODUCT))
+    {
+        printf("product: ");
+        bignum_print(product);
+        printf("\n");
+    }
+    if (ops & REDUCE_BIT(REDUCE_MIN))
+    {
+        printf("min: %d\n", total->min);
+    }
+    if (ops & REDUCE_BIT(REDUCE_MAX))
+    {
+        printf("max: %d\n", total->max);
+    }
+    if (ops & REDUCE_BIT(REDUCE_HISTOGRAM))
+    {
+        printf("histogram:");
+        for (int bin = 0; bin < HISTOGRAM_BINS; ++bin)
+        {
+            printf(" %d:%llu", bin, (unsigned long long)total->histogram[bin]);
+        }
+        printf(" other:%llu\n", (unsigned long long)total->histogram[HISTOGRAM_BINS]);
+    }
+}
+
+// Reduction engine: the parent generates values in [low, high], fans them out to the
+// workers and combines their partials. With scaling set, it times 1, 2, 4, ... workers.
+static int run_reduce(int ops, int size, int low_value, int high_value, int workers, int use_processes,
+                      int scaling)
+{
+    int *array = reduce_alloc(size * sizeof(int));
+    reduce_partial *partials = reduce_alloc(REDUCE_MAX_WORKERS * sizeof(reduce_partial));
+    _Atomic int *zero_seen = reduce_alloc(sizeof(*zero_seen));
+    if (array == NULL || partials == NULL || zero_seen == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+    srand(time(NULL));
+    for (int i = 0; i < size; ++i)
+    {
+        array[i] = low_value + rand() % (high_value - low_value + 1);
+    }
+    print_numbers(array, size);
+    printf("\n");
+
+    reduce_partial total;
+    bignum product = {0};
+    int low = scaling ? 1 : workers;
+    if (scaling)
+    {
+        printf("%8s %12s %16s %9s\n", "workers", "ms", "elements/s", "speedup");
+    }
+    double base_seconds = 0;
+    for (int count = low;; count = count * 2 < workers ? count * 2 : workers)
+    {
+        double best = 0;
+        for (int run = 0; run < (scaling ? REDUCE_SCALING_RUNS : 1); ++run)
+        {
+            struct timespec start, end;
+            bignum_free(&product);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (reduce_run(ops, array, size, count, use_processes, partials, zero_seen, &total, &product) < 0)
+            {
+                return EXIT_FAILURE;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            double seconds = elapsed_seconds(start, end);
+            best = run == 0 || seconds < best ? seconds : best;
+        }
+        if (count == low)
+        {
+            base_seconds = best;
+        }
+        if (scaling)
+        {
+            printf("%8d %12.2f %16.0f %8.1fx\n", count, best * 1000, size / best, base_seconds / best);
+        }
+        else
+        {
+            printf("Reduce: %d elements, %d %s, %.2f ms (%.0f elements/s)\n", size, count,
+                   use_processes ? "processes" : "threads", best * 1000, size / best);
+        }
+        if (count == workers)
+            break;
     }
+    print_reduction(ops, &total, &product);
+
+    bignum_free(&product);
+    munmap(array, size * sizeof(int));
+    munmap(partials, REDUCE_MAX_WORKERS * sizeof(reduce_partial));
+    munmap(zero_seen, sizeof(*zero_seen));
+    return 0;
 }
 
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-t fifo|shm] [-c multiply|min|max] <number of elements in array>\n", program);
+    fprintf(stderr, "       %s [-t fifo|shm] [-c multiply|min|max] -i file|-   (stream whitespace-separated ints)\n",
+            program);
+    fprintf(stderr, "       %s -b [max exponent]   (compare transports up to 10^max elements)\n", program);
+    fprintf(stderr, "       %s -r sum,product,min,max,histogram [-w workers] [-m thread|process] [-v low:high] [-b]"
+            " <elements>\n", program);
+    fprintf(stderr, "          (reduction engine over values in [low, high], 0:10 by default;"
+            " -b times 1, 2, 4, ... workers)\n");
+}
+
+static int run_fifo_pipeline(number_source *source, const char *command);
+
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    int use_shm = 0, benchmark = 0, option;
+    const char *command = DEFAULT_COMMAND; // Sent to Child 2 in FIFO mode
+    int reductions = 0, workers = sysconf(_SC_NPROCESSORS_ONLN), use_processes = 0;
+    const char *range = "0:10"; // Values generated for the reduction engine
+    const char *input = NULL;   // Pipeline input file, "-" for stdin; generated if NULL
+    while ((option = getopt(argc, argv, "t:bc:r:w:m:v:i:")) != -1)
+    {
+        if (option == 't' && (strcmp(optarg, "fifo") == 0 || strcmp(optarg, "shm") == 0))
+        {
+            use_shm = strcmp(optarg, "shm") == 0;
+        }
+        else if (option == 'b')
+        {
+            benchmark = 1;
+        }
+        else if (option == 'c' && optarg[0] != '\0' && strlen(optarg) < COMMAND_MAX)
+        {
+            command = optarg; // Child 2 decides whether it knows the command
+        }
+        else if (option == 'r' && parse_reductions(optarg) != 0)
+        {
+            reductions = parse_reductions(optarg);
+        }
+        else if (option == 'w' && atoi(optarg) > 0 && atoi(optarg) <= REDUCE_MAX_WORKERS)
+        {
+            workers = atoi(optarg);
+        }
+        else if (option == 'm' && (strcmp(optarg, "thread") == 0 || strcmp(optarg, "process") == 0))
+        {
+            use_processes = strcmp(optarg, "process") == 0;
+        }
+        else if (option == 'v')
+        {
+            range = optarg;
+        }
+        else if (option == 'i')
+        {
+            input = optarg;
+        }
+        else
+        {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (workers < 1 || workers > REDUCE_MAX_WORKERS)
+    {
+        workers = workers < 1 ? 1 : REDUCE_MAX_WORKERS;
+    }
+    if (reductions != 0)
     {
-        fprintf(stderr, "Usage: %s <number of elements in array>\n", argv[0]);
+        int low_value, high_value;
+        if (argc - optind != 1 || atoi(argv[optind]) <= 0 || !parse_value_range(range, &low_value, &high_value))
+        {
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        return run_reduce(reductions, atoi(argv[optind]), low_value, high_value, workers, use_processes, benchmark);
+    }
+    if (benchmark)
+    {
+        return run_benchmark(optind < argc ? atoi(argv[optind]) : BENCH_DEFAULT_EXPONENT);
+    }
+    if (input != NULL ? argc != optind : argc - optind != 1 || atoi(argv[optind]) <= 0)
+    {
+        usage(argv[0]);
         exit(EXIT_FAILURE);
     }
-
-    printf("Parent: Setting up signal handling\n");
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = sigchld_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
-    if (sigaction(SIGCHLD, &sa, NULL) == -1)
+    static number_source source;
+    if (source_open(&source, input, input != NULL ? 0 : atoi(argv[optind])) < 0) // Array size from command line
     {
-        perror("sigaction");
         exit(EXIT_FAILURE);
     }
 
+    int status = use_shm ? run_shm_pipeline(&source) : run_fifo_pipeline(&source, command);
+    source_close(&source);
+    return status;
+}
+
+// Child 2's commands: each reduces the numbers to one value that is added to the sum
+static const char *const command_names[] = {"multiply", "min", "max"};
+static const char *const command_labels[] = {"Multiplication", "Minimum", "Maximum"};
+
+static int find_command(const char *command)
+{
+    for (size_t i = 0; i < sizeof(command_names) / sizeof(command_names[0]); ++i)
+    {
+        if (strcmp(command, command_names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// FIFO pipeline without sleeps. Readers open their FIFO first (non-blocking) and say so
+// on the ready pipe; only then does the parent open the write ends, so no open() waits.
+// Every message is a typed frame, so Child 1's sum can arrive on FIFO2 at any point.
+// The numbers go out a chunk at a time as the source produces them, written as the epoll
+// loop reports the FIFOs writable; the same loop reaps the children through their pidfds.
+static int run_fifo_pipeline(number_source *source, const char *command)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     printf("Parent: Creating FIFOs\n");
     if (mkfifo(FIFO1, 0666) < 0 || mkfifo(FIFO2, 0666) < 0)
     {
         perror("FIFO creation failed");
         exit(EXIT_FAILURE);
     }
+    int ready_pipe[2], go_pipe[2];
+    if (pipe(ready_pipe) < 0 || pipe(go_pipe) < 0)
+    {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
 
-    int size = atoi(argv[1]); // Array size from command line
-    int *array = malloc(size * sizeof(int));
-    srand(time(NULL));
+    event_loop loop;
+    if (event_loop_init(&loop) < 0)
+    {
+        exit(EXIT_FAILURE);
+    }
+    static int chunk[STREAM_CHUNK];
+    fflush(stdout); // Children must not inherit buffered output
 
     pid_t pid1 = fork();
     if (pid1 == 0)
-    {              // Child Process 1: Calculates sum
-        sleep(10); // Sleep for 10 seconds
-        int fifo1 = open(FIFO1, O_RDONLY);
-        int sum = 0, num;
-        printf("Child 1: Reading numbers from FIFO1\n");
-        while (read(fifo1, &num, sizeof(num)) > 0)
-        {
+    { // Child Process 1: Calculates sum
+        static frame_reader reader;
+        reader.fd = open_fifo(FIFO1, O_RDONLY);
+        if (reader.fd < 0)
+            exit(EXIT_FAILURE);
+        write(ready_pipe[1], &(char){READY_CHILD1}, 1);
 
-            sum += num;
+        // FIFO2 can only be opened for writing once Child 2 holds its read end
+        char go;
+        if (read_fully(go_pipe[0], &go, 1) != 1 || go != MESSAGE_GO)
+        {
+            fprintf(stderr, "Child 1: no go from parent\n");
+            exit(EXIT_FAILURE);
         }
-
-        printf("Child 1: Sum calculated: %d\n", sum);
-        close(fifo1);
-
-        int fifo2_child1 = open(FIFO2, O_WRONLY);
+        int fifo2_child1 = open_fifo(FIFO2, O_WRONLY);
         if (fifo2_child1 < 0)
         {
-            perror("open FIFO2 for Child 1");
             exit(EXIT_FAILURE);
         }
-        ssize_t bytes_written = write(fifo2_child1, &sum, sizeof(sum));
-        if (bytes_written < 0)
+        write(ready_pipe[1], &(char){MESSAGE_WRITER_OPEN}, 1);
+
+        printf("Child 1: Reading numbers from FIFO1\n");
+        frame_header header;
+        const char *payload;
+        uint64_t received = 0, announced = UINT64_MAX;
+        __int128 sum = 0; // Exact however long the stream is
+        char digits[41];
+        int status;
+        while ((status = frame_next(&reader, &header, &payload)) > 0)
         {
-            perror("Failed to write sum to FIFO2");
+            if (header.type == FRAME_NUMBERS)
+            {
+                sum += reduce_sum128((const int *)payload, header.length / sizeof(int));
+                received += header.length / sizeof(int);
+            }
+            else if (header.type == FRAME_END)
+            {
+                memcpy(&announced, payload, sizeof(announced));
+            }
+        }
+        close(reader.fd);
+        if (status < 0 || received != announced)
+        {
+            fprintf(stderr, "Child 1: Malformed or incomplete frames on FIFO1\n");
             exit(EXIT_FAILURE);
         }
-        else
+        printf("Child 1: Sum calculated: %s\n", format_int128(sum, digits));
+
+        if (frame_write(fifo2_child1, FRAME_SUM, &sum, sizeof(sum)) < 0)
         {
-            printf("Child 1: Successfully wrote sum %d to FIFO2\n", sum);
+            perror("Failed to write sum to FIFO2");
+            exit(EXIT_FAILURE);
         }
+        printf("Child 1: Successfully wrote sum %s to FIFO2\n", format_int128(sum, digits));
         close(fifo2_child1);
         exit(0);
     }
-    sleep(12);
     pid_t pid2 = fork();
-    // Child Process 2: Handles multiplication and prints the final result
+    // Child Process 2: Applies the command and prints the final result
     if (pid2 == 0)
     {
-        sleep(10);
-        int fifo2_child2 = open(FIFO2, O_RDONLY);
-        int num, product = 1;
-        int numbers[atoi(argv[1])]; // Array to store numbers if needed
-        int count = 0;
-
-        while (count < atoi(argv[1]) && read(fifo2_child2, &numbers[count], sizeof(int)) > 0)
-        {
-
-            count++;
-        }
-        // Read the command
-        char command[20] = "multiply";
-        /*
-        read(fifo2_child2, command, sizeof(command) - 1);
-        command[sizeof(command) - 1] = '\0';  // Ensure null termination
-        */
-        printf("Child 2: Command received: %s\n", command);
+        static frame_reader reader;
+        reader.fd = open_fifo(FIFO2, O_RDONLY);
+        if (reader.fd < 0)
+            exit(EXIT_FAILURE);
+        write(ready_pipe[1], &(char){READY_CHILD2}, 1);
 
-        if (strcmp(command, "multiply") == 0)
+        // Frames from the parent and Child 1 interleave; reduce the numbers as they come
+        frame_header header;
+        const char *payload;
+        char received_command[COMMAND_MAX + 1] = "";
+        uint64_t count = 0, announced = UINT64_MAX;
+        product_stack product;
+        product_init(&product);
+        int minimum = INT_MAX, maximum = INT_MIN;
+        __int128 sumFromChild1 = 0;
+        char digits[41];
+        int have_sum = 0, status, command_index = -1;
+        while ((status = frame_next(&reader, &header, &payload)) > 0)
         {
-            // Perform multiplication if the command is correct
-            printf("Multiplication is processing...\n");
-            for (int i = 0; i < count; i++)
+            const int *numbers = (const int *)payload;
+            size_t n = header.length / sizeof(int);
+            int low, high;
+            switch (header.type)
             {
-                product *= numbers[i];
+            case FRAME_NUMBERS: // The command comes first; without one, keep every reduction
+                if (command_index <= 0)
+                {
+                    product_add_values(&product, numbers, n);
+                }
+                if (command_index != 0)
+                {
+                    reduce_min_max(numbers, n, &low, &high);
+                    minimum = low < minimum ? low : minimum;
+                    maximum = high > maximum ? high : maximum;
+                }
+                count += n;
+                break;
+            case FRAME_END:
+                memcpy(&announced, payload, sizeof(announced));
+                break;
+            case FRAME_COMMAND:
+                memcpy(received_command, payload, header.length);
+                received_command[header.length] = '\0';
+                printf("Child 2: Command received: %s\n", received_command);
+                command_index = find_command(received_command);
+                break;
+            case FRAME_SUM:
+                memcpy(&sumFromChild1, payload, sizeof(sumFromChild1));
+                have_sum = 1;
+                break;
             }
+        }
+        close(reader.fd);
 
-            // Read the sum from Child Process 1 after validating the command
-            int sumFromChild1;
-            read(fifo2_child2, &sumFromChild1, sizeof(sumFromChild1));
-            printf("Child 2: Sum from Child 1 received: %d\n", sumFromChild1);
-
-            // Compute the final result
-            int finalResult = product + sumFromChild1;
-            printf("Final Result: Multiplication: %d + Sum: %d = %d\n", product, sumFromChild1, finalResult);
+        if (status < 0 || count != announced)
+        {
+            printf("Child 2: Malformed or incomplete frames on FIFO2.\n");
         }
-        else
+        else if (command_index < 0)
         {
             printf("Child 2: Unexpected or no command received.\n");
         }
+        else if (!have_sum)
+        {
+            printf("Child 2: No sum received from Child 1.\n");
+            exit(EXIT_FAILURE);
+        }
+        else
+        {
+            if (command_index == 0)
+            {
+                printf("Multiplication is processing...\n");
+            }
+            printf("Child 2: Sum from Child 1 received: %s\n", format_int128(sumFromChild1, digits));
 
-        close(fifo2_child2);
-
+            // Compute the final result exactly
+            bignum result = command_index == 0 ? product_finish(&product)
+                                               : bignum_from_i64(command_index == 1 ? minimum : maximum);
+            print_final_result(command_labels[command_index], &result, sumFromChild1);
+            bignum_free(&result);
+        }
         exit(0);
     }
-
-    // Parent process writes to FIFO1 and FIFO2
-    int fifo1_parent = open(FIFO1, O_WRONLY);
-    int fifo2_parent = open(FIFO2, O_WRONLY);
-
-    printf("Parent: Generating and storing numbers\n");
-    for (int i = 0; i < size; ++i)
+    if (pid1 < 0 || pid2 < 0)
     {
-        array[i] = rand() % 11; // Random numbers between 0 and 10
-        printf("%d ", array[i]);
+        perror("fork");
+        exit(EXIT_FAILURE);
     }
-    printf("\nParent: Writing numbers to FIFO1 and FIFO2\n");
-    for (int i = 0; i < size; ++i)
+    if (event_loop_watch(&loop, pid1) < 0 || event_loop_watch(&loop, pid2) < 0)
     {
-        write(fifo1_parent, &array[i], sizeof(array[i]));
-        write(fifo2_parent, &array[i], sizeof(array[i]));
+        exit(EXIT_FAILURE);
     }
-    // Sending sum from Child 1 to Child 2, then the command
-    int sumFromChild1 = 0; // Placeholder for sum from Child 1, assuming received somehow
-
-    close(fifo1_parent);
 
-    // Wait before writing the command to ensure Child 1 has written the sum
-    sleep(10); // Adjust based on expected time for Child 1 to finish
-
-    // In the parent process, right after writing numbers to FIFO2
-    int sentinel = -1;
-    write(fifo2_parent, &sentinel, sizeof(sentinel));
+    // Both readers must be in place before the write ends can be opened without blocking
+    for (int readers = 0; readers < 2; readers++)
+    {
+        char message = wait_handshake(ready_pipe[0]);
+        if (message != READY_CHILD1 && message != READY_CHILD2)
+        {
+            fprintf(stderr, "Parent: children did not open the FIFOs\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Child 1 joins FIFO2 as a writer before the parent can close its end, so Child 2
+    // never sees end of file before the sum
+    write(go_pipe[1], &(char){MESSAGE_GO}, 1);
+    if (wait_handshake(ready_pipe[0]) != MESSAGE_WRITER_OPEN)
+    {
+        fprintf(stderr, "Parent: Child 1 did not open FIFO2\n");
+        exit(EXIT_FAILURE);
+    }
+    double handshake_ms = milliseconds_since(start);
+    int fifo1_parent = open(FIFO1, O_WRONLY | O_NONBLOCK);
+    int fifo2_parent = open(FIFO2, O_WRONLY | O_NONBLOCK);
+    if (fifo1_parent < 0 || fifo2_parent < 0)
+    {
+        perror("open FIFO for writing");
+        exit(EXIT_FAILURE);
+    }
 
-    // Now write the command
+    // FIFO1 is the parent's alone, so its frames go out in batches; FIFO2 is shared with
+    // Child 1, so each of its frames is one atomic write. The final empty batch carries
+    // END, and on FIFO2 the command, then closes the FIFOs.
+    printf("Parent: Streaming numbers to FIFO1 and FIFO2\n");
     printf("Parent: Writing command to FIFO2\n");
-    char *command = "multiply";
-    write(fifo2_parent, command, strlen(command) + 1);
+    fflush(stdout);
+    frame_stream streams[2] = {
+        {.fd = fifo1_parent, .exclusive = 1},
+        {.fd = fifo2_parent, .command = command},
+    };
+    uint64_t total = 0;
+    size_t count;
+    while ((count = source_next(source, chunk, STREAM_CHUNK)) > 0 || !source->error)
+    {
+        print_stream_numbers(chunk, count, total);
+        total += count;
+        frame_stream_batch(&streams[0], chunk, count, count > 0);
+        frame_stream_batch(&streams[1], chunk, count, count > 0);
+        if (event_loop_flush(&loop, streams, 2) < 0)
+        {
+            exit(EXIT_FAILURE);
+        }
+        if (count == 0)
+            break;
+    }
+    if (source->error)
+    { // Without END frames the children report an incomplete stream
+        for (int i = 0; i < 2; ++i)
+        {
+            if (streams[i].fd >= 0)
+                close(streams[i].fd);
+        }
+    }
+    if (total > PRINT_LIMIT)
+    {
+        printf("... (%llu more)", (unsigned long long)(total - PRINT_LIMIT));
+    }
+    printf("\nParent: Sent %llu numbers%s\n", (unsigned long long)total, source->error ? " (input error)" : "");
+    double written_ms = milliseconds_since(start);
 
-    close(fifo2_parent);
+    int waited = event_loop_wait(&loop);
+    event_loop_close(&loop);
+    double total_ms = milliseconds_since(start);
+    printf("Parent: Timing: handshake %.2f ms, numbers written %.2f ms, finished %.2f ms\n",
+           handshake_ms, written_ms, total_ms);
+    printf("Parent: The sleep-based version waited %d s before finishing\n", OLD_SLEEP_SECONDS);
 
     // Cleanup
     unlink(FIFO1);
     unlink(FIFO2);
-    free(array);
 
-    return 0;
+    return source->error || waited < 0 || loop.failed ? EXIT_FAILURE : 0;
 }
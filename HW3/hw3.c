@@ -1,87 +1,367 @@
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <string.h>
+#include <time.h>
 
 #define MAX_AUTOMOBILES 8
 #define MAX_PICKUPS 4
 #define NUM_CAR_OWNERS 45 // Adjust this to simulate more arrivals
+#define VEHICLE_TYPES 2
 
-sem_t newAutomobile, inChargeforAutomobile;
-sem_t newPickup, inChargeforPickup;
-sem_t entryMutex;
-pthread_mutex_t mutexParking;
+// Contention benchmark: parking attempts per run, split across the owner threads
+#define BENCH_ATTEMPTS 2000000
+#define BENCH_DEFAULT_THREADS 512
 
-int free_auto = 1; // Temporary spots for automobiles
-int free_pickup = 1;     // Temporary spots for pickups
-int mFree_automobile = 0;
-int mFree_pickup = 0;
+// Discrete-event simulation of the same model; times are virtual microseconds
+#define SIM_MAX_WORKERS 64
+#define SIM_DEFAULT_SECONDS 20     // The threaded model's alarm
+#define SIM_DEFAULT_ARRIVAL_MS 500 // Mean of usleep(rand() % 1000000)
+#define SIM_DEFAULT_DEPARTURE_MS 2000
+
+// Metrics: wait times go into power-of-two microsecond buckets
+#define WAIT_BUCKETS 40
+#define DEFAULT_SAMPLE_MS 1000 // Occupancy sampling interval
+
+typedef struct {
+    unsigned long long arrivals, parked, leftFull, leftNoTemporary, departures;
+    int waitingOwners; // Still blocked on inChargefor* when the clock ran out
+} SimTotals;
+
+// One thread's metrics; nothing in it is shared, so recording needs no synchronization.
+// The buffers are merged once the threads are done.
+typedef struct {
+    SimTotals totals;
+    unsigned long long waitHistogram[WAIT_BUCKETS]; // Owner arrival -> inChargefor* post
+    unsigned long long waits;
+    long long waitTotal, waitMax;
+    unsigned long long semaphoreWaits; // Any sem_wait() that had to block
+    long long semaphoreWaitTotal;
+    long long busy[VEHICLE_TYPES]; // Attendant time spent moving vehicles
+} Metrics;
+
+typedef struct {
+    long long time;
+    int permanent[VEHICLE_TYPES], temporary[VEHICLE_TYPES]; // Occupied spots
+} OccupancySample;
+
+typedef struct {
+    OccupancySample* samples;
+    size_t count, capacity;
+} OccupancySeries;
+
+typedef enum { FORMAT_CSV, FORMAT_JSON } MetricsFormat;
+
+// Metric options shared by both models
+typedef struct {
+    const char* path; // Export file, "-" for stdout; NULL to print the summary only
+    MetricsFormat format;
+    long long sampleInterval; // Microseconds between occupancy samples
+    int quiet;                // No per-vehicle lines, only metrics
+} MetricsOptions;
+
+// Everything the exporters need besides the merged metrics
+typedef struct {
+    const char* model;
+    long long elapsed; // Microseconds of model time the metrics cover
+    long long attendants[VEHICLE_TYPES];
+    const OccupancySeries* occupancy;
+} MetricsContext;
+
+const char* const vehicleNames[VEHICLE_TYPES] = {"Automobile", "Pickup"};
+const char* const vehicleSpotNames[VEHICLE_TYPES] = {"automobile", "pickup"};
+
+long long nowMicros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+void recordWait(Metrics* metrics, long long wait) {
+    int bucket = wait > 1 ? 63 - __builtin_clzll(wait) : 0;
+    metrics->waitHistogram[bucket < WAIT_BUCKETS ? bucket : WAIT_BUCKETS - 1]++;
+    metrics->waits++;
+    metrics->waitTotal += wait;
+    metrics->waitMax = wait > metrics->waitMax ? wait : metrics->waitMax;
+}
+
+void recordSemaphoreWait(Metrics* metrics, long long wait) {
+    metrics->semaphoreWaits++;
+    metrics->semaphoreWaitTotal += wait;
+}
+
+void addTotals(SimTotals* sum, const SimTotals* totals) {
+    sum->arrivals += totals->arrivals;
+    sum->parked += totals->parked;
+    sum->leftFull += totals->leftFull;
+    sum->leftNoTemporary += totals->leftNoTemporary;
+    sum->departures += totals->departures;
+    sum->waitingOwners += totals->waitingOwners;
+}
+
+void mergeMetrics(Metrics* sum, const Metrics* metrics) {
+    addTotals(&sum->totals, &metrics->totals);
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        sum->waitHistogram[i] += metrics->waitHistogram[i];
+    }
+    sum->waits += metrics->waits;
+    sum->waitTotal += metrics->waitTotal;
+    sum->waitMax = metrics->waitMax > sum->waitMax ? metrics->waitMax : sum->waitMax;
+    sum->semaphoreWaits += metrics->semaphoreWaits;
+    sum->semaphoreWaitTotal += metrics->semaphoreWaitTotal;
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        sum->busy[type] += metrics->busy[type];
+    }
+}
+
+int recordOccupancy(OccupancySeries* series, const OccupancySample* sample) {
+    if (series->count == series->capacity) {
+        size_t capacity = series->capacity ? series->capacity * 2 : 256;
+        OccupancySample* samples = realloc(series->samples, capacity * sizeof(OccupancySample));
+        if (samples == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        series->samples = samples;
+        series->capacity = capacity;
+    }
+    series->samples[series->count++] = *sample;
+    return 0;
+}
+
+// Upper bound in microseconds of the bucket holding the given fraction of the waits,
+// capped at the longest wait seen so a coarse bucket never reports more than happened
+long long waitPercentile(const Metrics* metrics, double fraction) {
+    unsigned long long seen = 0;
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        seen += metrics->waitHistogram[i];
+        if (metrics->waits > 0 && seen >= fraction * metrics->waits) {
+            return (2LL << i) < metrics->waitMax ? 2LL << i : metrics->waitMax;
+        }
+    }
+    return 0;
+}
+
+double rejectionRate(const SimTotals* totals) {
+    unsigned long long left = totals->leftFull + totals->leftNoTemporary;
+    return totals->arrivals > 0 ? (double)left / totals->arrivals : 0;
+}
+
+double utilization(const Metrics* metrics, const MetricsContext* context, int type) {
+    long long capacity = context->attendants[type] * context->elapsed;
+    return capacity > 0 ? (double)metrics->busy[type] / capacity : 0;
+}
+
+void printMetricsSummary(const Metrics* metrics, const MetricsContext* context) {
+    printf("Owner wait: %llu waits, mean %.3f ms, p50 <= %.3f ms, p99 <= %.3f ms, max %.3f ms\n", metrics->waits,
+           metrics->waits > 0 ? metrics->waitTotal / 1e3 / metrics->waits : 0, waitPercentile(metrics, 0.5) / 1e3,
+           waitPercentile(metrics, 0.99) / 1e3, metrics->waitMax / 1e3);
+    printf("Semaphore wait: %llu blocking waits, mean %.3f ms\n", metrics->semaphoreWaits,
+           metrics->semaphoreWaits > 0 ? metrics->semaphoreWaitTotal / 1e3 / metrics->semaphoreWaits : 0);
+    printf("Attendant utilization: automobile %.1f%%, pickup %.1f%%\n", 100 * utilization(metrics, context, 0),
+           100 * utilization(metrics, context, 1));
+    printf("Rejection rate: %.1f%% (%llu of %llu arrivals)\n", 100 * rejectionRate(&metrics->totals),
+           metrics->totals.leftFull + metrics->totals.leftNoTemporary, metrics->totals.arrivals);
+}
+
+// Long format: one metric,key,value row per number
+void writeMetricsCsv(FILE* out, const Metrics* metrics, const MetricsContext* context) {
+    const SimTotals* totals = &metrics->totals;
+    fprintf(out, "metric,key,value\n");
+    fprintf(out, "summary,model,%s\n", context->model);
+    fprintf(out, "summary,elapsed_s,%.6f\n", context->elapsed / 1e6);
+    fprintf(out, "summary,arrivals,%llu\nsummary,parked,%llu\nsummary,departures,%llu\n", totals->arrivals,
+            totals->parked, totals->departures);
+    fprintf(out, "summary,left_full,%llu\nsummary,left_no_temporary,%llu\nsummary,still_waiting,%d\n",
+            totals->leftFull, totals->leftNoTemporary, totals->waitingOwners);
+    fprintf(out, "summary,rejection_rate,%.6f\n", rejectionRate(totals));
+    fprintf(out, "summary,owner_waits,%llu\nsummary,owner_wait_mean_us,%.3f\nsummary,owner_wait_max_us,%lld\n",
+            metrics->waits, metrics->waits > 0 ? (double)metrics->waitTotal / metrics->waits : 0, metrics->waitMax);
+    fprintf(out, "summary,semaphore_waits,%llu\nsummary,semaphore_wait_mean_us,%.3f\n", metrics->semaphoreWaits,
+            metrics->semaphoreWaits > 0 ? (double)metrics->semaphoreWaitTotal / metrics->semaphoreWaits : 0);
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        fprintf(out, "attendant_utilization,%s,%.6f\n", vehicleSpotNames[type], utilization(metrics, context, type));
+    }
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        if (metrics->waitHistogram[i] > 0) {
+            fprintf(out, "owner_wait_us,%lld,%llu\n", i == 0 ? 0 : 1LL << i, metrics->waitHistogram[i]);
+        }
+    }
+    for (size_t i = 0; i < context->occupancy->count; i++) {
+        const OccupancySample* sample = &context->occupancy->samples[i];
+        for (int type = 0; type < VEHICLE_TYPES; type++) {
+            fprintf(out, "occupancy_permanent_%s,%.6f,%d\n", vehicleSpotNames[type], sample->time / 1e6,
+                    sample->permanent[type]);
+            fprintf(out, "occupancy_temporary_%s,%.6f,%d\n", vehicleSpotNames[type], sample->time / 1e6,
+                    sample->temporary[type]);
+        }
+    }
+}
+
+void writeMetricsJson(FILE* out, const Metrics* metrics, const MetricsContext* context) {
+    const SimTotals* totals = &metrics->totals;
+    fprintf(out, "{\n  \"model\": \"%s\",\n  \"elapsed_s\": %.6f,\n", context->model, context->elapsed / 1e6);
+    fprintf(out, "  \"arrivals\": %llu,\n  \"parked\": %llu,\n  \"departures\": %llu,\n", totals->arrivals,
+            totals->parked, totals->departures);
+    fprintf(out, "  \"left_full\": %llu,\n  \"left_no_temporary\": %llu,\n  \"still_waiting\": %d,\n",
+            totals->leftFull, totals->leftNoTemporary, totals->waitingOwners);
+    fprintf(out, "  \"rejection_rate\": %.6f,\n", rejectionRate(totals));
+    fprintf(out, "  \"owner_wait_us\": {\"count\": %llu, \"mean\": %.3f, \"max\": %lld, \"histogram\": [",
+            metrics->waits, metrics->waits > 0 ? (double)metrics->waitTotal / metrics->waits : 0, metrics->waitMax);
+    const char* separator = "";
+    for (int i = 0; i < WAIT_BUCKETS; i++) {
+        if (metrics->waitHistogram[i] > 0) {
+            fprintf(out, "%s\n    {\"from\": %lld, \"to\": %lld, \"count\": %llu}", separator, i == 0 ? 0 : 1LL << i,
+                    2LL << i, metrics->waitHistogram[i]);
+            separator = ",";
+        }
+    }
+    fprintf(out, "\n  ]},\n  \"semaphore_wait_us\": {\"count\": %llu, \"mean\": %.3f},\n", metrics->semaphoreWaits,
+            metrics->semaphoreWaits > 0 ? (double)metrics->semaphoreWaitTotal / metrics->semaphoreWaits : 0);
+    fprintf(out, "  \"attendant_utilization\": {\"automobile\": %.6f, \"pickup\": %.6f},\n",
+            utilization(metrics, context, 0), utilization(metrics, context, 1));
+    fprintf(out, "  \"occupancy\": [");
+    for (size_t i = 0; i < context->occupancy->count; i++) {
+        const OccupancySample* sample = &context->occupancy->samples[i];
+        fprintf(out, "%s\n    {\"time_s\": %.6f, \"permanent\": [%d, %d], \"temporary\": [%d, %d]}", i ? "," : "",
+                sample->time / 1e6, sample->permanent[0], sample->permanent[1], sample->temporary[0],
+                sample->temporary[1]);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// Writes the metrics to path ("-" for stdout) and prints the summary
+int exportMetrics(const char* path, MetricsFormat format, const Metrics* metrics, const MetricsContext* context) {
+    printMetricsSummary(metrics, context);
+    if (path == NULL) {
+        return 0;
+    }
+    FILE* out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (out == NULL) {
+        perror(path);
+        return -1;
+    }
+    if (format == FORMAT_JSON) {
+        writeMetricsJson(out, metrics, context);
+    } else {
+        writeMetricsCsv(out, metrics, context);
+    }
+    if (out != stdout && fclose(out) != 0) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+// One lot per vehicle type. The counters are atomics and spots are reserved with
+// compare-and-swap, so automobiles and pickups never wait on each other and no global
+// lock serializes the owners.
+typedef struct {
+    _Alignas(64) atomic_int freeTemporary; // free_auto / free_pickup
+    atomic_int permanent;                  // mFree_automobile / mFree_pickup
+    int maxPermanent;
+    sem_t newVehicle; // newAutomobile / newPickup
+    sem_t inCharge;   // inChargeforAutomobile / inChargeforPickup
+} ParkingLot;
+
+ParkingLot lots[VEHICLE_TYPES];
 volatile int terminate = 0; // Using volatile for visibility across threads
+int quiet = 0;              // Set by -q: the threads print nothing per vehicle
+
+// Each model thread records into its own metrics
+typedef struct {
+    _Alignas(64) int vehicleType;
+    Metrics metrics;
+} ModelThread;
+
+// printf() for the per-vehicle lines, skipped in quiet mode
+void report(const char* format, ...) {
+    if (quiet) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
+
+// sem_wait() that records how long it blocked, if it had to
+void timedWait(sem_t* sem, Metrics* metrics) {
+    if (sem_trywait(sem) == 0) {
+        return;
+    }
+    long long start = nowMicros();
+    sem_wait(sem);
+    recordSemaphoreWait(metrics, nowMicros() - start);
+}
 
 void handle_alarm(int sig) {
+    (void)sig;
     terminate = 1;
-    sem_post(&newAutomobile); // Unblock any waiting threads
-    sem_post(&newPickup); // Unblock any waiting threads
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        sem_post(&lots[type].newVehicle); // Unblock any waiting threads
+    }
+}
+
+// Takes one unit of counter unless it would drop below zero
+int tryTake(atomic_int* counter) {
+    int value = atomic_load(counter);
+    while (value > 0) {
+        if (atomic_compare_exchange_weak(counter, &value, value - 1)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Adds one unit to counter unless it would pass limit
+int tryGive(atomic_int* counter, int limit) {
+    int value = atomic_load(counter);
+    while (value < limit) {
+        if (atomic_compare_exchange_weak(counter, &value, value + 1)) {
+            return 1;
+        }
+    }
+    return 0;
 }
 
 void* carOwner(void* param) {
-    int vehicleType = *(int*)param;
-    free(param); // Free the allocated memory for vehicleType
+    ModelThread* self = param;
+    int vehicleType = self->vehicleType;
+    ParkingLot* lot = &lots[vehicleType];
 
     while (!terminate) {
         usleep(rand() % 1000000); // Random delay to simulate arrival times
-
-        sem_wait(&entryMutex); // Only one vehicle can enter the attempt to park
-        pthread_mutex_lock(&mutexParking);
-
         if (terminate) {
-            pthread_mutex_unlock(&mutexParking);
-            sem_post(&entryMutex);
             break;
         }
+        long long arrival = nowMicros();
+        self->metrics.totals.arrivals++;
 
         // Check if all permanent spots are filled
-        if ((vehicleType == 0 && mFree_automobile >= MAX_AUTOMOBILES) ||
-            (vehicleType == 1 && mFree_pickup >= MAX_PICKUPS)) {
-               
-            if ((vehicleType == 0 && free_auto > 0) ||
-                (vehicleType == 1 && free_pickup > 0)) {
-                if (vehicleType == 0) {
-                    
-                    free_auto--;
-                    printf("Automobile owner parked in temporary lot but no permanent spots left.\n");
-                    free_auto++;
-                } else {
-                   
-                    free_pickup--;
-                    printf("Pickup owner parked in temporary lot but no permanent spots left.\n");
-                    free_pickup++;
-                }
+        if (atomic_load(&lot->permanent) >= lot->maxPermanent) {
+            if (atomic_load(&lot->freeTemporary) > 0) {
+                report("%s owner parked in temporary lot but no permanent spots left.\n", vehicleNames[vehicleType]);
             }
-            pthread_mutex_unlock(&mutexParking);
-            sem_post(&entryMutex);
+            self->metrics.totals.leftFull++;
             break;
         }
 
-        // Check for available temporary spot
-        if ((vehicleType == 0 && free_auto > 0) ||
-            (vehicleType == 1 && free_pickup > 0)) {
-            if (vehicleType == 0) {
-                free_auto--;
-            } else {
-                free_pickup--;
-            }
-            pthread_mutex_unlock(&mutexParking);
-            printf("%s owner parked in temporary lot. Vale looks for an empty spot for %s.\n", vehicleType == 0 ? "Automobile" : "Pickup", vehicleType == 0 ? "Automobile" : "Pickup");
-            sem_post(vehicleType == 0 ? &newAutomobile : &newPickup);
-            sem_post(&entryMutex);
-            sem_wait(vehicleType == 0 ? &inChargeforAutomobile : &inChargeforPickup); // Wait for attendant to park in permanent spot
+        // Reserve the temporary spot
+        if (tryTake(&lot->freeTemporary)) {
+            report("%s owner parked in temporary lot. Vale looks for an empty spot for %s.\n",
+                   vehicleNames[vehicleType], vehicleNames[vehicleType]);
+            sem_post(&lot->newVehicle);
+            timedWait(&lot->inCharge, &self->metrics); // Wait for attendant to park in permanent spot
+            recordWait(&self->metrics, nowMicros() - arrival);
         } else {
-            pthread_mutex_unlock(&mutexParking);
-            printf("No temporary spots available. %s owner left.\n", vehicleType == 0 ? "Automobile" : "Pickup");
-            sem_post(&entryMutex);
+            report("No temporary spots available. %s owner left.\n", vehicleNames[vehicleType]);
+            self->metrics.totals.leftNoTemporary++;
             break;
         }
     }
@@ -89,115 +369,981 @@ void* carOwner(void* param) {
 }
 
 void* carAttendant(void* param) {
-    int vehicleType = *(int*)param;
-    sem_t* myNewSem = vehicleType == 0 ? &newAutomobile : &newPickup;
-    sem_t* myInChargeSem = vehicleType == 0 ? &inChargeforAutomobile : &inChargeforPickup;
-    int* myPermanentCounter = vehicleType == 0 ? &mFree_automobile : &mFree_pickup;
-    int maxSpots = vehicleType == 0 ? MAX_AUTOMOBILES : MAX_PICKUPS;
+    ModelThread* self = param;
+    int vehicleType = self->vehicleType;
+    ParkingLot* lot = &lots[vehicleType];
 
     while (1) {
-        sem_wait(myNewSem); // Wait for a vehicle to be ready to move to permanent
-
-        pthread_mutex_lock(&mutexParking);
-
+        timedWait(&lot->newVehicle, &self->metrics); // Wait for a vehicle to be ready to move to permanent
         if (terminate) {
-            pthread_mutex_unlock(&mutexParking);
             break;
         }
 
-        if (*myPermanentCounter < maxSpots) {
-            (*myPermanentCounter)++;
-            printf("%s moved to permanent lot by vale. Remaining permanent %s spots: %d.\n",
-                   vehicleType == 0 ? "Automobile" : "Pickup",
-                   vehicleType == 0 ? "automobile" : "pickup",
-                   maxSpots - *myPermanentCounter);
-            if (vehicleType == 0) {
-                free_auto++;
-            } else {
-                free_pickup++;
-            }
-            sem_post(myInChargeSem); // Notify the car owner that the vehicle is parked
+        long long start = nowMicros();
+        if (tryGive(&lot->permanent, lot->maxPermanent)) {
+            report("%s moved to permanent lot by vale. Remaining permanent %s spots: %d.\n",
+                   vehicleNames[vehicleType], vehicleSpotNames[vehicleType],
+                   lot->maxPermanent - atomic_load(&lot->permanent));
+            atomic_fetch_add(&lot->freeTemporary, 1);
+            sem_post(&lot->inCharge); // Notify the car owner that the vehicle is parked
+            self->metrics.totals.parked++;
         }
-
-        pthread_mutex_unlock(&mutexParking);
+        self->metrics.busy[vehicleType] += nowMicros() - start;
     }
     return NULL;
 }
 
 void* vehicleDeparture(void* param) {
+    ModelThread* self = param;
     while (!terminate) {
         sleep(2); // Wait for 5 seconds before removing a vehicle
 
-        pthread_mutex_lock(&mutexParking);
-        if (mFree_automobile > 0 && (rand() % 2 == 0 || mFree_pickup == 0)) {
-            mFree_automobile--;
-            printf("Automobile left the permanent lot. Remaining permanent automobile spots: %d.\n", MAX_AUTOMOBILES - mFree_automobile);
-            free_auto++;
-            sem_post(&newAutomobile);
-            printf("Automobile owner parked in temporary lot. Vale looks for an empty spot for Automobile.\n"); // New vehicle parks in the temporary lot
-        } else if (mFree_pickup > 0) {
-            mFree_pickup--;
-            printf("Pickup left the permanent lot. Remaining permanent pickup spots: %d.\n", MAX_PICKUPS - mFree_pickup);
-            free_pickup++;
-            sem_post(&newPickup);
-            printf("Pickup owner parked in temporary lot. Vale looks for an empty spot for Pickup.\n"); // New vehicle parks in the temporary lot
-        }
-        pthread_mutex_unlock(&mutexParking);
+        int type = rand() % 2 == 0 || atomic_load(&lots[1].permanent) == 0 ? 0 : 1;
+        if (!tryTake(&lots[type].permanent)) {
+            type = 1 - type;
+            if (!tryTake(&lots[type].permanent)) {
+                continue; // Both lots are empty
+            }
+        }
+        ParkingLot* lot = &lots[type];
+        self->metrics.totals.departures++;
+        report("%s left the permanent lot. Remaining permanent %s spots: %d.\n", vehicleNames[type],
+               vehicleSpotNames[type], lot->maxPermanent - atomic_load(&lot->permanent));
+        atomic_fetch_add(&lot->freeTemporary, 1);
+        sem_post(&lot->newVehicle);
+        report("%s owner parked in temporary lot. Vale looks for an empty spot for %s.\n", vehicleNames[type],
+               vehicleNames[type]); // New vehicle parks in the temporary lot
     }
     return NULL;
 }
 
-int main() {
+void initLots(void) {
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        atomic_init(&lots[type].freeTemporary, 1); // One temporary spot per type
+        atomic_init(&lots[type].permanent, 0);
+        lots[type].maxPermanent = type == 0 ? MAX_AUTOMOBILES : MAX_PICKUPS;
+        sem_init(&lots[type].newVehicle, 0, 0);
+        sem_init(&lots[type].inCharge, 0, 0);
+    }
+}
+
+void destroyLots(void) {
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        sem_destroy(&lots[type].newVehicle);
+        sem_destroy(&lots[type].inCharge);
+    }
+}
+
+// Occupied spots right now; the temporary count saturates at zero, since a departure
+// frees a temporary spot that nobody took
+OccupancySample sampleLots(long long time) {
+    OccupancySample sample = {.time = time};
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        int freeTemporary = atomic_load(&lots[type].freeTemporary);
+        sample.permanent[type] = atomic_load(&lots[type].permanent);
+        sample.temporary[type] = freeTemporary < 1 ? 1 - freeTemporary : 0;
+    }
+    return sample;
+}
+
+// Runs the thread-per-owner model for 20 seconds of wall-clock time
+int runThreadedModel(int owners, const MetricsOptions* options) {
     signal(SIGALRM, handle_alarm);
     alarm(20); // Set an alarm for 20 seconds
 
     srand(time(NULL));
-    pthread_t carOwnerThreads[NUM_CAR_OWNERS];
-    pthread_t autoAttendantThread, pickupAttendantThread, departureThread;
-
-    sem_init(&newAutomobile, 0, 0);
-    sem_init(&inChargeforAutomobile, 0, 0);
-    sem_init(&newPickup, 0, 0);
-    sem_init(&inChargeforPickup, 0, 0);
-    sem_init(&entryMutex, 0, 1);
-    pthread_mutex_init(&mutexParking, NULL);
+    quiet = options->quiet;
+    pthread_t* carOwnerThreads = malloc(owners * sizeof(pthread_t));
+    pthread_t attendantThreads[VEHICLE_TYPES], departureThread;
+    // Owners first, then one attendant per type, then the departure thread
+    ModelThread* threads = calloc(owners + VEHICLE_TYPES + 1, sizeof(ModelThread));
+    ModelThread* attendants = threads + owners;
+    ModelThread* departure = attendants + VEHICLE_TYPES;
+    OccupancySeries occupancy = {0};
+    if (carOwnerThreads == NULL || threads == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    initLots();
+    long long start = nowMicros();
 
     // Create car owner threads with random vehicle types
-    for (int i = 0; i < NUM_CAR_OWNERS; i++) {
-        int* vehicleType = malloc(sizeof(int));
-        *vehicleType = rand() % 2; // Randomly choose between 0 (automobile) and 1 (pickup)
-        pthread_create(&carOwnerThreads[i], NULL, carOwner, vehicleType);
+    for (int i = 0; i < owners; i++) {
+        threads[i].vehicleType = rand() % 2; // Randomly choose between 0 (automobile) and 1 (pickup)
+        pthread_create(&carOwnerThreads[i], NULL, carOwner, &threads[i]);
     }
 
     // Create attendant threads
-    int autoType = 0, pickupType = 1;
-    pthread_create(&autoAttendantThread, NULL, carAttendant, &autoType);
-    pthread_create(&pickupAttendantThread, NULL, carAttendant, &pickupType);
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        attendants[type].vehicleType = type;
+        pthread_create(&attendantThreads[type], NULL, carAttendant, &attendants[type]);
+    }
 
     // Create vehicle departure thread
-    pthread_create(&departureThread, NULL, vehicleDeparture, NULL);
+    pthread_create(&departureThread, NULL, vehicleDeparture, departure);
 
-    // Sleep for 20 seconds before termination
-    sleep(20);
+    // Sample the lots for 20 seconds before termination
+    long long end = start + 20 * 1000000LL, now;
+    while (!terminate && (now = nowMicros()) < end) {
+        long long next = now + options->sampleInterval;
+        usleep((next < end ? next : end) - now); // SIGALRM cuts the last one short
+        OccupancySample sample = sampleLots(nowMicros() - start);
+        if (recordOccupancy(&occupancy, &sample) < 0) {
+            break;
+        }
+    }
     terminate = 1; // Signal termination
 
     // Wait for car owner threads to complete
-    for (int i = 0; i < NUM_CAR_OWNERS; i++) {
+    for (int i = 0; i < owners; i++) {
         pthread_join(carOwnerThreads[i], NULL);
     }
 
     // Wait for departure and attendant threads to complete
     pthread_join(departureThread, NULL);
-    pthread_join(autoAttendantThread, NULL);
-    pthread_join(pickupAttendantThread, NULL);
-
-    sem_destroy(&newAutomobile);
-    sem_destroy(&inChargeforAutomobile);
-    sem_destroy(&newPickup);
-    sem_destroy(&inChargeforPickup);
-    sem_destroy(&entryMutex);
-    pthread_mutex_destroy(&mutexParking);
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        pthread_join(attendantThreads[type], NULL);
+    }
+    long long elapsed = nowMicros() - start;
 
+    Metrics metrics = {0};
+    for (int i = 0; i < owners + VEHICLE_TYPES + 1; i++) {
+        mergeMetrics(&metrics, &threads[i].metrics);
+    }
+    destroyLots();
+    free(carOwnerThreads);
+    free(threads);
     printf("Simulation complete. All vehicles processed.\n");
+    MetricsContext context = {"threaded", elapsed, {1, 1}, &occupancy};
+    int status = exportMetrics(options->path, options->format, &metrics, &context);
+    free(occupancy.samples);
+    return status < 0 ? EXIT_FAILURE : 0;
+}
+
+/* ---- Contention benchmark ----
+ * Owner threads run one vehicle's critical sections back to back, without sleeps or
+ * printing: take the temporary spot, move to a permanent spot, leave. The global lock
+ * variant is the old entryMutex + mutexParking scheme, the other the per-lot CAS.
+ * Attempts include the ones turned away by a full lot, which cost the CAS variant a
+ * single load, so the two are compared on completed parkings.
+ */
+
+typedef struct {
+    sem_t entryMutex;
+    pthread_mutex_t mutexParking;
+    int freeTemporary[VEHICLE_TYPES], permanent[VEHICLE_TYPES];
+    ParkingLot lots[VEHICLE_TYPES];
+    pthread_barrier_t start;
+    int attempts; // Per thread
+} BenchState;
+
+typedef struct {
+    BenchState* state;
+    int vehicleType, locked;
+    long parkings; // Vehicles that went through temporary, permanent and left
+} BenchOwner;
+
+typedef struct {
+    double attempts; // Per second
+    double parkings; // Per second
+} BenchResult;
+
+void* benchOwner(void* param) {
+    BenchOwner* owner = param;
+    BenchState* state = owner->state;
+    int type = owner->vehicleType, maxPermanent = type == 0 ? MAX_AUTOMOBILES : MAX_PICKUPS;
+    ParkingLot* lot = &state->lots[type];
+    long parkings = 0;
+    pthread_barrier_wait(&state->start);
+    for (int i = 0; i < state->attempts; i++) {
+        if (owner->locked) {
+            sem_wait(&state->entryMutex);
+            pthread_mutex_lock(&state->mutexParking);
+            int taken = state->permanent[type] < maxPermanent && state->freeTemporary[type] > 0;
+            state->freeTemporary[type] -= taken;
+            pthread_mutex_unlock(&state->mutexParking);
+            sem_post(&state->entryMutex);
+            if (taken) {
+                pthread_mutex_lock(&state->mutexParking); // Attendant
+                state->permanent[type]++;
+                state->freeTemporary[type]++;
+                pthread_mutex_unlock(&state->mutexParking);
+                pthread_mutex_lock(&state->mutexParking); // Departure
+                state->permanent[type]--;
+                pthread_mutex_unlock(&state->mutexParking);
+                parkings++;
+            }
+        } else if (atomic_load(&lot->permanent) < lot->maxPermanent && tryTake(&lot->freeTemporary)) {
+            if (tryGive(&lot->permanent, lot->maxPermanent)) {
+                atomic_fetch_add(&lot->freeTemporary, 1);
+                tryTake(&lot->permanent);
+                parkings++;
+            } else {
+                atomic_fetch_add(&lot->freeTemporary, 1); // Lot filled up meanwhile
+            }
+        }
+    }
+    owner->parkings = parkings;
+    return NULL;
+}
+
+// Runs BENCH_ATTEMPTS attempts on threads owners; rates are -1 if it could not start
+BenchResult benchRound(int threads, int locked) {
+    static BenchState state;
+    BenchResult result = {-1, -1};
+    pthread_t* ids = malloc(threads * sizeof(pthread_t));
+    BenchOwner* owners = calloc(threads, sizeof(BenchOwner));
+    if (ids == NULL || owners == NULL) {
+        perror("malloc");
+        free(ids);
+        free(owners);
+        return result;
+    }
+    sem_init(&state.entryMutex, 0, 1);
+    pthread_mutex_init(&state.mutexParking, NULL);
+    for (int type = 0; type < VEHICLE_TYPES; type++) {
+        state.freeTemporary[type] = 1;
+        state.permanent[type] = 0;
+        atomic_init(&state.lots[type].freeTemporary, 1);
+        atomic_init(&state.lots[type].permanent, 0);
+        state.lots[type].maxPermanent = type == 0 ? MAX_AUTOMOBILES : MAX_PICKUPS;
+    }
+    state.attempts = BENCH_ATTEMPTS / threads;
+    pthread_barrier_init(&state.start, NULL, threads + 1);
+
+    for (int i = 0; i < threads; i++) {
+        owners[i] = (BenchOwner){&state, i % VEHICLE_TYPES, locked, 0};
+        if (pthread_create(&ids[i], NULL, benchOwner, &owners[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE); // The barrier would never open
+        }
+    }
+    // Every owner is already waiting, so the clock starts right before they are let go;
+    // reading it after the barrier would miss owners that ran before this thread resumed
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_barrier_wait(&state.start);
+    for (int i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    long parkings = 0;
+    for (int i = 0; i < threads; i++) {
+        parkings += owners[i].parkings;
+    }
+
+    pthread_barrier_destroy(&state.start);
+    pthread_mutex_destroy(&state.mutexParking);
+    sem_destroy(&state.entryMutex);
+    free(ids);
+    free(owners);
+    result.attempts = seconds > 0 ? (double)state.attempts * threads / seconds : 0;
+    result.parkings = seconds > 0 ? parkings / seconds : 0;
+    return result;
+}
+
+int runContentionBenchmark(int maxThreads) {
+    printf("Contention benchmark: %d parking attempts per run; speedup compares parkings/s\n", BENCH_ATTEMPTS);
+    printf("%8s %28s %28s %10s\n", "", "global lock", "per-lot CAS", "");
+    printf("%8s %14s %13s %14s %13s %10s\n", "threads", "attempts/s", "parkings/s", "attempts/s", "parkings/s",
+           "speedup");
+    for (int threads = 1;; threads *= 2) {
+        threads = threads < maxThreads ? threads : maxThreads;
+        BenchResult locked = benchRound(threads, 1);
+        BenchResult cas = benchRound(threads, 0);
+        if (locked.attempts < 0 || cas.attempts < 0) {
+            return EXIT_FAILURE;
+        }
+        printf("%8d %14.0f %13.0f %14.0f %13.0f %9.1fx\n", threads, locked.attempts, locked.parkings, cas.attempts,
+               cas.parkings, locked.parkings > 0 ? cas.parkings / locked.parkings : 0);
+        if (threads == maxThreads) {
+            break;
+        }
+    }
     return 0;
 }
+
+/* ---- Discrete-event simulation ----
+ * The threaded model above needs one thread per owner and real sleeps. The simulator
+ * replays the same rules as events on a virtual clock: owners, attendants and the
+ * departure thread become event handlers, and the semaphores become counters with
+ * queues of blocked owners, so a day of traffic runs in a fraction of a second.
+ */
+
+enum { EVENT_ARRIVAL, EVENT_VALET_DONE, EVENT_DEPARTURE, EVENT_SAMPLE };
+
+typedef struct {
+    long long time;          // Virtual time in microseconds
+    unsigned long long order; // Equal times run in scheduling order
+    int kind;
+    int subject; // Owner for arrivals, attendant for valet moves, lot for departures
+} SimEvent;
+
+// Binary min-heap ordered by (time, order)
+typedef struct {
+    SimEvent* events;
+    size_t count, capacity;
+    unsigned long long nextOrder;
+} EventQueue;
+
+// A semaphore in virtual time: its value plus the FIFO of entities blocked on it
+typedef struct {
+    int value;
+    int* waiters;
+    int head, count, capacity;
+} SimSemaphore;
+
+typedef struct Simulation Simulation;
+
+// Picks the lot an arriving owner drives to
+typedef int (*RoutePolicy)(Simulation* sim, int owner, int type);
+
+typedef struct {
+    int owners, replications, workers, verbose;
+    long long duration, meanArrival, valetTime, departureInterval;
+    unsigned int seed;
+    int lots, attendants, temporary;         // Attendants and temporary spots per type and lot
+    int* capacities;                         // Permanent spots, lot * VEHICLE_TYPES + type
+    const char* routeName;
+    RoutePolicy route;
+    MetricsOptions metrics;
+} SimConfig;
+
+// One lot's shard of the state: only events routed to this lot touch it
+typedef struct {
+    int freeTemporary[VEHICLE_TYPES], permanent[VEHICLE_TYPES], maxPermanent[VEHICLE_TYPES];
+    SimSemaphore newVehicle[VEHICLE_TYPES], inCharge[VEHICLE_TYPES];
+    SimTotals totals;
+} SimLot;
+
+struct Simulation {
+    const SimConfig* config;
+    unsigned int seed;
+    int trace;
+    long long now;
+    unsigned long long events;
+    EventQueue queue;
+    unsigned char* ownerTypes;
+    int* ownerHomes; // Lot nearest to each owner; lots stand in a row
+    SimLot* lots;
+    // Attendant a of type t in lot l is (l * VEHICLE_TYPES + t) * attendants + a
+    long long *ownerSince, *attendantSince; // When each one blocked
+    Metrics* metrics;
+    OccupancySeries* occupancy; // NULL if this replication is not sampled
+};
+
+static int earlier(const SimEvent* a, const SimEvent* b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+static int eventPush(EventQueue* queue, long long time, int kind, int subject) {
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity ? queue->capacity * 2 : 1024;
+        SimEvent* events = realloc(queue->events, capacity * sizeof(SimEvent));
+        if (events == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        queue->events = events;
+        queue->capacity = capacity;
+    }
+    SimEvent event = {time, queue->nextOrder++, kind, subject};
+    size_t i = queue->count++;
+    while (i > 0 && earlier(&event, &queue->events[(i - 1) / 2])) {
+        queue->events[i] = queue->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    queue->events[i] = event;
+    return 0;
+}
+
+static SimEvent eventPop(EventQueue* queue) {
+    SimEvent top = queue->events[0], last = queue->events[--queue->count];
+    size_t i = 0, child;
+    while ((child = 2 * i + 1) < queue->count) {
+        if (child + 1 < queue->count && earlier(&queue->events[child + 1], &queue->events[child])) {
+            child++;
+        }
+        if (!earlier(&queue->events[child], &last)) {
+            break;
+        }
+        queue->events[i] = queue->events[child];
+        i = child;
+    }
+    queue->events[i] = last;
+    return top;
+}
+
+static void semInit(SimSemaphore* sem) {
+    *sem = (SimSemaphore){0};
+}
+
+// sem_wait(): returns 1 if who passes at once, 0 if it is now blocked, -1 on failure
+static int semWait(SimSemaphore* sem, int who) {
+    if (sem->value > 0) {
+        sem->value--;
+        return 1;
+    }
+    if (sem->count == sem->capacity) { // Grow the ring, unwrapping it
+        int capacity = sem->capacity ? sem->capacity * 2 : 16;
+        int* waiters = malloc(capacity * sizeof(int));
+        if (waiters == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        for (int i = 0; i < sem->count; i++) {
+            waiters[i] = sem->waiters[(sem->head + i) % sem->capacity];
+        }
+        free(sem->waiters);
+        *sem = (SimSemaphore){sem->value, waiters, 0, sem->count, capacity};
+    }
+    sem->waiters[(sem->head + sem->count++) % sem->capacity] = who;
+    return 0;
+}
+
+// sem_post(): returns the entity it unblocks, or -1 if the value went up instead
+static int semPost(SimSemaphore* sem) {
+    if (sem->count == 0) {
+        sem->value++;
+        return -1;
+    }
+    int who = sem->waiters[sem->head];
+    sem->head = (sem->head + 1) % sem->capacity;
+    sem->count--;
+    return who;
+}
+
+// Uniform in [0, bound), like rand() % bound for bounds past RAND_MAX
+static long long simRandom(Simulation* sim, long long bound) {
+    unsigned long long value = (unsigned long long)rand_r(&sim->seed) << 31 | rand_r(&sim->seed);
+    return bound > 0 ? (long long)(value % bound) : 0;
+}
+
+static void simTrace(const Simulation* sim, int lot, const char* format, const char* name, const char* spot,
+                     int count) {
+    if (sim->trace) {
+        printf("[%12.6f] ", sim->now / 1e6);
+        if (sim->config->lots > 1) {
+            printf("Lot %d: ", lot);
+        }
+        printf(format, name, spot, count);
+        printf("\n");
+    }
+}
+
+// How much room a lot has for type: a free temporary spot first, then permanent spots
+static long long lotRoom(const SimLot* lot, int type) {
+    return (long long)(lot->freeTemporary[type] > 0) << 32 | (lot->maxPermanent[type] - lot->permanent[type]);
+}
+
+static int routeRandom(Simulation* sim, int owner, int type) {
+    (void)owner;
+    (void)type;
+    return simRandom(sim, sim->config->lots);
+}
+
+// The lot with the most room for the type; ties go to the lower index
+static int routeLeastLoaded(Simulation* sim, int owner, int type) {
+    (void)owner;
+    int best = 0;
+    for (int lot = 1; lot < sim->config->lots; lot++) {
+        if (lotRoom(&sim->lots[lot], type) > lotRoom(&sim->lots[best], type)) {
+            best = lot;
+        }
+    }
+    return best;
+}
+
+// The closest lot to the owner's home that still has a permanent spot, else home
+static int routeNearest(Simulation* sim, int owner, int type) {
+    int home = sim->ownerHomes[owner];
+    for (int distance = 0; distance < sim->config->lots; distance++) {
+        int candidates[2] = {home - distance, home + distance};
+        for (int i = 0; i < (distance == 0 ? 1 : 2); i++) {
+            int lot = candidates[i];
+            if (lot >= 0 && lot < sim->config->lots && sim->lots[lot].permanent[type] < sim->lots[lot].maxPermanent[type]) {
+                return lot;
+            }
+        }
+    }
+    return home;
+}
+
+static const struct {
+    const char* name;
+    RoutePolicy route;
+} routePolicies[] = {
+    {"least-loaded", routeLeastLoaded},
+    {"nearest", routeNearest},
+    {"random", routeRandom},
+};
+
+static int scheduleArrival(Simulation* sim, int owner) {
+    return eventPush(&sim->queue, sim->now + simRandom(sim, 2 * sim->config->meanArrival), EVENT_ARRIVAL, owner);
+}
+
+// sem_post(newAutomobile/newPickup): an idle attendant of the lot starts moving the vehicle
+static int postNewVehicle(Simulation* sim, int lot, int type) {
+    int attendant = semPost(&sim->lots[lot].newVehicle[type]);
+    if (attendant < 0) {
+        return 0;
+    }
+    recordSemaphoreWait(sim->metrics, sim->now - sim->attendantSince[attendant]);
+    return eventPush(&sim->queue, sim->now + sim->config->valetTime, EVENT_VALET_DONE, attendant);
+}
+
+// carOwner() after its sleep: park in the temporary spot and block until the valet is done
+static int ownerArrives(Simulation* sim, int owner) {
+    int type = sim->ownerTypes[owner], index = sim->config->route(sim, owner, type);
+    SimLot* lot = &sim->lots[index];
+    lot->totals.arrivals++;
+    if (lot->permanent[type] >= lot->maxPermanent[type]) {
+        if (lot->freeTemporary[type] > 0) {
+            simTrace(sim, index, "%s owner parked in temporary lot but no permanent spots left.", vehicleNames[type],
+                     "", 0);
+        }
+        lot->totals.leftFull++;
+        return 0;
+    }
+    if (lot->freeTemporary[type] == 0) {
+        simTrace(sim, index, "No temporary spots available. %s owner left.", vehicleNames[type], "", 0);
+        lot->totals.leftNoTemporary++;
+        return 0;
+    }
+    lot->freeTemporary[type]--;
+    simTrace(sim, index, "%s owner parked in temporary lot. Vale looks for an empty spot for %s.",
+             vehicleNames[type], vehicleNames[type], 0);
+    if (postNewVehicle(sim, index, type) < 0) {
+        return -1;
+    }
+    int passed = semWait(&lot->inCharge[type], owner);
+    if (passed > 0) {
+        recordWait(sim->metrics, 0);
+        return scheduleArrival(sim, owner);
+    }
+    sim->ownerSince[owner] = sim->now;
+    return passed;
+}
+
+// carAttendant() once the move is over, then back to sem_wait() for the next vehicle
+static int valetDone(Simulation* sim, int attendant) {
+    int index = attendant / sim->config->attendants / VEHICLE_TYPES;
+    int type = attendant / sim->config->attendants % VEHICLE_TYPES;
+    SimLot* lot = &sim->lots[index];
+    sim->metrics->busy[type] += sim->config->valetTime;
+    if (lot->permanent[type] < lot->maxPermanent[type]) {
+        lot->permanent[type]++;
+        lot->totals.parked++;
+        simTrace(sim, index, "%s moved to permanent lot by vale. Remaining permanent %s spots: %d.",
+                 vehicleNames[type], vehicleSpotNames[type], lot->maxPermanent[type] - lot->permanent[type]);
+        lot->freeTemporary[type]++;
+        int owner = semPost(&lot->inCharge[type]);
+        if (owner >= 0) {
+            recordWait(sim->metrics, sim->now - sim->ownerSince[owner]);
+            recordSemaphoreWait(sim->metrics, sim->now - sim->ownerSince[owner]);
+            if (scheduleArrival(sim, owner) < 0) {
+                return -1;
+            }
+        }
+    }
+    int passed = semWait(&lot->newVehicle[type], attendant);
+    if (passed > 0) {
+        return eventPush(&sim->queue, sim->now + sim->config->valetTime, EVENT_VALET_DONE, attendant);
+    }
+    sim->attendantSince[attendant] = sim->now;
+    return passed;
+}
+
+// vehicleDeparture() of one lot: a vehicle leaves and, as in the threaded model, hands
+// the valet a new one from the temporary lot
+static int vehicleLeaves(Simulation* sim, int index) {
+    SimLot* lot = &sim->lots[index];
+    int type = -1;
+    if (lot->permanent[0] > 0 && (rand_r(&sim->seed) % 2 == 0 || lot->permanent[1] == 0)) {
+        type = 0;
+    } else if (lot->permanent[1] > 0) {
+        type = 1;
+    }
+    if (type >= 0) {
+        lot->permanent[type]--;
+        lot->totals.departures++;
+        simTrace(sim, index, "%s left the permanent lot. Remaining permanent %s spots: %d.", vehicleNames[type],
+                 vehicleSpotNames[type], lot->maxPermanent[type] - lot->permanent[type]);
+        lot->freeTemporary[type]++;
+        if (postNewVehicle(sim, index, type) < 0) {
+            return -1;
+        }
+    }
+    return eventPush(&sim->queue, sim->now + sim->config->departureInterval, EVENT_DEPARTURE, index);
+}
+
+// Occupied spots over all lots; temporary counts saturate at zero as in the threaded model
+static int sampleOccupancy(Simulation* sim) {
+    OccupancySample sample = {.time = sim->now};
+    for (int index = 0; index < sim->config->lots; index++) {
+        for (int type = 0; type < VEHICLE_TYPES; type++) {
+            int freeTemporary = sim->lots[index].freeTemporary[type];
+            sample.permanent[type] += sim->lots[index].permanent[type];
+            sample.temporary[type] += freeTemporary < sim->config->temporary ? sim->config->temporary - freeTemporary : 0;
+        }
+    }
+    if (recordOccupancy(sim->occupancy, &sample) < 0) {
+        return -1;
+    }
+    return eventPush(&sim->queue, sim->now + sim->config->metrics.sampleInterval, EVENT_SAMPLE, 0);
+}
+
+static void simulationFree(Simulation* sim) {
+    free(sim->queue.events);
+    free(sim->ownerTypes);
+    free(sim->ownerHomes);
+    free(sim->ownerSince);
+    free(sim->attendantSince);
+    for (int lot = 0; sim->lots != NULL && lot < sim->config->lots; lot++) {
+        for (int type = 0; type < VEHICLE_TYPES; type++) {
+            free(sim->lots[lot].newVehicle[type].waiters);
+            free(sim->lots[lot].inCharge[type].waiters);
+        }
+    }
+    free(sim->lots);
+}
+
+// Runs one replication until the virtual clock passes the configured duration; totals
+// receives one entry per lot, metrics and occupancy (if not NULL) this run's buffers
+static int runSimulation(const SimConfig* config, unsigned int seed, int trace, SimTotals* totals,
+                         unsigned long long* events, Metrics* metrics, OccupancySeries* occupancy) {
+    Simulation sim = {.config = config, .seed = seed, .trace = trace, .metrics = metrics, .occupancy = occupancy};
+    int status = 0;
+    sim.ownerTypes = malloc(config->owners);
+    sim.ownerHomes = malloc(config->owners * sizeof(int));
+    sim.ownerSince = malloc(config->owners * sizeof(long long));
+    sim.attendantSince = calloc((size_t)config->lots * VEHICLE_TYPES * config->attendants, sizeof(long long));
+    sim.lots = calloc(config->lots, sizeof(SimLot));
+    if (sim.ownerTypes == NULL || sim.ownerHomes == NULL || sim.ownerSince == NULL || sim.attendantSince == NULL ||
+        sim.lots == NULL) {
+        perror("malloc");
+        simulationFree(&sim);
+        return -1;
+    }
+    for (int index = 0; index < config->lots && status == 0; index++) {
+        SimLot* lot = &sim.lots[index];
+        for (int type = 0; type < VEHICLE_TYPES; type++) {
+            lot->freeTemporary[type] = config->temporary;
+            lot->maxPermanent[type] = config->capacities[index * VEHICLE_TYPES + type];
+            semInit(&lot->newVehicle[type]);
+            semInit(&lot->inCharge[type]);
+            int first = (index * VEHICLE_TYPES + type) * config->attendants;
+            for (int attendant = first; attendant < first + config->attendants && status == 0; attendant++) {
+                status = semWait(&lot->newVehicle[type], attendant); // Attendants start out waiting
+            }
+        }
+        if (status == 0) {
+            status = eventPush(&sim.queue, config->departureInterval, EVENT_DEPARTURE, index);
+        }
+    }
+    for (int owner = 0; owner < config->owners && status == 0; owner++) {
+        sim.ownerTypes[owner] = rand_r(&sim.seed) % 2;
+        sim.ownerHomes[owner] = rand_r(&sim.seed) % config->lots;
+        status = scheduleArrival(&sim, owner);
+    }
+    if (status == 0 && occupancy != NULL) {
+        status = eventPush(&sim.queue, 0, EVENT_SAMPLE, 0);
+    }
+
+    while (status == 0 && sim.queue.count > 0 && sim.queue.events[0].time <= config->duration) {
+        SimEvent event = eventPop(&sim.queue);
+        sim.now = event.time;
+        sim.events++;
+        if (event.kind == EVENT_ARRIVAL) {
+            status = ownerArrives(&sim, event.subject);
+        } else if (event.kind == EVENT_VALET_DONE) {
+            status = valetDone(&sim, event.subject);
+        } else if (event.kind == EVENT_DEPARTURE) {
+            status = vehicleLeaves(&sim, event.subject);
+        } else {
+            status = sampleOccupancy(&sim);
+        }
+    }
+    for (int index = 0; index < config->lots; index++) {
+        SimLot* lot = &sim.lots[index];
+        lot->totals.waitingOwners = lot->inCharge[0].count + lot->inCharge[1].count;
+        totals[index] = lot->totals;
+        addTotals(&metrics->totals, &lot->totals);
+    }
+    *events = sim.events;
+    simulationFree(&sim);
+    return status;
+}
+
+static void printTotals(const char* label, int index, const SimTotals* totals) {
+    printf("%s %d: %llu arrivals, %llu moved to permanent lot, %llu departures, "
+           "%llu left (lot full), %llu left (no temporary spot), %d still waiting\n",
+           label, index, totals->arrivals, totals->parked, totals->departures, totals->leftFull,
+           totals->leftNoTemporary, totals->waitingOwners);
+}
+
+typedef struct {
+    const SimConfig* config;
+    SimTotals* results; // replications x lots
+    unsigned long long* events;
+    Metrics* metrics;          // One buffer per replication, merged at the end
+    OccupancySeries occupancy; // Sampled from replication 0
+    int* statuses;
+    int next; // Next replication to hand out
+    pthread_mutex_t lock;
+} SimPool;
+
+// Worker: replications are independent, so each one runs start to finish on one thread
+static void* simulationWorker(void* param) {
+    SimPool* pool = param;
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        int replication = pool->next < pool->config->replications ? pool->next++ : -1;
+        pthread_mutex_unlock(&pool->lock);
+        if (replication < 0) {
+            break;
+        }
+        pool->statuses[replication] = runSimulation(pool->config, pool->config->seed + replication,
+                                                    pool->config->verbose && replication == 0,
+                                                    &pool->results[(size_t)replication * pool->config->lots],
+                                                    &pool->events[replication], &pool->metrics[replication],
+                                                    replication == 0 ? &pool->occupancy : NULL);
+    }
+    return NULL;
+}
+
+int runSimulations(const SimConfig* config) {
+    SimPool pool = {.config = config};
+    pthread_t threads[SIM_MAX_WORKERS];
+    int workers = config->workers < config->replications ? config->workers : config->replications;
+    pool.results = calloc((size_t)config->replications * config->lots, sizeof(SimTotals));
+    pool.events = calloc(config->replications, sizeof(unsigned long long));
+    pool.statuses = calloc(config->replications, sizeof(int));
+    pool.metrics = calloc(config->replications, sizeof(Metrics));
+    SimTotals* lotTotals = calloc(config->lots, sizeof(SimTotals));
+    if (pool.results == NULL || pool.events == NULL || pool.statuses == NULL || pool.metrics == NULL ||
+        lotTotals == NULL) {
+        perror("calloc");
+        return EXIT_FAILURE;
+    }
+    pthread_mutex_init(&pool.lock, NULL);
+    printf("Simulating %d owner(s) for %.0f s of virtual time, %d replication(s) on %d thread(s)\n",
+           config->owners, config->duration / 1e6, config->replications, workers);
+    printf("Topology: %d lot(s), %d attendant(s) and %d temporary spot(s) per vehicle type, routing %s\n",
+           config->lots, config->attendants, config->temporary, config->routeName);
+    fflush(stdout);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < workers; i++) {
+        pthread_create(&threads[i], NULL, simulationWorker, &pool);
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int status = 0;
+    unsigned long long events = 0;
+    Metrics metrics = {0};
+    for (int i = 0; i < config->replications; i++) {
+        if (pool.statuses[i] < 0) {
+            fprintf(stderr, "Replication %d failed\n", i);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        SimTotals replication = {0};
+        for (int lot = 0; lot < config->lots; lot++) {
+            addTotals(&replication, &pool.results[(size_t)i * config->lots + lot]);
+            addTotals(&lotTotals[lot], &pool.results[(size_t)i * config->lots + lot]);
+        }
+        events += pool.events[i];
+        mergeMetrics(&metrics, &pool.metrics[i]);
+        if (!config->metrics.quiet) {
+            printTotals("Replication", i, &replication);
+        }
+    }
+    for (int lot = 0; config->lots > 1 && !config->metrics.quiet && lot < config->lots; lot++) {
+        printTotals("Lot", lot, &lotTotals[lot]); // Summed over the replications
+    }
+    printf("Simulation complete: %llu events in %.3f s (%.0f events/s, %.0fx real time)\n", events, seconds,
+           seconds > 0 ? events / seconds : 0, seconds > 0 ? config->duration / 1e6 * config->replications / seconds : 0);
+    long long attendants = (long long)config->lots * config->attendants;
+    MetricsContext context = {"simulation", config->duration * config->replications, {attendants, attendants},
+                              &pool.occupancy};
+    if (exportMetrics(config->metrics.path, config->metrics.format, &metrics, &context) < 0) {
+        status = EXIT_FAILURE;
+    }
+
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.results);
+    free(pool.events);
+    free(pool.statuses);
+    free(pool.metrics);
+    free(pool.occupancy.samples);
+    free(lotTotals);
+    return status;
+}
+
+// Parses "auto:pickup[,auto:pickup...]" into the capacities of lots lots; the last pair
+// repeats for any lot left over. Returns NULL if the list is malformed.
+int* parseCapacities(const char* text, int lots) {
+    int* capacities = malloc(lots * VEHICLE_TYPES * sizeof(int));
+    int given = 0, consumed;
+    if (capacities == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    while (given < lots) {
+        int* pair = &capacities[given * VEHICLE_TYPES];
+        if (sscanf(text, "%d:%d%n", &pair[0], &pair[1], &consumed) != 2 || pair[0] < 0 || pair[1] < 0) {
+            break;
+        }
+        given++;
+        text += consumed;
+        if (*text != ',') {
+            break;
+        }
+        text++;
+    }
+    if (given == 0 || (*text != '\0' && given < lots)) {
+        free(capacities);
+        return NULL;
+    }
+    for (int lot = given; lot < lots; lot++) {
+        memcpy(&capacities[lot * VEHICLE_TYPES], &capacities[(given - 1) * VEHICLE_TYPES], VEHICLE_TYPES * sizeof(int));
+    }
+    return capacities;
+}
+
+RoutePolicy findRoutePolicy(const char* name) {
+    for (size_t i = 0; i < sizeof(routePolicies) / sizeof(routePolicies[0]); i++) {
+        if (strcmp(name, routePolicies[i].name) == 0) {
+            return routePolicies[i].route;
+        }
+    }
+    return NULL;
+}
+
+void printUsage(const char* program) {
+    printf("Usage: %s                 run the threaded model for 20 seconds\n", program);
+    printf("       %s -s [options]    run the discrete-event simulation\n", program);
+    printf("       %s -b [threads]    compare the global lock with per-lot CAS (default %d)\n", program,
+           BENCH_DEFAULT_THREADS);
+    printf("  -o owners      car owners, also for the threaded model (default %d)\n", NUM_CAR_OWNERS);
+    printf("  -d seconds     virtual time to simulate (default %d)\n", SIM_DEFAULT_SECONDS);
+    printf("  -a ms          mean time between an owner's arrivals (default %d)\n", SIM_DEFAULT_ARRIVAL_MS);
+    printf("  -m ms          time the valet takes to move a vehicle (default 0)\n");
+    printf("  -p ms          time between departures (default %d)\n", SIM_DEFAULT_DEPARTURE_MS);
+    printf("  -r count       independent replications (default 1)\n");
+    printf("  -w threads     worker threads for the replications (default: online CPUs)\n");
+    printf("  -S seed        seed of the first replication (default: time)\n");
+    printf("  -v             print every event of the first replication\n");
+    printf("  -n lots        parking lots (default 1)\n");
+    printf("  -c a:p[,a:p]   permanent automobile:pickup spots of each lot; the last pair repeats (default %d:%d)\n",
+           MAX_AUTOMOBILES, MAX_PICKUPS);
+    printf("  -t spots       temporary spots per vehicle type and lot (default 1)\n");
+    printf("  -A count       attendants per vehicle type and lot (default 1)\n");
+    printf("  -R policy      lot an arrival goes to: least-loaded, nearest or random (default least-loaded)\n");
+    printf("Metrics, for both models:\n");
+    printf("  -M file        export wait histogram, utilization, rejections and occupancy (- for stdout)\n");
+    printf("  -F format      export format: csv or json (default csv)\n");
+    printf("  -i ms          occupancy sampling interval (default %d)\n", DEFAULT_SAMPLE_MS);
+    printf("  -q             quiet: no per-vehicle or per-replication lines\n");
+}
+
+int main(int argc, char* argv[]) {
+    SimConfig config = {
+        .owners = NUM_CAR_OWNERS,
+        .replications = 1,
+        .workers = sysconf(_SC_NPROCESSORS_ONLN),
+        .duration = SIM_DEFAULT_SECONDS * 1000000LL,
+        .meanArrival = SIM_DEFAULT_ARRIVAL_MS * 1000LL,
+        .departureInterval = SIM_DEFAULT_DEPARTURE_MS * 1000LL,
+        .seed = time(NULL),
+        .lots = 1,
+        .attendants = 1,
+        .temporary = 1,
+        .routeName = "least-loaded",
+        .metrics = {.format = FORMAT_CSV, .sampleInterval = DEFAULT_SAMPLE_MS * 1000LL},
+    };
+    char defaultCapacities[32];
+    const char* capacities = defaultCapacities;
+    snprintf(defaultCapacities, sizeof(defaultCapacities), "%d:%d", MAX_AUTOMOBILES, MAX_PICKUPS);
+    int simulate = 0, benchmark = 0, option;
+    while ((option = getopt(argc, argv, "sbo:d:a:m:p:r:w:S:vn:c:t:A:R:M:F:i:q")) != -1) {
+        if (option == 's') {
+            simulate = 1;
+        } else if (option == 'b') {
+            benchmark = 1;
+        } else if (option == 'o' && atoi(optarg) > 0) {
+            config.owners = atoi(optarg);
+        } else if (option == 'd' && atof(optarg) > 0) {
+            config.duration = atof(optarg) * 1e6;
+        } else if (option == 'a' && atof(optarg) >= 0) {
+            config.meanArrival = atof(optarg) * 1e3;
+        } else if (option == 'm' && atof(optarg) >= 0) {
+            config.valetTime = atof(optarg) * 1e3;
+        } else if (option == 'p' && atof(optarg) > 0) {
+            config.departureInterval = atof(optarg) * 1e3;
+        } else if (option == 'r' && atoi(optarg) > 0) {
+            config.replications = atoi(optarg);
+        } else if (option == 'w' && atoi(optarg) > 0) {
+            config.workers = atoi(optarg);
+        } else if (option == 'S') {
+            config.seed = strtoul(optarg, NULL, 10);
+        } else if (option == 'v') {
+            config.verbose = 1;
+        } else if (option == 'n' && atoi(optarg) > 0) {
+            config.lots = atoi(optarg);
+        } else if (option == 'c') {
+            capacities = optarg;
+        } else if (option == 't' && atoi(optarg) > 0) {
+            config.temporary = atoi(optarg);
+        } else if (option == 'A' && atoi(optarg) > 0) {
+            config.attendants = atoi(optarg);
+        } else if (option == 'R' && findRoutePolicy(optarg) != NULL) {
+            config.routeName = optarg;
+        } else if (option == 'M') {
+            config.metrics.path = optarg;
+        } else if (option == 'F' && (strcmp(optarg, "csv") == 0 || strcmp(optarg, "json") == 0)) {
+            config.metrics.format = strcmp(optarg, "json") == 0 ? FORMAT_JSON : FORMAT_CSV;
+        } else if (option == 'i' && atof(optarg) > 0) {
+            config.metrics.sampleInterval = atof(optarg) * 1e3;
+        } else if (option == 'q') {
+            config.metrics.quiet = 1;
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (benchmark) {
+        int maxThreads = optind < argc ? atoi(argv[optind]) : BENCH_DEFAULT_THREADS;
+        if (optind + 1 < argc || maxThreads < 1) {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        return runContentionBenchmark(maxThreads);
+    }
+    if (optind != argc) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (config.workers < 1 || config.workers > SIM_MAX_WORKERS) {
+        config.workers = config.workers < 1 ? 1 : SIM_MAX_WORKERS;
+    }
+    if (!simulate) {
+        return runThreadedModel(config.owners, &config.metrics);
+    }
+    config.route = findRoutePolicy(config.routeName);
+    config.capacities = parseCapacities(capacities, config.lots);
+    if (config.capacities == NULL) {
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    int status = runSimulations(&config);
+    free(config.capacities);
+    return status;
+}